@@ -0,0 +1,352 @@
+/*
+ *
+ *  CMSC 23300 / 33300 - Networks and Distributed Systems
+ *
+ *  channels as actors for chirc project
+ *
+ *  sachs_sandler
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <pthread.h>
+#include <time.h>
+#include "simclist.h"
+#include "ircstructs.h"
+#include "prof.h"
+#include "trace.h"
+#include "config.h"
+#include "rcu.h"
+#include "chanmap.h"
+#include "history.h"
+#include "pool.h"
+#include "actor.h"
+#include "affinity.h"
+
+extern pthread_mutex_t lock;
+
+int user_send(chirc_server *server, person *user, char *msg);
+void names_patch(channel *chan, char *oldnick, char *newnick, unsigned int mode);
+
+//a mailbox is an intrusive queue that any thread can post to without locking
+//and only the thread running the channel takes jobs from. the stub keeps it
+//from ever being empty, so posting is a single exchange
+typedef struct actor_box {
+    actor_job *head;            //only touched by the thread running the channel
+    actor_job *tail;            //swapped by posters
+    actor_job stub;
+    int scheduled;              //on the run queue or being run
+    struct actor_box *next;     //on the run queue
+} actor_box;
+
+//one message to send once the global lock is let go
+typedef struct {
+    person *to;
+    char *line;
+} delivery;
+
+static chirc_server *actor_server;
+static int numworkers = 0;
+
+static pthread_mutex_t runlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t runnable = PTHREAD_COND_INITIALIZER;
+static actor_box *runhead = NULL, *runtail = NULL;
+
+static int inflight = 0;    //jobs posted and not yet done
+
+static void push(actor_box *box, actor_job *job){
+    actor_job *prev;
+
+    __atomic_store_n(&(job->next), NULL, __ATOMIC_RELAXED);
+    prev = __atomic_exchange_n(&(box->tail), job, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&(prev->next), job, __ATOMIC_RELEASE);
+}
+
+//returns the oldest job, or NULL if there is none or one is still being posted
+static actor_job *pop(actor_box *box){
+    actor_job *head = box->head;
+    actor_job *next = __atomic_load_n(&(head->next), __ATOMIC_ACQUIRE);
+
+    if (head == &(box->stub)) {
+        if (next == NULL)
+            return NULL;
+        box->head = head = next;
+        next = __atomic_load_n(&(head->next), __ATOMIC_ACQUIRE);
+    }
+    if (next != NULL) {
+        box->head = next;
+        return head;
+    }
+    if (head != __atomic_load_n(&(box->tail), __ATOMIC_ACQUIRE))
+        return NULL;
+    //head is the last job: put the stub behind it so it can be taken
+    push(box, &(box->stub));
+    next = __atomic_load_n(&(head->next), __ATOMIC_ACQUIRE);
+    if (next != NULL) {
+        box->head = next;
+        return head;
+    }
+    return NULL;
+}
+
+static void enqueue(actor_box *box){
+    pthread_mutex_lock(&runlock);
+    box->next = NULL;
+    if (runtail != NULL)
+        runtail->next = box;
+    else
+        runhead = box;
+    runtail = box;
+    pthread_cond_signal(&runnable);
+    pthread_mutex_unlock(&runlock);
+}
+
+static actor_box *dequeue(void){
+    actor_box *box;
+
+    pthread_mutex_lock(&runlock);
+    while (runhead == NULL)
+        pthread_cond_wait(&runnable, &runlock);
+    box = runhead;
+    if ((runhead = box->next) == NULL)
+        runtail = NULL;
+    pthread_mutex_unlock(&runlock);
+    return box;
+}
+
+//the channel's mailbox, made the first time anything is posted to it. it goes
+//when the channel does (see channel_free), which can't be while a job holds
+//a reference
+static actor_box *mailbox(channel *chan){
+    actor_box *box = __atomic_load_n(&(chan->box), __ATOMIC_ACQUIRE);
+
+    if (box != NULL)
+        return box;
+    box = calloc(1, sizeof(actor_box));
+    box->head = box->tail = &(box->stub);
+    if (!__sync_bool_compare_and_swap(&(chan->box), NULL, box)) {
+        free(box);
+        box = __atomic_load_n(&(chan->box), __ATOMIC_ACQUIRE);
+    }
+    return box;
+}
+
+static actor_job *job_new(int op, channel *chan, person *from, const char *line){
+    actor_job *job = pool_alloc(POOL_ACTOR_JOB);
+
+    job->op = op;
+    job->chan = chan;
+    job->from = from;
+    job->mode = 0;
+    job->history = 0;
+    job->out = NULL;
+    job->wait = 0;
+    job->done = 0;
+    snprintf(job->line, MAXMSG, "%s", line != NULL ? line : "");
+    return job;
+}
+
+static void post(actor_job *job){
+    actor_box *box = mailbox(job->chan);
+
+    chanmap_ref(actor_server->chans, job->chan);
+    if (job->from != NULL)
+        __atomic_add_fetch(&(job->from->actor_pending), 1, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&inflight, 1, __ATOMIC_SEQ_CST);
+    push(box, job);
+    if (!__atomic_load_n(&(box->scheduled), __ATOMIC_SEQ_CST)
+        && __sync_bool_compare_and_swap(&(box->scheduled), 0, 1))
+        enqueue(box);
+}
+
+//everyone on the channel gets line, except skip. call with lock held
+static void address(actor_job *job, person *skip, delivery **out, int *n, int *size){
+    list_t *members = job->chan->members;
+    list_iter_t it;
+    person *member;
+
+    if (*n + list_size(members) > *size) {
+        *size = (*n + list_size(members)) * 2;
+        *out = realloc(*out, *size * sizeof(delivery));
+    }
+    list_iter_start(&it, members);
+    while (list_iter_hasnext(&it)) {
+        member = (person *)list_iter_next(&it);
+        if (member != skip) {
+            (*out)[*n].to = member;
+            (*out)[(*n)++].line = job->line;
+        }
+    }
+}
+
+//applies a job to its channel, adding what it sends to out. call with lock held
+static void apply(actor_job *job, delivery **out, int *n, int *size){
+    channel *chan = job->chan;
+
+    switch (job->op)
+    {
+        case ACTOR_SEND:
+            address(job, job->from, out, n, size);
+            if (job->history)
+                history_add(chan, job->line);
+            break;
+        case ACTOR_JOIN:
+            list_append(chan->members, job->from);
+            names_patch(chan, NULL, job->from->nick, job->mode);
+            history_replay(chan, job->out);
+            address(job, NULL, out, n, size);
+            break;
+        case ACTOR_PART:
+            if (job->line[0] != '\0')
+                address(job, job->from, out, n, size);
+            list_delete(chan->members, job->from);
+            names_patch(chan, job->from->nick, NULL, 0);
+            break;
+    }
+}
+
+//runs up to ACTOR_BATCH of a channel's jobs
+static void run(actor_box *box, delivery **out, int *size){
+    actor_job *batch[ACTOR_BATCH];
+    actor_job *job;
+    int i, n, more, numsent = 0;
+
+    for (n = 0; n < ACTOR_BATCH && (batch[n] = pop(box)) != NULL; n++)
+        ;
+    if (n > 0) {
+        CHIRC_TRACE2(fanout__start, batch[0]->chan->name, n);
+        chirc_lock(&lock);
+        for (i = 0; i < n; i++)
+            apply(batch[i], out, &numsent, size);
+        chirc_unlock(&lock);
+        //nobody sent to here can be gone yet: they can't exit until the job
+        //taking them off the channel is done, and that's at best one of these
+        for (i = 0; i < numsent; i++)
+            user_send(actor_server, (*out)[i].to, (*out)[i].line);
+        CHIRC_TRACE2(fanout__done, batch[0]->chan->name, numsent);
+    }
+
+    //the channel goes to the back of the queue if it has more to do. otherwise
+    //it's unscheduled, unless something was posted meanwhile
+    if (n == ACTOR_BATCH)
+        enqueue(box);
+    else {
+        more = box->head != &(box->stub);
+        __atomic_store_n(&(box->scheduled), 0, __ATOMIC_SEQ_CST);
+        if ((more || __atomic_load_n(&(box->tail), __ATOMIC_SEQ_CST) != &(box->stub))
+            && __sync_bool_compare_and_swap(&(box->scheduled), 0, 1))
+            enqueue(box);
+    }
+
+    //the box isn't touched after this, since dropping the references can free it
+    for (i = 0; i < n; i++) {
+        job = batch[i];
+        chanmap_put(actor_server->chans, job->chan);
+        if (job->wait) {
+            __atomic_store_n(&(job->done), 1, __ATOMIC_RELEASE);
+            continue;
+        }
+        if (job->from != NULL)
+            __atomic_sub_fetch(&(job->from->actor_pending), 1, __ATOMIC_SEQ_CST);
+        pool_free(POOL_ACTOR_JOB, job);
+        __atomic_sub_fetch(&inflight, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+static void *worker(void *args){
+    delivery *out = NULL;
+    int size = 0;
+
+    affinity_enter((int)(long) args);
+    while (1)
+        run(dequeue(), &out, &size);
+    return NULL;
+}
+
+void actor_start(chirc_server *server){
+    pthread_attr_t attr;
+    pthread_t tid;
+    long node;
+    int i;
+
+    rcu_read_lock();
+    numworkers = config_get()->channel_actors;
+    rcu_read_unlock();
+    actor_server = server;
+    for (i = 0; i < numworkers; i++) {
+        pthread_attr_init(&attr);
+        node = affinity_actor(&attr, i);
+        if (pthread_create(&tid, &attr, worker, (void *) node) != 0) {
+            perror("Could not create actor thread");
+            exit(-1);
+        }
+        pthread_attr_destroy(&attr);
+        pthread_detach(tid);
+    }
+}
+
+int actor_enabled(void){
+    return numworkers > 0;
+}
+
+void actor_send(channel *chan, person *from, const char *line, int history){
+    actor_job *job = job_new(ACTOR_SEND, chan, from, line);
+
+    job->history = history;
+    post(job);
+}
+
+//posts job and waits for it to be done
+static void call(actor_job *job){
+    struct timespec wait = { 0, 100000 };
+
+    job->wait = 1;
+    post(job);
+    while (!__atomic_load_n(&(job->done), __ATOMIC_ACQUIRE))
+        nanosleep(&wait, NULL);
+    if (job->from != NULL)
+        __atomic_sub_fetch(&(job->from->actor_pending), 1, __ATOMIC_SEQ_CST);
+    pool_free(POOL_ACTOR_JOB, job);
+    __atomic_sub_fetch(&inflight, 1, __ATOMIC_SEQ_CST);
+}
+
+void actor_relay(channel *chan, const char *line){
+    call(job_new(ACTOR_SEND, chan, NULL, line));
+}
+
+void actor_join(channel *chan, person *client, unsigned int mode, const char *line, outbuf *out){
+    actor_job *job = job_new(ACTOR_JOIN, chan, client, line);
+
+    job->mode = mode;
+    job->out = out;
+    call(job);
+}
+
+void actor_part(channel *chan, person *client, const char *line){
+    call(job_new(ACTOR_PART, chan, client, line));
+}
+
+void actor_leave(channel *chan, person *client){
+    post(job_new(ACTOR_PART, chan, client, NULL));
+}
+
+void actor_flush(person *client){
+    struct timespec wait = { 0, 1000000 };
+
+    while (__atomic_load_n(&(client->actor_pending), __ATOMIC_SEQ_CST) > 0)
+        nanosleep(&wait, NULL);
+}
+
+int actor_quiesce(int timeout){
+    time_t deadline = time(NULL) + timeout;
+
+    while (__atomic_load_n(&inflight, __ATOMIC_SEQ_CST) > 0) {
+        if (time(NULL) > deadline)
+            return -1;
+        usleep(10000);
+    }
+    return 0;
+}
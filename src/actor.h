@@ -0,0 +1,96 @@
+/*
+ *
+ *  CMSC 23300 / 33300 - Networks and Distributed Systems
+ *
+ *  channels as actors for chirc project
+ *
+ *  sachs_sandler
+ *
+ */
+
+/*
+ * With channel_actors set, each channel becomes an actor: the changes to its
+ * member list and everything said on it are posted to the channel's mailbox
+ * instead of being carried out by the client thread that asked for them. A
+ * pool of channel_actors threads runs the mailboxes, one channel on one
+ * thread at a time, so a channel's jobs happen in the order they were posted
+ * without the poster taking chan_lock, the global lock or any member's lock.
+ *
+ * A thread takes up to ACTOR_BATCH jobs from a mailbox at once, applies them
+ * to the channel under a single acquisition of the global lock (which NAMES,
+ * WHO and the NICK and QUIT fanout still read member lists under), and sends
+ * what they produced once it has let go. A busy channel is then put at the
+ * back of the run queue, so it can't keep the others waiting.
+ *
+ * Every job holds a reference to its channel, and counts against the person
+ * who posted it until it is done. user_exit posts a job taking the user off
+ * each of their channels and waits for all of the user's jobs, so by the time
+ * a person is gone no actor can still send to them. A failed send only marks
+ * the connection closing (see user_close), and the connection's own thread
+ * finds that out and exits.
+ *
+ * Only a PRIVMSG or NOTICE to a single channel is handed to its actor without
+ * waiting. A message with several targets is still sent by the client thread,
+ * so that whoever several targets reach gets one copy, and so are NICK and
+ * QUIT, but only once the user's earlier messages are out. JOIN, PART, TOPIC
+ * and MODE wait for the actor, so replies to the user can't get ahead of them.
+ *
+ * channel_actors is only read at startup. With it at 0 (the default) there
+ * are no actor threads, and every channel is run by its client threads.
+ */
+
+#ifndef ACTOR_H_
+#define ACTOR_H_
+
+#define ACTOR_BATCH 64      //jobs run per turn of a channel
+
+enum { ACTOR_SEND, ACTOR_JOIN, ACTOR_PART };
+
+//posted to a mailbox. only actor.c looks inside, but jobs come from a pool (see pool.h)
+typedef struct actor_job {
+    struct actor_job *next;     //in the mailbox
+    int op;
+    channel *chan;      //the job's reference to it
+    person *from;       //who posted it, if anyone: the member for JOIN and PART. SEND and PART skip them
+    unsigned int mode;  //ACTOR_JOIN's member status
+    int history;        //ACTOR_SEND adds line to the channel's history
+    outbuf *out;        //ACTOR_JOIN's history replay
+    int wait;           //the poster waits for it, and frees it
+    int done;           //set once it's finished, for a poster that waits
+    char line[MAXMSG];  //sent to the members, empty for none
+} actor_job;
+
+//starts the actor threads, if channel_actors asks for any. call once the
+//configuration is loaded
+void actor_start(chirc_server *server);
+
+//whether channels are run by actors
+int actor_enabled(void);
+
+//sends line to everyone on chan but from (which may be NULL), adding it to the
+//channel's history if history is set
+void actor_send(channel *chan, person *from, const char *line, int history);
+
+//sends line to everyone on chan, returning once it has
+void actor_relay(channel *chan, const char *line);
+
+//puts client on chan with member status mode, sends line to everyone on it
+//(client included) and replays the channel's history into out. returns once
+//that's all done
+void actor_join(channel *chan, person *client, unsigned int mode, const char *line, outbuf *out);
+
+//sends line to everyone else on chan, then takes client off it. client is
+//sent its own copy by the caller, once it's off. returns once that's done
+void actor_part(channel *chan, person *client, const char *line);
+
+//takes client off chan without telling anyone, and without waiting (see actor_flush)
+void actor_leave(channel *chan, person *client);
+
+//waits until every job client posted is done
+void actor_flush(person *client);
+
+//waits until no actor has anything left to do. returns -1 if that takes more
+//than timeout seconds
+int actor_quiesce(int timeout);
+
+#endif /* ACTOR_H_ */
@@ -0,0 +1,261 @@
+/*
+ *
+ *  CMSC 23300 / 33300 - Networks and Distributed Systems
+ *
+ *  connection admission control for chirc project
+ *
+ *  sachs_sandler
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <time.h>
+#include "config.h"
+#include "rcu.h"
+#include "admit.h"
+#include "log.h"
+
+#define ADMIT_BUCKETS 4096
+
+//a connection waiting for the rate limiter
+typedef struct pending_conn {
+    int fd;
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    struct pending_conn *next;
+} pending_conn;
+
+//a source address with connections open or queued
+typedef struct source {
+    int family;
+    unsigned char bytes[16];
+    int conns;                  //queued or started, and not yet released
+    pending_conn *first, *last; //queued
+    struct source *next_ready;  //next in the round robin, while anything is queued
+    struct source *next;        //next in its bucket
+} source;
+
+static pthread_mutex_t admit_lock = PTHREAD_MUTEX_INITIALIZER;
+static source *buckets[ADMIT_BUCKETS];
+static int total = 0;               //connections queued or started
+static source *ready = NULL;        //last in the round robin, so ready->next_ready is served next
+
+//the token bucket, only used by the accept thread
+static double tokens = -1;
+static struct timespec refilled;
+
+//the part of addr that identifies where a connection comes from
+static int source_key(const struct sockaddr *addr, unsigned char *bytes){
+    memset(bytes, 0, 16);
+    if (addr->sa_family == AF_INET6) {
+        memcpy(bytes, &((struct sockaddr_in6 *)addr)->sin6_addr, 16);
+        return AF_INET6;
+    }
+    memcpy(bytes, &((struct sockaddr_in *)addr)->sin_addr, 4);
+    return AF_INET;
+}
+
+static unsigned int source_hash(int family, const unsigned char *bytes){
+    unsigned int h = 2166136261u ^ family;
+    int i;
+    for (i = 0; i < 16; i++)
+        h = (h ^ bytes[i]) * 16777619u;
+    return h % ADMIT_BUCKETS;
+}
+
+//call with admit_lock held. creates the source if create is set
+static source *source_find(const struct sockaddr *addr, int create){
+    unsigned char bytes[16];
+    int family = source_key(addr, bytes);
+    unsigned int b = source_hash(family, bytes);
+    source *src;
+
+    for (src = buckets[b]; src != NULL; src = src->next)
+        if (src->family == family && memcmp(src->bytes, bytes, 16) == 0)
+            return src;
+    if (!create)
+        return NULL;
+    src = calloc(1, sizeof(source));
+    src->family = family;
+    memcpy(src->bytes, bytes, 16);
+    src->next = buckets[b];
+    buckets[b] = src;
+    return src;
+}
+
+//call with admit_lock held, once src has nothing open or queued
+static void source_drop(source *src){
+    unsigned int b = source_hash(src->family, src->bytes);
+    source **pp;
+
+    for (pp = &buckets[b]; *pp != src; pp = &((*pp)->next))
+        ;
+    *pp = src->next;
+    free(src);
+}
+
+//tells the client why, without waiting on it, and closes the connection
+static void shed(int fd, const struct sockaddr *addr, int per_ip, const char *reason){
+    char host[INET6_ADDRSTRLEN] = "*";
+    char msg[256], drain[512];
+    int len;
+
+    if (addr->sa_family == AF_INET6)
+        inet_ntop(AF_INET6, &((struct sockaddr_in6 *)addr)->sin6_addr, host, sizeof(host));
+    else
+        inet_ntop(AF_INET, &((struct sockaddr_in *)addr)->sin_addr, host, sizeof(host));
+    log_event(LOG_SHED, fd, per_ip, 0, host);
+    len = snprintf(msg, sizeof(msg), "ERROR :Closing Link: %s (%s)\r\n", host, reason);
+    send(fd, msg, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    shutdown(fd, SHUT_WR);
+    //anything the client already sent would make close() reset the connection,
+    //and the client might never read the ERROR
+    while (recv(fd, drain, sizeof(drain), MSG_DONTWAIT) > 0)
+        ;
+    close(fd);
+}
+
+int admit_connection(int fd, const struct sockaddr *addr, socklen_t addrlen){
+    int max_clients, max_per_ip;
+    pending_conn *conn;
+    source *src;
+
+    rcu_read_lock();
+    max_clients = config_get()->max_clients;
+    max_per_ip = config_get()->max_clients_per_ip;
+    rcu_read_unlock();
+
+    pthread_mutex_lock(&admit_lock);
+    if (max_clients && total >= max_clients) {
+        pthread_mutex_unlock(&admit_lock);
+        shed(fd, addr, 0, "Server full");
+        return -1;
+    }
+    src = source_find(addr, 1);
+    if (max_per_ip && src->conns >= max_per_ip) {
+        pthread_mutex_unlock(&admit_lock);
+        shed(fd, addr, 1, "Too many connections from your host");
+        return -1;
+    }
+    total++;
+    src->conns++;
+
+    conn = malloc(sizeof(pending_conn));
+    conn->fd = fd;
+    memcpy(&(conn->addr), addr, addrlen);
+    conn->addrlen = addrlen;
+    conn->next = NULL;
+    if (src->first == NULL) {
+        src->first = conn;
+        //joins the end of the round robin
+        if (ready == NULL)
+            src->next_ready = src;
+        else {
+            src->next_ready = ready->next_ready;
+            ready->next_ready = src;
+        }
+        ready = src;
+    }
+    else
+        src->last->next = conn;
+    src->last = conn;
+    pthread_mutex_unlock(&admit_lock);
+    return 0;
+}
+
+//adds whatever has accumulated since the last refill, up to a second's worth
+static void refill(int rate){
+    struct timespec now;
+    double elapsed;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (tokens < 0)
+        tokens = rate;
+    else {
+        elapsed = (now.tv_sec - refilled.tv_sec) + (now.tv_nsec - refilled.tv_nsec) / 1e9;
+        tokens += elapsed * rate;
+        if (tokens > rate)
+            tokens = rate;
+    }
+    refilled = now;
+}
+
+int admit_next(struct sockaddr_storage *addr, socklen_t *addrlen, int *wait, int drain){
+    pending_conn *conn;
+    source *src;
+    int rate, fd;
+
+    rcu_read_lock();
+    rate = config_get()->registration_rate;
+    rcu_read_unlock();
+
+    pthread_mutex_lock(&admit_lock);
+    if (ready == NULL) {
+        pthread_mutex_unlock(&admit_lock);
+        *wait = -1;
+        return -1;
+    }
+    if (rate && !drain) {
+        refill(rate);
+        if (tokens < 1) {
+            pthread_mutex_unlock(&admit_lock);
+            *wait = (int) ((1 - tokens) * 1000 / rate) + 1;
+            return -1;
+        }
+        tokens--;
+    }
+
+    //take the first connection of the source whose turn it is, and move the turn on
+    src = ready->next_ready;
+    conn = src->first;
+    src->first = conn->next;
+    if (src->first == NULL) {
+        if (src == ready)
+            ready = NULL;
+        else
+            ready->next_ready = src->next_ready;
+        src->next_ready = NULL;
+    }
+    else
+        ready = src;
+    pthread_mutex_unlock(&admit_lock);
+
+    fd = conn->fd;
+    memcpy(addr, &(conn->addr), conn->addrlen);
+    *addrlen = conn->addrlen;
+    free(conn);
+    return fd;
+}
+
+void admit_release(const struct sockaddr *addr){
+    source *src;
+
+    pthread_mutex_lock(&admit_lock);
+    total--;
+    if ((src = source_find(addr, 0)) != NULL && --(src->conns) == 0)
+        source_drop(src);
+    pthread_mutex_unlock(&admit_lock);
+}
+
+void admit_existing(int fd, struct sockaddr_storage *addr, socklen_t *addrlen){
+    source *src;
+
+    *addrlen = sizeof(struct sockaddr_storage);
+    if (getpeername(fd, (struct sockaddr *)addr, addrlen) == -1) {
+        perror("getpeername() failed");
+        memset(addr, 0, sizeof(struct sockaddr_storage));
+        addr->ss_family = AF_INET;
+    }
+    pthread_mutex_lock(&admit_lock);
+    total++;
+    src = source_find((struct sockaddr *)addr, 1);
+    src->conns++;
+    pthread_mutex_unlock(&admit_lock);
+}
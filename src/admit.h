@@ -0,0 +1,47 @@
+/*
+ *
+ *  CMSC 23300 / 33300 - Networks and Distributed Systems
+ *
+ *  connection admission control for chirc project
+ *
+ *  sachs_sandler
+ *
+ */
+
+/*
+ * Every connection accept_clients takes is counted against max_clients and
+ * against max_clients_per_ip for its source address (see config.h) until its
+ * thread ends. A connection over either limit is sent an ERROR line and closed
+ * straight away, which costs a lot less than serving it.
+ *
+ * Connections within the limits wait in a queue per source address until the
+ * registration rate limiter lets them start. The limiter is a token bucket
+ * refilled at registration_rate per second, holding up to one second's worth,
+ * and the queues are served round robin, so one address reconnecting a
+ * thousand clients can't hold up the others.
+ *
+ * Only the accept thread admits and starts connections; admit_release and
+ * admit_existing may be called by any thread.
+ */
+
+#ifndef ADMIT_H_
+#define ADMIT_H_
+
+#include <sys/socket.h>
+
+//counts fd (just accepted from addr) and queues it, or sheds it if it is over a limit.
+//returns -1 if it was shed
+int admit_connection(int fd, const struct sockaddr *addr, socklen_t addrlen);
+
+//the next queued connection that may start now, with its address in addr. returns -1,
+//and sets *wait to the milliseconds until one may (or -1 if none is queued), if there
+//is none. with drain set every queued connection may start
+int admit_next(struct sockaddr_storage *addr, socklen_t *addrlen, int *wait, int drain);
+
+//a connection from addr is gone
+void admit_release(const struct sockaddr *addr);
+
+//counts fd, connected before an upgrade handed it over, against the limits
+void admit_existing(int fd, struct sockaddr_storage *addr, socklen_t *addrlen);
+
+#endif /* ADMIT_H_ */
@@ -0,0 +1,214 @@
+/*
+ *
+ *  CMSC 23300 / 33300 - Networks and Distributed Systems
+ *
+ *  CPU affinity and NUMA placement for chirc project
+ *
+ *  sachs_sandler
+ *
+ */
+#define _GNU_SOURCE     //cpu_set_t, pthread_attr_setaffinity_np
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include "config.h"
+#include "rcu.h"
+#include "affinity.h"
+
+#define MAXNODES 64
+
+static int numnodes = 1;
+static cpu_set_t node_cpus[MAXNODES];
+static cpu_set_t accept_set, client_set, actor_set;
+static int accept_pinned = 0, client_pinned = 0, actor_pinned = 0;
+static int threads[MAXNODES];   //pinned threads running on each node, changed with atomics
+
+static pthread_key_t node_key;
+static __thread int self_node = -1;
+
+//fills set from a list like "0-3,8,10-11". returns -1 if it doesn't parse
+static int parse_list(const char *list, cpu_set_t *set){
+    const char *p = list;
+    char *end;
+    long first, last, cpu;
+
+    CPU_ZERO(set);
+    while (*p != '\0') {
+        first = strtol(p, &end, 10);
+        if (end == p || first < 0 || first >= CPU_SETSIZE)
+            return -1;
+        last = first;
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first || last >= CPU_SETSIZE)
+                return -1;
+        }
+        for (cpu = first; cpu <= last; cpu++)
+            CPU_SET(cpu, set);
+        if (*end == ',')
+            end++;
+        else if (*end != '\0')
+            return -1;
+        p = end;
+    }
+    return 0;
+}
+
+int affinity_valid(const char *list){
+    cpu_set_t set;
+
+    return parse_list(list, &set);
+}
+
+static void read_nodes(void){
+    char path[128], line[4096];
+    FILE *f;
+    int n, cpu;
+
+    for (n = 0; n < MAXNODES; n++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", n);
+        if ((f = fopen(path, "r")) == NULL)
+            break;
+        if (fgets(line, sizeof(line), f) == NULL)
+            line[0] = '\0';
+        fclose(f);
+        line[strcspn(line, "\n")] = '\0';
+        if (parse_list(line, &node_cpus[n]) == -1)
+            CPU_ZERO(&node_cpus[n]);
+    }
+    if (n == 0) {
+        //no NUMA information: one node with everything
+        n = 1;
+        CPU_ZERO(&node_cpus[0]);
+        for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+            CPU_SET(cpu, &node_cpus[0]);
+    }
+    numnodes = n;
+}
+
+//what list leaves of the CPUs we may run on. sets *pinned if list isn't empty
+static void configured(const char *key, const char *list, cpu_set_t *set, int *pinned){
+    cpu_set_t allowed;
+
+    if (list[0] == '\0')
+        return;
+    parse_list(list, set);
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+    CPU_AND(set, set, &allowed);
+    if (CPU_COUNT(set) == 0) {
+        fprintf(stderr, "ERROR: %s names no CPU chirc can run on\n", key);
+        exit(-1);
+    }
+    *pinned = 1;
+}
+
+static void thread_done(void *arg){
+    __sync_fetch_and_sub(&threads[(long) arg - 1], 1);
+}
+
+void affinity_start(void){
+    char accept_list[CONFLINE], client_list[CONFLINE], actor_list[CONFLINE];
+
+    rcu_read_lock();
+    strcpy(accept_list, config_get()->accept_cpus);
+    strcpy(client_list, config_get()->client_cpus);
+    strcpy(actor_list, config_get()->actor_cpus);
+    rcu_read_unlock();
+
+    read_nodes();
+    configured("accept_cpus", accept_list, &accept_set, &accept_pinned);
+    configured("client_cpus", client_list, &client_set, &client_pinned);
+    configured("actor_cpus", actor_list, &actor_set, &actor_pinned);
+    if (pthread_key_create(&node_key, thread_done) != 0) {
+        perror("Could not create affinity thread key");
+        exit(-1);
+    }
+}
+
+//the node cpu is on, or 0 if it's on none we know of
+static int node_of(int cpu){
+    int n;
+
+    for (n = 0; n < numnodes; n++)
+        if (CPU_ISSET(cpu, &node_cpus[n]))
+            return n;
+    return 0;
+}
+
+void affinity_accept(pthread_attr_t *attr){
+    if (accept_pinned)
+        pthread_attr_setaffinity_np(attr, sizeof(cpu_set_t), &accept_set);
+}
+
+int affinity_client(pthread_attr_t *attr){
+    cpu_set_t set;
+    int n, best = -1, load;
+
+    if (!client_pinned)
+        return -1;
+    for (n = 0; n < numnodes; n++) {
+        CPU_AND(&set, &client_set, &node_cpus[n]);
+        if (CPU_COUNT(&set) == 0)
+            continue;
+        load = __atomic_load_n(&threads[n], __ATOMIC_RELAXED);
+        if (best == -1 || load < __atomic_load_n(&threads[best], __ATOMIC_RELAXED))
+            best = n;
+    }
+    if (best == -1) {
+        //client_cpus are on no node we know of
+        pthread_attr_setaffinity_np(attr, sizeof(cpu_set_t), &client_set);
+        return -1;
+    }
+    CPU_AND(&set, &client_set, &node_cpus[best]);
+    pthread_attr_setaffinity_np(attr, sizeof(cpu_set_t), &set);
+    //counted straight away, so a burst of connections doesn't all land on the
+    //node that was quietest before it
+    __sync_fetch_and_add(&threads[best], 1);
+    return best;
+}
+
+int affinity_actor(pthread_attr_t *attr, int i){
+    cpu_set_t set;
+    int cpu, node, k;
+
+    if (!actor_pinned)
+        return -1;
+    k = i % CPU_COUNT(&actor_set);
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        if (CPU_ISSET(cpu, &actor_set) && k-- == 0)
+            break;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_attr_setaffinity_np(attr, sizeof(cpu_set_t), &set);
+    node = node_of(cpu);
+    __sync_fetch_and_add(&threads[node], 1);
+    return node;
+}
+
+void affinity_forget(int node){
+    if (node != -1)
+        __sync_fetch_and_sub(&threads[node], 1);
+}
+
+void affinity_enter(int node){
+    unsigned long mask[MAXNODES / (8 * sizeof(unsigned long)) + 1] = { 0 };
+
+    if (node == -1)
+        return;
+    self_node = node;
+    pthread_setspecific(node_key, (void *)(long) (node + 1));
+    if (numnodes > 1) {
+        mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+        syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask, MAXNODES + 1);
+    }
+}
+
+int affinity_node(void){
+    return self_node;
+}
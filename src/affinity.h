@@ -0,0 +1,62 @@
+/*
+ *
+ *  CMSC 23300 / 33300 - Networks and Distributed Systems
+ *
+ *  CPU affinity and NUMA placement for chirc project
+ *
+ *  sachs_sandler
+ *
+ */
+
+/*
+ * accept_cpus, client_cpus and actor_cpus (see config.h) pin the accept thread,
+ * the connections' threads and the channel actors to the CPUs listed. Each is
+ * read at startup only, and left empty the threads it covers run wherever the
+ * scheduler likes.
+ *
+ * A connection is placed on a NUMA node when it is accepted, the node among
+ * those client_cpus covers with the fewest pinned threads, and its thread may
+ * only run on client_cpus on that node for as long as it lasts. Actors are
+ * pinned to one CPU each, going round actor_cpus. Every pinned thread prefers
+ * memory on its own node, which covers its stack (and with it the person
+ * struct and input buffers), and pool.c hands a new thread the cache of one
+ * that exited on the same node, so memberships and outbuf chunks stay local
+ * too.
+ *
+ * Nodes are read from /sys/devices/system/node. Without it the machine is
+ * taken to be one node.
+ */
+
+#ifndef AFFINITY_H_
+#define AFFINITY_H_
+
+#include <pthread.h>
+
+//checks that list is a CPU list ("0-3,8,10-11"), as config.c reads it
+int affinity_valid(const char *list);
+
+//reads the machine's nodes and the configured CPUs. call once the
+//configuration is loaded. exits if a list names no CPU we can run on
+void affinity_start(void);
+
+//sets attr up for the accept thread
+void affinity_accept(pthread_attr_t *attr);
+
+//picks a node for a new connection and sets attr up to run its thread there.
+//returns the node, or -1 if connections aren't pinned
+int affinity_client(pthread_attr_t *attr);
+
+//sets attr up for actor thread i. returns its node, or -1 if actors aren't pinned
+int affinity_actor(pthread_attr_t *attr, int i);
+
+//called by a thread set up by one of the above once it is running, with the
+//node it was given. it counts there until it exits, and prefers memory from there
+void affinity_enter(int node);
+
+//stops counting a thread on node that never got to start
+void affinity_forget(int node);
+
+//the calling thread's node, or -1 if it isn't pinned
+int affinity_node(void);
+
+#endif /* AFFINITY_H_ */
@@ -0,0 +1,339 @@
+/*
+ *
+ *  CMSC 23300 / 33300 - Networks and Distributed Systems
+ *
+ *  microbenchmarks for chirc hot paths (make bench)
+ *
+ *  sachs_sandler
+ *
+ */
+
+/*
+ * usage: chirc-bench [-u users] [-c channels] [-m members] [-n iterations]
+ *                    [-s seed] [-b benchmark]
+ *
+ * Builds an in-memory server with the given population (every channel has
+ * members users, picked round-robin from the userlist), then times each
+ * benchmark and prints one JSON object per line on stdout (anything the server
+ * code logs goes to stderr instead). Replies that the code under test sends
+ * go to a socketpair that a background thread drains.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <pthread.h>
+#include <time.h>
+#include "reply.h"
+#include "simclist.h"
+#include "ircstructs.h"
+#include "prof.h"
+#include "chanmap.h"
+#include "upgrade.h"
+
+//normally defined in main.c
+pthread_mutex_t lock;
+
+void *service_single_client(void *args);
+void parse(char *msg, int clientSocket, chirc_server *server);
+void constr_reply(char code[4], person *client, char *reply, chirc_server *server, char *extra);
+void send_names(chirc_server *server, channel *chan, person *user);
+void sendtochannel(chirc_server *server, channel *chan, char *msg, char *sender);
+void channel_join(person *client, chirc_server *server, char* channel_name);
+int fun_seek(const void *el, const void *indicator);
+int fun_compare(const void *a, const void *b);
+list_hash_t hash_nick(const void *el);
+int hash_nick_seek(const void *indicator, list_hash_t *hash);
+list_hash_t hash_fd(const void *el);
+int hash_fd_seek(const void *indicator, list_hash_t *hash);
+list_hash_t hash_userchan(const void *el);
+int hash_userchan_seek(const void *indicator, list_hash_t *hash);
+int chirc_handle_WHO(chirc_server *server, person *user, chirc_message params);
+
+static chirc_server server;
+static list_t userlist;
+static person **users;
+static int numusers = 1000, numchans = 100, members = 50, iters = 10000;
+static int sink[2];     //replies are written to sink[0]; sink[1] is drained and discarded
+static FILE *results;   //the original stdout; chirc's own printf logging goes to stderr
+
+static void *drain_sink(void *args)
+{
+    char buf[65536];
+    while (read(sink[1], buf, sizeof(buf)) > 0)
+        ;
+    return NULL;
+}
+
+static person *make_user(int i)
+{
+    person *p = calloc(1, sizeof(person));
+
+    sprintf(p->nick, "user%d", i);
+    sprintf(p->user, "user%d", i);
+    sprintf(p->fullname, "Bench User %d", i);
+    p->address = strdup("bench.example.org");
+    p->clientSocket = sink[0];
+    p->tid = pthread_self();
+    pthread_mutex_init(&(p->c_lock), NULL);
+    p->my_chans = malloc(sizeof(list_t));
+    list_init(p->my_chans);
+    list_attributes_seeker(p->my_chans, fun_seek);
+    list_attributes_comparator(p->my_chans, fun_compare);
+    list_attributes_index(p->my_chans, hash_userchan, hash_userchan_seek);
+    list_append(&userlist, p);
+    return p;
+}
+
+static void populate(void)
+{
+    char cname[MAXMSG];
+    int c, k;
+
+    users = malloc(numusers * sizeof(person *));
+    for (k = 0; k < numusers; k++)
+        users[k] = make_user(k);
+    server.numregistered = numusers;
+
+    for (c = 0; c < numchans; c++) {
+        sprintf(cname, "#chan%d", c);
+        for (k = 0; k < members && k < numusers; k++)
+            channel_join(users[(c * members + k) % numusers], &server, cname);
+    }
+}
+
+//every channel keeps its members for the whole run, so the reference can go straight back
+static channel *random_chan(void)
+{
+    char cname[MAXMSG];
+    channel *chan;
+
+    sprintf(cname, "#chan%d", rand() % numchans);
+    if ((chan = chanmap_get(server.chans, cname)) != NULL)
+        chanmap_put(server.chans, chan);
+    return chan;
+}
+
+static void report(const char *name, int n, uint64_t ns)
+{
+    fprintf(results, "{\"bench\":\"%s\",\"iters\":%d,\"ns_per_op\":%.1f,\"ops_per_sec\":%.0f,"
+           "\"users\":%d,\"channels\":%d,\"members\":%d}\n",
+           name, n, (double) ns / n, n * 1e9 / ns, numusers, numchans, members);
+    fflush(results);
+}
+
+//full receive path: framing in parse_message, tokenizing in parse, dispatch
+static void bench_parse_message(void)
+{
+    int pair[2];
+    pthread_t tid;
+    workerArgs *wa;
+    char *msg = "PONG :bench.example.org\r\n";
+    size_t len = strlen(msg);
+    char *buf = malloc(len * iters);
+    char ignore[512];
+    int i;
+    uint64_t start;
+
+    for (i = 0; i < iters; i++)
+        memcpy(buf + i * len, msg, len);
+    socketpair(AF_UNIX, SOCK_STREAM, 0, pair);
+    wa = malloc(sizeof(workerArgs));
+    wa->server = &server;
+    wa->clientname = strdup("bench.example.org");
+    wa->socket = pair[0];
+    memset(&(wa->addr), 0, sizeof(wa->addr));
+    wa->addrlen = sizeof(wa->addr);
+    wa->restore = NULL;
+    wa->node = -1;
+
+    start = prof_now();
+    upgrade_client_starting();
+    pthread_create(&tid, NULL, service_single_client, wa);
+    if (write(pair[1], buf, len * iters) != len * iters)
+        perror("write failed");
+    shutdown(pair[1], SHUT_WR);
+    //the server closes its end once it has handled everything
+    while (read(pair[1], ignore, sizeof(ignore)) > 0)
+        ;
+    report("parse_message", iters, prof_now() - start);
+    close(pair[1]);
+    free(buf);
+}
+
+static void bench_parse(void)
+{
+    char msg[MAXMSG];
+    int i;
+    uint64_t start = prof_now();
+
+    for (i = 0; i < iters; i++) {
+        strcpy(msg, "PONG :bench.example.org");
+        parse(msg, sink[0], &server);
+    }
+    report("parse", iters, prof_now() - start);
+}
+
+static void bench_constr_reply(void)
+{
+    char reply[MAXMSG];
+    int i;
+    uint64_t start = prof_now();
+
+    for (i = 0; i < iters; i++)
+        constr_reply(RPL_WELCOME, users[i % numusers], reply, &server, NULL);
+    report("constr_reply", iters, prof_now() - start);
+}
+
+static void bench_seek_nick(void)
+{
+    char nick[MAXMSG];
+    el_indicator seek_arg;
+    int i;
+    uint64_t start = prof_now();
+
+    seek_arg.field = NICK;
+    seek_arg.value = nick;
+    for (i = 0; i < iters; i++) {
+        sprintf(nick, "user%d", rand() % numusers);
+        if (list_seek(&userlist, &seek_arg) == NULL)
+            fprintf(stderr, "seek_nick: %s not found\n", nick);
+    }
+    report("seek_nick", iters, prof_now() - start);
+}
+
+static void bench_seek_chan(void)
+{
+    int i;
+    uint64_t start = prof_now();
+
+    for (i = 0; i < iters; i++)
+        if (random_chan() == NULL)
+            fprintf(stderr, "seek_chan: channel not found\n");
+    report("seek_chan", iters, prof_now() - start);
+}
+
+static void bench_contains_mychan(void)
+{
+    mychan dummy;
+    int i;
+    uint64_t start = prof_now();
+
+    for (i = 0; i < iters; i++) {
+        sprintf(dummy.name, "#chan%d", rand() % numchans);
+        list_contains(users[rand() % numusers]->my_chans, &dummy);
+    }
+    report("contains_mychan", iters, prof_now() - start);
+}
+
+static void bench_send_names(void)
+{
+    int i;
+    uint64_t start = prof_now();
+
+    for (i = 0; i < iters; i++)
+        send_names(&server, random_chan(), users[i % numusers]);
+    report("send_names", iters, prof_now() - start);
+}
+
+static void bench_sendtochannel(void)
+{
+    char *msg = ":user0!user0@bench.example.org PRIVMSG #chan :benchmark message\r\n";
+    int i;
+    uint64_t start = prof_now();
+
+    for (i = 0; i < iters; i++)
+        sendtochannel(&server, random_chan(), msg, "user0");
+    report("sendtochannel", iters, prof_now() - start);
+}
+
+static void bench_who(void)
+{
+    chirc_message params;
+    int i, n = iters / 100 + 1;     //each one reports on most of the userlist
+    uint64_t start = prof_now();
+
+    for (i = 0; i < n; i++) {
+        strcpy(params[0], "WHO");
+        strcpy(params[1], "*");
+        chirc_handle_WHO(&server, users[rand() % numusers], params);
+    }
+    report("who", n, prof_now() - start);
+}
+
+struct benchmark {
+    char *name;
+    void (*run)(void);
+};
+
+static struct benchmark benchmarks[] = {
+    {"parse_message",   bench_parse_message},
+    {"parse",           bench_parse},
+    {"constr_reply",    bench_constr_reply},
+    {"seek_nick",       bench_seek_nick},
+    {"seek_chan",       bench_seek_chan},
+    {"contains_mychan", bench_contains_mychan},
+    {"send_names",      bench_send_names},
+    {"sendtochannel",   bench_sendtochannel},
+    {"who",             bench_who},
+};
+
+#define NUM_BENCHMARKS (sizeof(benchmarks) / sizeof(struct benchmark))
+
+int main(int argc, char *argv[])
+{
+    int opt, i;
+    unsigned int seed = 1;
+    char *only = NULL;
+    pthread_t drainer;
+    time_t birthday = time(NULL);
+
+    while ((opt = getopt(argc, argv, "u:c:m:n:s:b:")) != -1)
+        switch (opt)
+        {
+            case 'u': numusers = atoi(optarg); break;
+            case 'c': numchans = atoi(optarg); break;
+            case 'm': members = atoi(optarg); break;
+            case 'n': iters = atoi(optarg); break;
+            case 's': seed = atoi(optarg); break;
+            case 'b': only = optarg; break;
+            default:
+                fprintf(stderr, "usage: chirc-bench [-u users] [-c channels] [-m members] [-n iterations] [-s seed] [-b benchmark]\n");
+                exit(-1);
+        }
+    if (numusers < 1 || numchans < 1 || members < 0 || iters < 1) {
+        fprintf(stderr, "populations and iterations must be positive\n");
+        exit(-1);
+    }
+    srand(seed);
+    
+    results = fdopen(dup(STDOUT_FILENO), "w");
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+
+    pthread_mutex_init(&lock, NULL);
+    list_init(&userlist);
+    list_attributes_seeker(&userlist, fun_seek);
+    list_attributes_index(&userlist, hash_nick, hash_nick_seek);
+    list_attributes_index(&userlist, hash_fd, hash_fd_seek);
+    server.userlist = &userlist;
+    server.chans = chanmap_create();
+    server.servername = "bench.example.org";
+    server.birthday = ctime(&birthday);
+    server.birthday[strlen(server.birthday) - 1] = '\0';
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sink) == -1) {
+        perror("socketpair failed");
+        exit(-1);
+    }
+    pthread_create(&drainer, NULL, drain_sink, NULL);
+
+    populate();
+
+    for (i = 0; i < NUM_BENCHMARKS; i++)
+        if (only == NULL || strcmp(only, benchmarks[i].name) == 0)
+            benchmarks[i].run();
+
+    return 0;
+}
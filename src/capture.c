@@ -0,0 +1,103 @@
+/*
+ *
+ *  CMSC 23300 / 33300 - Networks and Distributed Systems
+ *
+ *  traffic capture for chirc project
+ *
+ *  sachs_sandler
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include "capture.h"
+
+#define MAXFDS 65536
+
+static FILE *capfile = NULL;
+static pthread_mutex_t caplock = PTHREAD_MUTEX_INITIALIZER;
+static struct timespec capstart;
+static uint32_t nextconn = 1;
+static uint32_t conn_of_fd[MAXFDS];     //0 if the fd is not a captured connection
+
+static uint64_t since_start(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)(now.tv_sec - capstart.tv_sec) * 1000000 + (now.tv_nsec - capstart.tv_nsec) / 1000;
+}
+
+//caller holds caplock
+static void write_record(uint8_t type, uint32_t conn, const char *buf, uint16_t len){
+    capture_record rec;
+    rec.type = type;
+    rec.conn = conn;
+    rec.usec = since_start();
+    rec.len = len;
+    if (fwrite(&rec, sizeof(rec), 1, capfile) != 1 || (len && fwrite(buf, len, 1, capfile) != 1))
+        perror("capture write failed");
+}
+
+//start recording all client input to path. returns 0 on success, -1 on failure
+int capture_start(const char *path){
+    capture_header hdr;
+    
+    if ((capfile = fopen(path, "wb")) == NULL) {
+        perror("Could not open capture file");
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &capstart);
+    hdr.version = CAPTURE_VERSION;
+    hdr.started = time(NULL);
+    if (fwrite(CAPTURE_MAGIC, strlen(CAPTURE_MAGIC), 1, capfile) != 1 || fwrite(&hdr, sizeof(hdr), 1, capfile) != 1) {
+        perror("capture write failed");
+        fclose(capfile);
+        capfile = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+//flush and close the capture; records after this are dropped
+void capture_stop(void){
+    pthread_mutex_lock(&caplock);
+    if (capfile != NULL) {
+        fclose(capfile);
+        capfile = NULL;
+    }
+    pthread_mutex_unlock(&caplock);
+}
+
+void capture_connect(int fd){
+    if (capfile == NULL || fd < 0 || fd >= MAXFDS)
+        return;
+    pthread_mutex_lock(&caplock);
+    if (capfile != NULL) {
+        conn_of_fd[fd] = nextconn++;
+        write_record(CAP_CONNECT, conn_of_fd[fd], NULL, 0);
+    }
+    pthread_mutex_unlock(&caplock);
+}
+
+void capture_data(int fd, const char *buf, int len){
+    if (capfile == NULL || fd < 0 || fd >= MAXFDS || len <= 0)
+        return;
+    pthread_mutex_lock(&caplock);
+    if (capfile != NULL && conn_of_fd[fd] != 0)
+        write_record(CAP_DATA, conn_of_fd[fd], buf, len);
+    pthread_mutex_unlock(&caplock);
+}
+
+void capture_close(int fd){
+    if (capfile == NULL || fd < 0 || fd >= MAXFDS)
+        return;
+    pthread_mutex_lock(&caplock);
+    if (capfile != NULL && conn_of_fd[fd] != 0) {
+        write_record(CAP_CLOSE, conn_of_fd[fd], NULL, 0);
+        conn_of_fd[fd] = 0;
+        //a closed connection is a natural point to make the file usable
+        fflush(capfile);
+    }
+    pthread_mutex_unlock(&caplock);
+}
@@ -0,0 +1,48 @@
+/*
+ *
+ *  CMSC 23300 / 33300 - Networks and Distributed Systems
+ *
+ *  traffic capture for chirc project
+ *
+ *  sachs_sandler
+ *
+ */
+
+/*
+ * A capture file is CAPTURE_MAGIC followed by a capture_header and then a
+ * sequence of records. Each record is a capture_record followed by len bytes
+ * of data (only DATA records carry data). Integers are in host byte order;
+ * times are microseconds since the capture started.
+ */
+
+#ifndef CAPTURE_H_
+#define CAPTURE_H_
+
+#include <stdint.h>
+
+#define CAPTURE_MAGIC   "CHIRCCAP"
+#define CAPTURE_VERSION 1
+
+#define CAP_CONNECT 1
+#define CAP_DATA    2
+#define CAP_CLOSE   3
+
+typedef struct __attribute__((packed)) {
+    uint32_t version;
+    uint64_t started;       //wall clock time capture started, seconds since epoch
+} capture_header;
+
+typedef struct __attribute__((packed)) {
+    uint8_t  type;
+    uint32_t conn;          //connection number, never reused within a capture
+    uint64_t usec;
+    uint16_t len;
+} capture_record;
+
+int capture_start(const char *path);
+void capture_stop(void);
+void capture_connect(int fd);
+void capture_data(int fd, const char *buf, int len);
+void capture_close(int fd);
+
+#endif /* CAPTURE_H_ */
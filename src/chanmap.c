@@ -0,0 +1,163 @@
+/*
+ *
+ *  CMSC 23300 / 33300 - Networks and Distributed Systems
+ *
+ *  concurrent channel registry for chirc project
+ *
+ *  sachs_sandler
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <pthread.h>
+#include <time.h>
+#include "simclist.h"
+#include "ircstructs.h"
+#include "prof.h"
+#include "chanmap.h"
+#include "history.h"
+
+struct chanmap {
+    channel *buckets[CHANMAP_BUCKETS];
+    pthread_mutex_t stripes[CHANMAP_STRIPES];
+    unsigned int size;      //changed with atomics, read without a lock
+};
+
+//FNV-1a
+static unsigned int chanmap_hash(const char *name){
+    unsigned int h = 2166136261u;
+    while (*name != '\0') {
+        h ^= (unsigned char) *name++;
+        h *= 16777619u;
+    }
+    return h & (CHANMAP_BUCKETS - 1);
+}
+
+static pthread_mutex_t *stripe(chanmap *map, unsigned int b){
+    return &(map->stripes[b % CHANMAP_STRIPES]);
+}
+
+static channel *channel_new(const char *name){
+    channel *chan = malloc(sizeof(channel));
+
+    strcpy(chan->name, name);
+    chan->meta = calloc(1, sizeof(chan_meta));
+    chan->numusers = 0;
+    chan->members = malloc(sizeof(list_t));
+    list_init(chan->members);
+    chan->names = NULL;
+    chan->nameslen = 0;
+    chan->namessize = 0;
+    pthread_mutex_init(&(chan->chan_lock), NULL);
+    chan->refs = 0;
+    chan->history = NULL;
+    chan->box = NULL;
+    return chan;
+}
+
+//nothing can reach chan any more, so its metadata can go straight away too
+static void channel_free(channel *chan){
+    list_destroy(chan->members);
+    free(chan->members);
+    free(chan->names);
+    free(chan->meta);
+    history_free(chan);
+    free(chan->box);    //its actor's mailbox, empty once nothing holds a reference
+    pthread_mutex_destroy(&(chan->chan_lock));
+    free(chan);
+}
+
+chanmap *chanmap_create(void){
+    chanmap *map = calloc(1, sizeof(chanmap));
+    int i;
+
+    if (map == NULL) {
+        perror("Could not allocate channel map");
+        exit(-1);
+    }
+    for (i = 0; i < CHANMAP_STRIPES; i++)
+        pthread_mutex_init(&(map->stripes[i]), NULL);
+    return map;
+}
+
+//call with the bucket's stripe held
+static channel *chanmap_find(chanmap *map, unsigned int b, const char *name){
+    channel *chan;
+    for (chan = map->buckets[b]; chan != NULL; chan = chan->next)
+        if (strcmp(chan->name, name) == 0)
+            return chan;
+    return NULL;
+}
+
+channel *chanmap_get(chanmap *map, const char *name){
+    unsigned int b = chanmap_hash(name);
+    channel *chan;
+
+    chirc_lock(stripe(map, b));
+    if ((chan = chanmap_find(map, b, name)) != NULL)
+        chan->refs++;
+    chirc_unlock(stripe(map, b));
+    return chan;
+}
+
+channel *chanmap_get_or_create(chanmap *map, const char *name){
+    unsigned int b = chanmap_hash(name);
+    channel *chan;
+
+    chirc_lock(stripe(map, b));
+    if ((chan = chanmap_find(map, b, name)) == NULL) {
+        chan = channel_new(name);
+        chan->next = map->buckets[b];
+        __atomic_store_n(&(map->buckets[b]), chan, __ATOMIC_RELAXED);
+        __sync_fetch_and_add(&(map->size), 1);
+    }
+    chan->refs++;
+    chirc_unlock(stripe(map, b));
+    return chan;
+}
+
+void chanmap_ref(chanmap *map, channel *chan){
+    unsigned int b = chanmap_hash(chan->name);
+
+    chirc_lock(stripe(map, b));
+    chan->refs++;
+    chirc_unlock(stripe(map, b));
+}
+
+void chanmap_put(chanmap *map, channel *chan){
+    unsigned int b = chanmap_hash(chan->name);
+    channel **p;
+
+    chirc_lock(stripe(map, b));
+    if (--(chan->refs) > 0) {
+        chirc_unlock(stripe(map, b));
+        return;
+    }
+    for (p = &(map->buckets[b]); *p != chan; p = &((*p)->next))
+        ;
+    __atomic_store_n(p, chan->next, __ATOMIC_RELAXED);
+    __sync_fetch_and_sub(&(map->size), 1);
+    chirc_unlock(stripe(map, b));
+    channel_free(chan);
+}
+
+unsigned int chanmap_size(chanmap *map){
+    return __atomic_load_n(&(map->size), __ATOMIC_RELAXED);
+}
+
+void chanmap_foreach(chanmap *map, void (*fn)(channel *chan, void *arg), void *arg){
+    unsigned int b;
+    channel *chan;
+
+    for (b = 0; b < CHANMAP_BUCKETS; b++) {
+        //skip empty buckets without touching their lock
+        if (__atomic_load_n(&(map->buckets[b]), __ATOMIC_RELAXED) == NULL)
+            continue;
+        chirc_lock(stripe(map, b));
+        for (chan = map->buckets[b]; chan != NULL; chan = chan->next)
+            fn(chan, arg);
+        chirc_unlock(stripe(map, b));
+    }
+}
@@ -0,0 +1,55 @@
+/*
+ *
+ *  CMSC 23300 / 33300 - Networks and Distributed Systems
+ *
+ *  concurrent channel registry for chirc project
+ *
+ *  sachs_sandler
+ *
+ */
+
+/*
+ * Channels are kept in a hash table of CHANMAP_BUCKETS chains, each bucket
+ * guarded by one of CHANMAP_STRIPES locks, so lookups and creations of
+ * different channels rarely wait on each other and never on the global lock.
+ *
+ * A channel lives as long as someone holds a reference to it. Every member
+ * holds one (through its mychan) and so does every chanmap_get and
+ * chanmap_get_or_create until the matching chanmap_put. The put that drops the
+ * last reference unlinks the channel and frees it, and since references are
+ * only taken under the bucket lock a lookup can never return a dying channel.
+ *
+ * Bucket locks come after the global lock: nothing may take lock while
+ * holding one, including the callback passed to chanmap_foreach.
+ */
+
+#ifndef CHANMAP_H_
+#define CHANMAP_H_
+
+#define CHANMAP_BUCKETS 65536   //chains stay short up to a few hundred thousand channels
+#define CHANMAP_STRIPES 256     //must divide CHANMAP_BUCKETS
+
+typedef struct chanmap chanmap;
+
+chanmap *chanmap_create(void);
+
+//returns a reference to the channel called name, or NULL if there is none
+channel *chanmap_get(chanmap *map, const char *name);
+
+//like chanmap_get, but creates an empty channel if there is none. concurrent
+//calls for the same name all get the same channel
+channel *chanmap_get_or_create(chanmap *map, const char *name);
+
+//takes another reference to a channel the caller already holds one to
+void chanmap_ref(chanmap *map, channel *chan);
+
+//drops a reference taken by one of the above
+void chanmap_put(chanmap *map, channel *chan);
+
+//number of channels in the map
+unsigned int chanmap_size(chanmap *map);
+
+//calls fn on every channel, with that channel's bucket locked
+void chanmap_foreach(chanmap *map, void (*fn)(channel *chan, void *arg), void *arg);
+
+#endif /* CHANMAP_H_ */
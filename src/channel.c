@@ -23,106 +23,309 @@
 #include "reply.h"
 #include "simclist.h"
 #include "ircstructs.h"
+#include "prof.h"
+#include "rcu.h"
+#include "chanmap.h"
+#include "history.h"
+#include "pool.h"
+#include "mem.h"
+#include "actor.h"
+#include "config.h"
 
 #define MAXMSG 512
 
 extern pthread_mutex_t lock;
-extern pthread_mutex_t loglock;
 
 void constr_reply(char code[4], person *client, char *reply, chirc_server *server, char *extra);
 void sendtochannel(chirc_server *server, channel *chan, char *msg, char *sender);
 void send_names(chirc_server *server, channel *chan, person *user);
 int fun_seek(const void *el, const void *indicator);
 void user_exit(chirc_server *server, person *user);
+int user_send(chirc_server *server, person *user, char *msg);
+void outbuf_init(outbuf *out);
+int outbuf_send(chirc_server *server, person *user, outbuf *out);
 
-void channel_join(person *client, chirc_server *server, char* channel_name){
-    int oper = 0;
-    int clientSocket = client->clientSocket;
-    char reply[MAXMSG];
+//each channel caches its NAMES list: every member's status prefix and nick, each
+//followed by a space. it is patched as members come and go instead of being rebuilt,
+//and like the member list it is protected by lock
+
+//replaces oldnick's entry with one for newnick carrying the status in mode. a NULL
+//newnick removes the entry, and a NULL oldnick appends a new one
+void names_patch(channel *chan, char *oldnick, char *newnick, unsigned int mode){
+    char entry[MAXMSG];
+    char *p = chan->names + chan->nameslen;     //where entry goes
+    char *next, *nick;
+    size_t entrylen = 0, oldlen = 0;
     
-    mychan *newchan;
+    if (newnick != NULL)
+        entrylen = snprintf(entry, MAXMSG, "%s%s%s ", (mode & MODE_OPER) ? "@" : "",
+                            (mode & MODE_VOICE) ? "+" : "", newnick);
+    if (oldnick != NULL) {
+        for (p = chan->names; p < chan->names + chan->nameslen; p = next) {
+            next = strchr(p, ' ') + 1;
+            nick = p + strspn(p, "@+");
+            if (next - nick - 1 == strlen(oldnick) && strncmp(nick, oldnick, next - nick - 1) == 0)
+                break;
+        }
+        if (p == chan->names + chan->nameslen)
+            return;
+        oldlen = next - p;
+    }
     
-    char *cname = malloc(strlen(channel_name));
-    strcpy(cname, channel_name);
-    
-    // First, check to see if the channel exists
-    el_indicator *seek_arg = malloc(sizeof(el_indicator));
-    seek_arg->field = CHAN;      // used in list seek
-    seek_arg->value = cname;   // used in list seek
-    
-    pthread_mutex_lock(&lock);
-    channel *channelpt = (channel *)list_seek(server->chanlist, seek_arg);
-    pthread_mutex_unlock(&lock);
-	free(seek_arg);
-
-    // Create a new channel if it doesn't
-    if (channelpt == NULL){
-        oper = 1;
-		channelpt = malloc(sizeof(channel));
-		strcpy(channelpt->name, cname);
-		channelpt->topic[0] = '\0';
-		channelpt->mode[0] = '\0';
-        channelpt->numusers = 0;
-        pthread_mutex_init(&(channelpt->chan_lock), NULL);
-        
-        pthread_mutex_lock(&lock);
-        list_append(server->chanlist, channelpt);
-        pthread_mutex_unlock(&lock);
+    if (chan->nameslen - oldlen + entrylen + 1 > chan->namessize) {
+        size_t off = p - chan->names;
+        chan->namessize = chan->namessize ? chan->namessize * 2 : 256;
+        while (chan->nameslen - oldlen + entrylen + 1 > chan->namessize)
+            chan->namessize *= 2;
+        chan->names = realloc(chan->names, chan->namessize);
+        p = chan->names + off;
     }
+    memmove(p + entrylen, p + oldlen, chan->names + chan->nameslen - (p + oldlen) + 1);
+    memcpy(p, entry, entrylen);
+    chan->nameslen += entrylen - oldlen;
+}
 
+//renames user in the names of every channel they are on
+void names_rename(chirc_server *server, person *user, char *newnick){
+    list_iter_t it;
+    mychan *userchan;
+    
+    chirc_lock(&lock);
+    list_iter_start(&it, user->my_chans);
+    while (list_iter_hasnext(&it)) {
+        userchan = (mychan *)list_iter_next(&it);
+        names_patch(userchan->chan, user->nick, newnick, userchan->mode);
+    }
+    chirc_unlock(&lock);
+}
 
-	// Check to see if the user is already in the channel
-    mychan *dummy = malloc(sizeof(mychan));
-    strcpy(dummy->name, cname);
-    if (list_contains(client->my_chans, dummy)) {
+//publishes a copy of chan's metadata with topic replaced (if not NULL) and the modes in
+//set and clear changed. the version it replaces is freed once no reader can see it
+void channel_update(channel *chan, char *topic, unsigned int set, unsigned int clear){
+    chan_meta *old, *new = malloc(sizeof(chan_meta));
+    
+    chirc_lock(&(chan->chan_lock));
+    old = chan->meta;
+    *new = *old;
+    if (topic != NULL) {
+        strcpy(new->topic, topic);
+        new->topic_time = time(NULL);
+    }
+    new->mode = (new->mode | set) & ~clear;
+    rcu_assign(chan->meta, new);
+    chirc_unlock(&(chan->chan_lock));
+    rcu_retire(old, free);
+}
+
+//LIST is answered from a snapshot of the channel list that is shared by every
+//LIST until something it shows changes, so a burst of LISTs (e.g. from clients
+//that LIST on connect) costs one walk of the channels rather than one each.
+//on a busy server something always has, so a snapshot is also kept for up to
+//list_refresh ms after it was built
+
+static pthread_mutex_t dirlock = PTHREAD_MUTEX_INITIALIZER;
+static directory *current_dir = NULL;    //protected by dirlock
+static struct timespec dir_built;        //when current_dir was built. protected by dirlock
+
+//state kept while directory_build walks the channels
+typedef struct {
+    directory *dir;
+    int maxentries;
+    size_t len;
+    size_t size;
+} directory_builder;
+
+//called after anything LIST shows has changed: a channel's existence, size or topic
+void directory_changed(chirc_server *server){
+    __sync_fetch_and_add(&(server->chanversion), 1);
+}
+
+//chanmap_foreach callback adding one channel to the directory being built
+static void directory_add(channel *chan, void *arg){
+    directory_builder *b = arg;
+    directory *dir = b->dir;
+    chan_meta *meta;
+    
+    //the last member has left and the channel is about to go
+    if (chan->numusers == 0)
         return;
+    if (dir->numentries == b->maxentries) {
+        b->maxentries *= 2;
+        dir->entries = realloc(dir->entries, b->maxentries * sizeof(dir_entry));
+    }
+    while (b->len + 3 * MAXMSG > b->size) {
+        b->size *= 2;
+        dir->data = realloc(dir->data, b->size);
     }
+    //pointers are fixed up once data has stopped moving
+    rcu_read_lock();
+    meta = rcu_dereference(chan->meta);
+    dir->entries[dir->numentries].numusers = chan->numusers;
+    dir->entries[dir->numentries].topic_time = meta->topic_time;
+    dir->entries[dir->numentries].name = (char *) b->len;
+    b->len += sprintf(dir->data + b->len, "%s", chan->name) + 1;
+    dir->entries[dir->numentries].listing = (char *) b->len;
+    if(meta->topic[0] == '\0')
+        b->len += sprintf(dir->data + b->len, "%s %i :", chan->name, chan->numusers) + 1;
+    else
+        b->len += sprintf(dir->data + b->len, "%s %i %s", chan->name, chan->numusers, meta->topic) + 1;
+    rcu_read_unlock();
+    dir->numentries++;
+}
+
+static directory *directory_build(chirc_server *server){
+    directory_builder b;
+    directory *dir = malloc(sizeof(directory));
+    size_t off;
+    int i;
+    
+    dir->version = server->chanversion;
+    dir->refs = 1;
+    dir->numentries = 0;
+    b.dir = dir;
+    b.len = 0;
+    b.size = 4096;
+    b.maxentries = chanmap_size(server->chans) + 1;
+    dir->data = malloc(b.size);
+    dir->entries = malloc(b.maxentries * sizeof(dir_entry));
+    chanmap_foreach(server->chans, directory_add, &b);
+    
+    for (i = 0; i < dir->numentries; i++) {
+        off = (size_t) dir->entries[i].name;
+        dir->entries[i].name = dir->data + off;
+        off = (size_t) dir->entries[i].listing;
+        dir->entries[i].listing = dir->data + off;
+    }
+    return dir;
+}
+
+//returns a reference to a snapshot at most list_refresh ms out of date. release it
+//with directory_put
+directory *directory_get(chirc_server *server){
+    directory *dir;
+    struct timespec now;
+    long age = 0;
+    int refresh;
     
-    // Finally, add the user to the channel
-    newchan = malloc(sizeof(mychan));
+    rcu_read_lock();
+    refresh = config_get()->list_refresh;
+    rcu_read_unlock();
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    
+    chirc_lock(&dirlock);
+    if (current_dir != NULL)
+        age = (now.tv_sec - dir_built.tv_sec) * 1000 + (now.tv_nsec - dir_built.tv_nsec) / 1000000;
+    if (current_dir == NULL || (current_dir->version != server->chanversion && age >= refresh)) {
+        dir = directory_build(server);
+        dir_built = now;
+        if (current_dir != NULL && --(current_dir->refs) == 0) {
+            free(current_dir->entries);
+            free(current_dir->data);
+            free(current_dir);
+        }
+        current_dir = dir;
+    }
+    dir = current_dir;
+    dir->refs++;
+    chirc_unlock(&dirlock);
+    return dir;
+}
+
+void directory_put(directory *dir){
+    chirc_lock(&dirlock);
+    if (--(dir->refs) == 0) {
+        free(dir->entries);
+        free(dir->data);
+        free(dir);
+    }
+    chirc_unlock(&dirlock);
+}
+
+void channel_join(person *client, chirc_server *server, char* channel_name){
+    char reply[MAXMSG];
+    mychan *newchan;
+    mychan dummy;
+    channel *channelpt;
+    outbuf history;
+    char *cname = channel_name;
+    
+	// Check to see if the user is already in the channel
+    strcpy(dummy.name, cname);
+    if (list_contains(client->my_chans, &dummy))
+        return;
+    
+    // Find the channel, creating it if it doesn't exist. the reference taken here
+    // is the one the membership holds until the user parts or quits
+    channelpt = chanmap_get_or_create(server->chans, cname);
+    
+    // Finally, add the user to the channel. whoever finds it empty becomes operator
+    newchan = pool_alloc(POOL_MYCHAN);
     strcpy(newchan->name, cname);
-    newchan->mode[0] = '\0';
-    if(oper)
-        strcat(newchan->mode, "o");
-    pthread_mutex_lock(&(client->c_lock));
+    newchan->mode = 0;
+    newchan->chan = channelpt;
+    chirc_lock(&(channelpt->chan_lock));
+    if ((channelpt->numusers)++ == 0)
+        newchan->mode |= MODE_OPER;
+    chirc_unlock(&(channelpt->chan_lock));
+    chirc_lock(&(client->c_lock));
     list_append(client->my_chans, newchan);
-    pthread_mutex_unlock(&(client->c_lock));
-    pthread_mutex_lock(&(channelpt->chan_lock));
-    channelpt->numusers++;
-    pthread_mutex_unlock(&(channelpt->chan_lock));
+    chirc_unlock(&(client->c_lock));
+    mem_charge(client, MEM_CHANNELS, sizeof(mychan));
+    directory_changed(server);
+    outbuf_init(&history);
 
     // Send appropriate replies
     // This first reply is send to all channel users
     snprintf(reply, MAXMSG-1, ":%s!%s@%s JOIN %s", client->nick, client->user, client->address, cname);
     strcat(reply, "\r\n");
-    sendtochannel(server, channelpt, reply, NULL);
+    if (actor_enabled())
+        actor_join(channelpt, client, newchan->mode, reply, &history);
+    else {
+        chirc_lock(&lock);
+        list_append(channelpt->members, client);
+        names_patch(channelpt, NULL, client->nick, newchan->mode);
+        history_replay(channelpt, &history);
+        chirc_unlock(&lock);
+        sendtochannel(server, channelpt, reply, NULL);
+    }
     
     // if the channel has a topic, send RPL_TOPIC
     
-    if(channelpt->topic[0] != '\0'){
-        snprintf(reply, MAXMSG-1, "%s %s", cname, channelpt->topic);
+    rcu_read_lock();
+    snprintf(reply, MAXMSG-1, "%s %s", cname, rcu_dereference(channelpt->meta)->topic);
+    rcu_read_unlock();
+    if(reply[strlen(cname) + 1] != '\0'){
         constr_reply(RPL_TOPIC, client, reply, server, NULL);
-        pthread_mutex_lock(&(client->c_lock));
-        if (send(clientSocket, reply, strlen(reply), 0) == -1) {
-            perror("Socket send() failed");
-            user_exit(server, client);
-        }
-        pthread_mutex_unlock(&(client->c_lock));
+        user_send(server, client, reply);
     }
     
     send_names(server, channelpt, client);
     
     constr_reply(RPL_ENDOFNAMES, client, reply, server, cname); //ie channel name as final parameter
-    pthread_mutex_lock(&(client->c_lock));
-    if(send(clientSocket, reply, strlen(reply), 0) == -1){
-        perror("Socket send() failed");
-        user_exit(server, client);
-    }
-    pthread_mutex_unlock(&(client->c_lock)); 
+    user_send(server, client, reply);
     
-    free(dummy);
+    // then what was said before the user got here
+    outbuf_send(server, client, &history);
 }
 
-
-
-
+//puts client back on a channel it was on before an upgrade, without telling anyone
+void channel_restore(chirc_server *server, person *client, char *cname, unsigned int mode){
+    mychan *newchan = pool_alloc(POOL_MYCHAN);
+    channel *channelpt = chanmap_get_or_create(server->chans, cname);
+    
+    strcpy(newchan->name, cname);
+    newchan->mode = mode;
+    newchan->chan = channelpt;
+    chirc_lock(&(channelpt->chan_lock));
+    channelpt->numusers++;
+    chirc_unlock(&(channelpt->chan_lock));
+    chirc_lock(&(client->c_lock));
+    list_append(client->my_chans, newchan);
+    chirc_unlock(&(client->c_lock));
+    mem_charge(client, MEM_CHANNELS, sizeof(mychan));
+    chirc_lock(&lock);
+    list_append(channelpt->members, client);
+    names_patch(channelpt, NULL, client->nick, mode);
+    chirc_unlock(&lock);
+    directory_changed(server);
+}
@@ -0,0 +1,265 @@
+/*
+ *
+ *  CMSC 23300 / 33300 - Networks and Distributed Systems
+ *
+ *  server configuration for chirc project
+ *
+ *  sachs_sandler
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include "config.h"
+#include "log.h"
+#include "rcu.h"
+#include "affinity.h"
+
+#define MAXOVERRIDES 8
+#define MAXVERSION 64      //longest version, which goes into replies alongside other fields
+
+static const char *level_names[] = { "debug", "info", "warn", "error" };     //in LOG_ order
+
+static chirc_config defaults = {
+    "",             //listen_address
+    "6667",         //port
+    128,            //backlog
+    "",             //oper_password
+    "chirc-0.1",    //version
+    "motd.txt",     //motd
+    16384,          //list_chunk
+    1000,           //list_refresh
+    0,              //history_lines
+    16384,          //history_bytes
+    16 << 20,       //history_total_bytes
+    1024,           //max_clients
+    64,             //max_clients_per_ip
+    100,            //registration_rate
+    LOG_INFO,       //log_level
+    "",             //log_file
+    10 << 20,       //log_max_bytes
+    5,              //log_keep
+    256 << 20,      //mem_budget
+    0,              //channel_actors
+    "",             //accept_cpus
+    "",             //client_cpus
+    "",             //actor_cpus
+};
+
+static chirc_config *current = &defaults;      //written only by config_load
+
+static struct {
+    char *key;
+    char *value;
+} overrides[MAXOVERRIDES];
+static int numoverrides = 0;
+
+static int set_string(char *field, const char *value){
+    if (strlen(value) >= CONFLINE)
+        return -1;
+    strcpy(field, value);
+    return 0;
+}
+
+static int set_number(long *n, const char *value, long min){
+    char *end;
+    errno = 0;
+    *n = strtol(value, &end, 10);
+    if (errno != 0 || end == value || *end != '\0' || *n < min)
+        return -1;
+    return 0;
+}
+
+//returns -1 for an unknown key or a bad value
+static int config_set(chirc_config *conf, const char *key, const char *value){
+    long n;
+
+    if (strcmp(key, "listen_address") == 0)
+        return set_string(conf->listen_address, value);
+    if (strcmp(key, "port") == 0)
+        return set_string(conf->port, value);
+    if (strcmp(key, "oper_password") == 0)
+        return set_string(conf->oper_password, value);
+    if (strcmp(key, "version") == 0) {
+        if (strlen(value) > MAXVERSION)
+            return -1;
+        return set_string(conf->version, value);
+    }
+    if (strcmp(key, "motd") == 0)
+        return set_string(conf->motd, value);
+    if (strcmp(key, "log_file") == 0)
+        return set_string(conf->log_file, value);
+    if (strcmp(key, "log_level") == 0) {
+        for (n = 0; n < sizeof(level_names) / sizeof(level_names[0]); n++)
+            if (strcmp(value, level_names[n]) == 0) {
+                conf->log_level = n;
+                return 0;
+            }
+        return -1;
+    }
+    if (strcmp(key, "backlog") == 0) {
+        if (set_number(&n, value, 1) == -1)
+            return -1;
+        conf->backlog = n;
+        return 0;
+    }
+    if (strcmp(key, "list_chunk") == 0) {
+        if (set_number(&n, value, 1) == -1)
+            return -1;
+        conf->list_chunk = n;
+        return 0;
+    }
+    if (strcmp(key, "list_refresh") == 0) {
+        if (set_number(&n, value, 0) == -1)
+            return -1;
+        conf->list_refresh = n;
+        return 0;
+    }
+    if (strcmp(key, "history_lines") == 0) {
+        if (set_number(&n, value, 0) == -1)
+            return -1;
+        conf->history_lines = n;
+        return 0;
+    }
+    if (strcmp(key, "history_bytes") == 0) {
+        if (set_number(&n, value, 512) == -1)   //room for at least one whole message
+            return -1;
+        conf->history_bytes = n;
+        return 0;
+    }
+    if (strcmp(key, "history_total_bytes") == 0) {
+        if (set_number(&n, value, 0) == -1)
+            return -1;
+        conf->history_total_bytes = n;
+        return 0;
+    }
+    if (strcmp(key, "max_clients") == 0) {
+        if (set_number(&n, value, 0) == -1)
+            return -1;
+        conf->max_clients = n;
+        return 0;
+    }
+    if (strcmp(key, "max_clients_per_ip") == 0) {
+        if (set_number(&n, value, 0) == -1)
+            return -1;
+        conf->max_clients_per_ip = n;
+        return 0;
+    }
+    if (strcmp(key, "registration_rate") == 0) {
+        if (set_number(&n, value, 0) == -1)
+            return -1;
+        conf->registration_rate = n;
+        return 0;
+    }
+    if (strcmp(key, "log_max_bytes") == 0) {
+        if (set_number(&n, value, 1) == -1)
+            return -1;
+        conf->log_max_bytes = n;
+        return 0;
+    }
+    if (strcmp(key, "log_keep") == 0) {
+        if (set_number(&n, value, 0) == -1)
+            return -1;
+        conf->log_keep = n;
+        return 0;
+    }
+    if (strcmp(key, "mem_budget") == 0) {
+        if (set_number(&n, value, 0) == -1)
+            return -1;
+        conf->mem_budget = n;
+        return 0;
+    }
+    if (strcmp(key, "channel_actors") == 0) {
+        if (set_number(&n, value, 0) == -1)
+            return -1;
+        conf->channel_actors = n;
+        return 0;
+    }
+    if (strcmp(key, "accept_cpus") == 0)
+        return affinity_valid(value) == -1 ? -1 : set_string(conf->accept_cpus, value);
+    if (strcmp(key, "client_cpus") == 0)
+        return affinity_valid(value) == -1 ? -1 : set_string(conf->client_cpus, value);
+    if (strcmp(key, "actor_cpus") == 0)
+        return affinity_valid(value) == -1 ? -1 : set_string(conf->actor_cpus, value);
+    return -1;
+}
+
+int config_override(const char *key, const char *value){
+    chirc_config scratch = defaults;
+
+    if (numoverrides == MAXOVERRIDES || config_set(&scratch, key, value) == -1)
+        return -1;
+    overrides[numoverrides].key = strdup(key);
+    overrides[numoverrides].value = strdup(value);
+    numoverrides++;
+    return 0;
+}
+
+//trims leading and trailing whitespace in place
+static char *trim(char *s){
+    char *end;
+    while (isspace((unsigned char) *s))
+        s++;
+    end = s + strlen(s);
+    while (end > s && isspace((unsigned char) end[-1]))
+        end--;
+    *end = '\0';
+    return s;
+}
+
+static int config_read(chirc_config *conf, const char *path){
+    FILE *fp;
+    char line[2 * CONFLINE];
+    char *key, *value, *eq;
+    int lineno = 0, errors = 0;
+
+    if ((fp = fopen(path, "r")) == NULL) {
+        perror("Could not open configuration file");
+        return -1;
+    }
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        lineno++;
+        key = trim(line);
+        if (*key == '\0' || *key == '#')
+            continue;
+        if ((eq = strchr(key, '=')) == NULL) {
+            fprintf(stderr, "%s:%d: expected key = value\n", path, lineno);
+            errors++;
+            continue;
+        }
+        *eq = '\0';
+        key = trim(key);
+        value = trim(eq + 1);
+        if (config_set(conf, key, value) == -1) {
+            fprintf(stderr, "%s:%d: bad setting for %s\n", path, lineno, key);
+            errors++;
+        }
+    }
+    fclose(fp);
+    return errors ? -1 : 0;
+}
+
+int config_load(const char *path){
+    chirc_config *conf = malloc(sizeof(chirc_config)), *old;
+    int i;
+
+    *conf = defaults;
+    if (path != NULL && config_read(conf, path) == -1) {
+        free(conf);
+        return -1;
+    }
+    for (i = 0; i < numoverrides; i++)
+        config_set(conf, overrides[i].key, overrides[i].value);
+
+    old = current;
+    rcu_assign(current, conf);
+    if (old != &defaults)
+        rcu_retire(old, free);
+    return 0;
+}
+
+const chirc_config *config_get(void){
+    return rcu_dereference(current);
+}
@@ -0,0 +1,99 @@
+/*
+ *
+ *  CMSC 23300 / 33300 - Networks and Distributed Systems
+ *
+ *  server configuration for chirc project
+ *
+ *  sachs_sandler
+ *
+ */
+
+/*
+ * chirc -f file reads settings from file, one "key = value" per line. Blank
+ * lines and lines starting with # are ignored. Keys:
+ *
+ *   listen_address   address to listen on (default: every address)
+ *   port             port to listen on (default 6667)
+ *   backlog          listen() backlog (default 128)
+ *   oper_password    password OPER expects
+ *   version          version reported in RPL_YOURHOST, RPL_MYINFO and RPL_WHOISSERVER
+ *                    (at most 64 characters)
+ *   motd             file sent by MOTD, relative to the working directory
+ *   list_chunk       bytes of LIST output queued before they are sent
+ *   list_refresh     milliseconds LIST may show a channel list that has since
+ *                    changed, 0 to always show the current one (default 1000)
+ *   history_lines    channel messages replayed to someone joining (default 0, none)
+ *   history_bytes    most bytes of messages kept per channel (default 16384)
+ *   history_total_bytes  most bytes kept for every channel together (default 16M)
+ *   max_clients      most connections open at once, 0 for no limit (default 1024)
+ *   max_clients_per_ip  most connections from one address, 0 for no limit (default 64)
+ *   registration_rate  new connections started per second, 0 for no limit (default 100)
+ *   log_level        least severe events logged: debug, info, warn or error (default info)
+ *   log_file         file events are logged to (default: stderr)
+ *   log_max_bytes    size log_file is rotated at (default 10M)
+ *   log_keep         rotated files kept (default 5)
+ *   mem_budget       bytes connections and history may hold before the biggest
+ *                    connections are shut down, 0 for no limit (default 256M)
+ *   channel_actors   threads running channels as actors, 0 to run them on the
+ *                    client threads (default 0). only read at startup (see actor.h)
+ *   accept_cpus      CPUs the accept thread runs on, as a list like 0-3,8
+ *                    (default: any). only read at startup, like the next two
+ *   client_cpus      CPUs connections' threads run on, each kept to one NUMA
+ *                    node (default: any; see affinity.h)
+ *   actor_cpus       CPUs channel actors are pinned to, one each (default: any)
+ *
+ * -p and -o on the command line override port and oper_password. SIGHUP
+ * rereads the file. A file that does not parse is reported and the running
+ * configuration is kept. Connected clients are not affected by a reload: a
+ * new listen_address or port opens a new listening socket and closes the old
+ * one, and a new backlog applies to the socket already listening.
+ *
+ * The current configuration is published through RCU (see rcu.h), so read it
+ * with config_get between rcu_read_lock and rcu_read_unlock and copy out
+ * whatever is needed after the read section.
+ */
+
+#ifndef CONFIG_H_
+#define CONFIG_H_
+
+#include <stddef.h>
+
+#define CONFLINE 512
+
+typedef struct {
+    char listen_address[CONFLINE];  //empty for every address
+    char port[CONFLINE];
+    int backlog;
+    char oper_password[CONFLINE];
+    char version[CONFLINE];
+    char motd[CONFLINE];
+    size_t list_chunk;
+    int list_refresh;
+    int history_lines;
+    size_t history_bytes;
+    size_t history_total_bytes;
+    int max_clients;
+    int max_clients_per_ip;
+    int registration_rate;
+    int log_level;      //LOG_DEBUG to LOG_ERROR (see log.h)
+    char log_file[CONFLINE];
+    size_t log_max_bytes;
+    int log_keep;
+    size_t mem_budget;
+    int channel_actors;
+    char accept_cpus[CONFLINE];     //CPU lists (see affinity.h), empty for no pinning
+    char client_cpus[CONFLINE];
+    char actor_cpus[CONFLINE];
+} chirc_config;
+
+//settings that win over the file, for command line options. call before config_load
+int config_override(const char *key, const char *value);
+
+//reads path (or just applies the defaults and overrides if it is NULL) and publishes
+//the result. returns -1, leaving the current configuration alone, if it can't
+int config_load(const char *path);
+
+//the current configuration. only valid inside an RCU read section
+const chirc_config *config_get(void);
+
+#endif /* CONFIG_H_ */
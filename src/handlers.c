@@ -20,9 +20,21 @@
 #include <signal.h>
 #include <errno.h>
 #include <time.h>
+#include <limits.h>
 #include "reply.h"
 #include "simclist.h"
 #include "ircstructs.h"
+#include "prof.h"
+#include "trace.h"
+#include "rcu.h"
+#include "chanmap.h"
+#include "config.h"
+#include "history.h"
+#include "log.h"
+#include "pool.h"
+#include "mem.h"
+#include "transport.h"
+#include "actor.h"
 
 #define MAXMSG 512
 
@@ -34,9 +46,25 @@ void do_registration(person *client, chirc_server *server);
 void sendtoallchans(chirc_server *server, person *user, char *msg);
 void channel_join(person *client, chirc_server *server, char* channel_name);
 void sendtochannel(chirc_server *server, channel *chan, char *msg, char *sender);
-void channel_destroy(chirc_server *server, channel *chan);
 void user_exit(chirc_server *server, person *user);
+int user_send(chirc_server *server, person *user, char *msg);
+void user_ref(person *user);
+void user_put(person *user);
 void send_names(chirc_server *server, channel *chan, person *user);
+int split_list(char *list, char **items, int max, char **rest);
+void fanout_begin(void);
+int fanout_mark(person *someone);
+void outbuf_init(outbuf *out);
+void outbuf_add(outbuf *out, char *msg);
+int outbuf_send(chirc_server *server, person *user, outbuf *out);
+void names_patch(channel *chan, char *oldnick, char *newnick, unsigned int mode);
+char *mode_string(unsigned int mode, char *buf);
+void names_rename(chirc_server *server, person *user, char *newnick);
+void names_reply(chirc_server *server, channel *chan, person *user, outbuf *out);
+void directory_changed(chirc_server *server);
+void channel_update(channel *chan, char *topic, unsigned int set, unsigned int clear);
+directory *directory_get(chirc_server *server);
+void directory_put(directory *dir);
 
 //all the handlers
 int chirc_handle_NICK(chirc_server *server, person *user, chirc_message params);
@@ -58,39 +86,71 @@ int chirc_handle_WHO(chirc_server *server, person *user, chirc_message params);
 int chirc_handle_NAMES(chirc_server *server, person *user, chirc_message params);
 int chirc_handle_MODE(chirc_server *server, person *user, chirc_message params);
 int chirc_handle_OPER(chirc_server *server, person *user, chirc_message params);
+int chirc_handle_STATS(chirc_server *server, person *user, chirc_message params);
 
 int chirc_handle_UNKNOWN(chirc_server *server, person *user, chirc_message params);
 
 
 
+typedef int (*handler_function)(chirc_server *server, person *user, chirc_message params);
+
+struct handler_entry
+{
+    char *name;
+    handler_function func;
+};
+
+//dispatch table--the index of a command in this table is its command id
+struct handler_entry handlers[] = {
+    {"NICK",    chirc_handle_NICK},
+    {"USER",    chirc_handle_USER},
+    {"QUIT",    chirc_handle_QUIT},
+    
+    {"PRIVMSG", chirc_handle_PRIVMSG},
+    {"NOTICE",  chirc_handle_NOTICE},
+    
+    {"WHOIS",   chirc_handle_WHOIS},
+    
+    {"PING",    chirc_handle_PING},
+    {"PONG",    NULL},                  //drop PONG silently
+    {"LUSERS",  chirc_handle_LUSERS},
+    {"MOTD",    chirc_handle_MOTD},
+    
+    {"JOIN",    chirc_handle_JOIN},
+    {"AWAY",    chirc_handle_AWAY},
+    {"PART",    chirc_handle_PART},
+    {"TOPIC",   chirc_handle_TOPIC},
+    {"NAMES",   chirc_handle_NAMES},
+    {"MODE",    chirc_handle_MODE},
+    {"OPER",    chirc_handle_OPER},
+    {"LIST",    chirc_handle_LIST},
+    {"WHO",     chirc_handle_WHO},
+    {"STATS",   chirc_handle_STATS},
+};
+
+#define NUM_HANDLERS (sizeof(handlers) / sizeof(struct handler_entry))
+
 void handle_chirc_message(chirc_server *server, person *user, chirc_message params)
 {
     char *command = params[0];
-    
-    if      (strcmp(command, "NICK") == 0)    chirc_handle_NICK(server, user, params);
-    else if (strcmp(command, "USER") == 0)    chirc_handle_USER(server, user, params);
-    else if (strcmp(command, "QUIT") == 0)    chirc_handle_QUIT(server, user, params);
-    
-    else if (strcmp(command, "PRIVMSG") == 0) chirc_handle_PRIVMSG(server, user, params);
-    else if (strcmp(command, "NOTICE") == 0)  chirc_handle_NOTICE(server, user, params);
-    
-    else if (strcmp(command, "WHOIS") == 0)   chirc_handle_WHOIS(server, user, params);
-    
-    else if (strcmp(command, "PING") == 0)    chirc_handle_PING(server, user, params);
-    else if (strcmp(command, "PONG") == 0) ;  //drop PONG silently
-    else if (strcmp(command, "LUSERS") == 0)  chirc_handle_LUSERS(server, user, params);
-    else if (strcmp(command, "MOTD") == 0)    chirc_handle_MOTD(server, user, params);
-    
-    else if (strcmp(command, "JOIN") == 0)    chirc_handle_JOIN(server, user, params);
-    else if (strcmp(command, "AWAY") == 0)    chirc_handle_AWAY(server, user, params);
-    else if (strcmp(command, "PART") == 0)    chirc_handle_PART(server, user, params);
-    else if (strcmp(command, "TOPIC") == 0)   chirc_handle_TOPIC(server, user, params);
-    else if (strcmp(command, "NAMES") == 0)   chirc_handle_NAMES(server, user, params);
-    else if (strcmp(command, "MODE") == 0)   chirc_handle_MODE(server, user, params);
-    else if (strcmp(command, "OPER") == 0)   chirc_handle_OPER(server, user, params);
-    else if (strcmp(command, "LIST") == 0)   chirc_handle_LIST(server, user, params);
-    else if (strcmp(command, "WHO") == 0)    chirc_handle_WHO(server, user, params);
-    else chirc_handle_UNKNOWN(server, user, params);
+    int i;
+    int fd = user->clientSocket;
+    PROF_START(start);
+    
+    for(i = 0; i < NUM_HANDLERS; i++)
+        if (strcmp(command, handlers[i].name) == 0)
+            break;
+    
+    CHIRC_TRACE3(handler__entry, fd, i, command);
+    if (i == NUM_HANDLERS) {
+        chirc_handle_UNKNOWN(server, user, params);
+        PROF_HANDLER(i, "UNKNOWN", start);
+    }
+    else if (handlers[i].func != NULL) {
+        handlers[i].func(server, user, params);
+        PROF_HANDLER(i, handlers[i].name, start);
+    }
+    CHIRC_TRACE2(handler__return, fd, i);
 }
 
 int chirc_handle_NICK(chirc_server  *server, // current server
@@ -100,56 +160,47 @@ int chirc_handle_NICK(chirc_server  *server, // current server
 {
     char reply[MAXMSG];                         // reply to be sent as a response
     char *newnick;                              // used for registering the new NICK
-    int clientSocket = user->clientSocket;
     newnick = msg[1];
     
     //check list to see if someone already has that nickname
-    el_indicator *seek_arg = malloc(sizeof(el_indicator));
-    seek_arg->field = NICK;      // used in list seek
-    seek_arg->value = newnick;   // used in list seek
+    el_indicator seek_arg;
+    seek_arg.field = NICK;      // used in list seek
+    seek_arg.value = newnick;   // used in list seek
     
-    pthread_mutex_lock(&lock);
-    person *clientpt = (person *)list_seek(server->userlist, seek_arg);
-    pthread_mutex_unlock(&lock);
-    free(seek_arg);
+    chirc_lock(&lock);
+    person *clientpt = (person *)list_seek(server->userlist, &seek_arg);
+    chirc_unlock(&lock);
     
     
     if (clientpt) { //nickname is already in use
         constr_reply(ERR_NICKNAMEINUSE, user, reply, server, newnick);
         
-        pthread_mutex_lock(&(user->c_lock));
-        if(send(clientSocket, reply, strlen(reply), 0) == -1)  // if there is an error, disconnect the client and delete them from the userlist
-        {
-            perror("Socket send() failed");
-            user_exit(server, user);
-        }
-        pthread_mutex_unlock(&(user->c_lock));
+        user_send(server, user, reply);
     }
     else{
         if (strlen(user->nick)){    //changing NICK already given
             //send notification of change in NICK
             snprintf(reply, MAXMSG - 2, ":%s!%s@%s NICK :%s", user->nick, user->user, user->address, newnick);
             strcat(reply, "\r\n");
-            pthread_mutex_lock(&(user->c_lock));
-            if(send(clientSocket, reply, strlen(reply), 0) == -1)
-            {
-                perror("Socket send() failed");
-                user_exit(server, user);
-            }
+            user_send(server, user, reply);
             
             //actually change nick--also need to change it in each channel!
-            pthread_mutex_unlock(&(user->c_lock));
             sendtoallchans(server, user, reply);
-            pthread_mutex_lock(&lock);
+            names_rename(server, user, newnick);
+            chirc_lock(&lock);
+            list_unindex(server->userlist, user);
             strcpy(user->nick, newnick);
-            pthread_mutex_unlock(&lock);
+            list_reindex(server->userlist, user);
+            chirc_unlock(&lock);
 
         }
         else{
             //this is the first time nick is given
-            pthread_mutex_lock(&lock);
+            chirc_lock(&lock);
+            list_unindex(server->userlist, user);
             strcpy(user->nick, newnick);
-            pthread_mutex_unlock(&lock);
+            list_reindex(server->userlist, user);
+            chirc_unlock(&lock);
             if (strlen(user->user))
                 do_registration(user, server); // registers the client if they have added a nick and username
         }
@@ -163,7 +214,6 @@ int chirc_handle_USER(chirc_server  *server, // current server
                       )
 {
     char reply[MAXMSG];
-    int clientSocket = user->clientSocket;
     char *username = msg[1];
     char *fullname = msg[4];
     
@@ -173,19 +223,13 @@ int chirc_handle_USER(chirc_server  *server, // current server
     if ( strlen(user->user) && strlen(user->nick) ) {   //already registered
         constr_reply(ERR_ALREADYREGISTRED, user, reply, server, NULL);
         
-        pthread_mutex_lock(&(user->c_lock));
-        if(send(clientSocket, reply, strlen(reply), 0) == -1)
-        {
-            perror("Socket send() failed");
-            user_exit(server, user);
-        }
-        pthread_mutex_unlock(&(user->c_lock));
+        user_send(server, user, reply);
     }
     else {  //first time user is sent, so get info
-        pthread_mutex_lock(&lock);
+        chirc_lock(&lock);
         strcpy(user->user, username);
         strcpy(user->fullname, fullname);
-        pthread_mutex_unlock(&lock);
+        chirc_unlock(&lock);
         if(strlen(user->nick))
             do_registration(user, server); // registers the client if they have added a nick and username
     }
@@ -216,247 +260,231 @@ int chirc_handle_QUIT(chirc_server  *server, // current server
     snprintf(reply, MAXMSG - 2, "ERROR :Closing Link: %s (%s)", user->address, quitmsg + 1);
     strcat(reply, "\r\n");
     
-    pthread_mutex_lock(&(user->c_lock));
-    if(send(clientSocket, reply, strlen(reply), 0) == -1)
+    chirc_lock(&(user->c_lock));
+    if(transport_send(clientSocket, reply, strlen(reply)) == -1)
     {
-        perror("Socket send() failed");
+        log_event(LOG_SEND_ERROR, clientSocket, errno, 0, NULL);
     }
-    pthread_mutex_unlock(&(user->c_lock));
+    chirc_unlock(&(user->c_lock));
     //close socket and remove user from userlist
     user_exit(server, user);
     
     return 0;
 }
 
-int chirc_handle_PRIVMSG(chirc_server *server, //current server
-                         person *user,          //current user
-                         chirc_message params)  //message received
+//a PRIVMSG/NOTICE target after lookup
+typedef struct
+{
+    char *name;
+    person *recip;          //set if the target is a nick
+    channel *chan;          //set if the target is a channel
+    char *error;            //reply code if the message can't be delivered to this target
+    char relay[MAXMSG];     //message relayed to everyone reached through this target
+} msg_target;
+
+//answers each of the comma-separated targets in rest, the ones past MAXTARGETS,
+//with ERR_TOOMANYTARGETS
+static void too_many_targets(chirc_server *server, person *user, char *rest)
 {
-    char priv_msg[MAXMSG];
     char reply[MAXMSG];
-    int senderSocket = user->clientSocket;
-    char *target_name = params[1];  //may be a nickname or channel name
-    char *recipaway;
-    char awaymsg[MAXMSG];
-    mychan *dummy = malloc(sizeof(mychan));
-    strcpy(dummy->name, target_name);
+    char *item;
     
-    //check that sender is registered
+    while (rest != NULL) {
+        item = strsep(&rest, ",");
+        constr_reply(ERR_TOOMANYTARGETS, user, reply, server, item);
+        user_send(server, user, reply);
+    }
+}
+
+//relays a PRIVMSG or NOTICE to a comma-separated list of nicks and channels.
+//each recipient gets exactly one copy, even if several targets reach them.
+static int relay_message(chirc_server *server, person *user, chirc_message params, int notice)
+{
+    char reply[MAXMSG];
+    char awaymsg[MAXMSG];
+    char *names[MAXTARGETS];
+    char *rest;
+    msg_target targets[MAXTARGETS];
+    el_indicator seek_arg;
+    mychan *mychanpt;
+    list_iter_t it;
+    person *someone;
+    person *stack_recips[FANOUT_STACK];
+    int stack_via[FANOUT_STACK];
+    person **recips = stack_recips;
+    int *via = stack_via;
+    int numtargets, numrecips = 0, maxrecips = 0, byactor;
+    unsigned int chanmode;
+    int i, t;
+    
+    //check that sender is registered--although NOTICE is never answered, the reference server indicates that ERR_NOTREGISTERED should still be returned to unregistered user
     if(!(strlen(user->nick) && strlen(user->user))){
         constr_reply(ERR_NOTREGISTERED, user, reply, server, NULL);
-        pthread_mutex_lock(&(user->c_lock));
-        if(send(senderSocket, reply, strlen(reply), 0) == -1)
-        {
-            perror("Socket send() failed");
-            user_exit(server, user);
-        }
-        pthread_mutex_unlock(&(user->c_lock));
-        
-        free(dummy);
+        user_send(server, user, reply);
         return 0;
     }
     
-    //try to get recipient from userlist and chanlist
-    el_indicator *seek_arg = malloc(sizeof(el_indicator));
-    seek_arg->field = NICK;
-    seek_arg->value = target_name;
-    pthread_mutex_lock(&lock);
-    person *recippt = (person *)list_seek(server->userlist, seek_arg);
-    seek_arg->field = CHAN;
-    channel *chanpt = (channel *)list_seek(server->chanlist, seek_arg);
-    pthread_mutex_unlock(&lock);
-
-
-    
-    
-    if (!recippt && !chanpt) {
-        constr_reply(ERR_NOSUCHNICK, user, reply, server, target_name);
-        
-        pthread_mutex_lock(&(user->c_lock));
-        if(send(senderSocket, reply, strlen(reply), 0) == -1)
-        {
-            perror("Socket send() failed");
-            user_exit(server, user);
+    numtargets = split_list(params[1], names, MAXTARGETS, &rest);
+    
+    //look every target up with a single acquisition of the server lock
+    chirc_lock(&lock);
+    for(t = 0; t < numtargets; t++){
+        targets[t].name = names[t];
+        targets[t].error = NULL;
+        targets[t].recip = NULL;
+        targets[t].chan = NULL;
+        if (names[t][0] == '\0') {
+            targets[t].error = ERR_NORECIPIENT;
+            continue;
         }
-        pthread_mutex_unlock(&(user->c_lock));
-        
+        seek_arg.value = names[t];
+        seek_arg.field = NICK;
+        targets[t].recip = (person *)list_seek(server->userlist, &seek_arg);
+        if (targets[t].recip != NULL)
+            user_ref(targets[t].recip);     //until the away check at the end
+        else {
+            targets[t].chan = chanmap_get(server->chans, names[t]);
+        }
+        if (targets[t].recip == NULL && targets[t].chan == NULL)
+            targets[t].error = ERR_NOSUCHNICK;
+    }
+    chirc_unlock(&lock);
+    
+    //sender must be on a channel, and voiced or an operator if it is moderated
+    seek_arg.field = USERCHAN;
+    chirc_lock(&(user->c_lock));
+    for(t = 0; t < numtargets; t++){
+        if (targets[t].chan == NULL)
+            continue;
+        rcu_read_lock();
+        chanmode = rcu_dereference(targets[t].chan->meta)->mode;
+        rcu_read_unlock();
+        seek_arg.value = targets[t].name;
+        mychanpt = (mychan *)list_seek(user->my_chans, &seek_arg);
+        if (mychanpt == NULL)
+            targets[t].error = ERR_CANNOTSENDTOCHAN;
+        else if ((chanmode & MODE_MODERATED) && !(user->mode & MODE_OPER)
+                 && !(mychanpt->mode & MEMBER_MODES))
+            targets[t].error = ERR_CANNOTSENDTOCHAN;
     }
     
-    //relay message
-    else{
-        pthread_mutex_lock(&(user->c_lock));
-        snprintf(priv_msg, (MAXMSG-1), ":%s!%s@%s %s %s %s", user->nick,
-                                                             user->user,
-                                                             user->address,
-                                                             params[0],
-                                                             params[1],
-                                                             params[2]
-        );
-
-        strcat(priv_msg, "\r\n");
-        pthread_mutex_unlock(&(user->c_lock)); 
-        if (recippt != NULL){               //recipient is an individual
-            pthread_mutex_lock(&(recippt->c_lock));
-            if(send(recippt->clientSocket, priv_msg, strlen(priv_msg), 0) == -1)
-            {
-                perror("Socket send() failed");
-                user_exit(server, recippt);
-            }
-            //check whether recipient is away
-            recipaway = strchr(recippt->mode, (int) 'a');
-            pthread_mutex_unlock(&(recippt->c_lock));
-            if (recipaway != NULL) {    //recipient is away
-                pthread_mutex_lock(&(recippt->c_lock));
-                snprintf(awaymsg, MAXMSG, "%s %s", recippt->nick, recippt->away);
-                pthread_mutex_unlock(&(recippt->c_lock));
-                constr_reply(RPL_AWAY, user, reply, server, awaymsg);
-                
-                pthread_mutex_lock(&(user->c_lock));
-                if(send(senderSocket, reply, strlen(reply), 0) == -1)
-                {
-                    perror("Socket send() failed");
-                    user_exit(server, user);
-                }
-                pthread_mutex_unlock(&(user->c_lock));
-                
-                return 0;
+    for(t = 0; t < numtargets; t++){
+        if (targets[t].error == NULL) {
+            snprintf(targets[t].relay, MAXMSG - 2, ":%s!%s@%s %s %s %s", user->nick, user->user, user->address,
+                     params[0], targets[t].name, params[2]);
+            strcat(targets[t].relay, "\r\n");
+        }
+    }
+    chirc_unlock(&(user->c_lock));
+    
+    //with actors, a message to just one channel is left to its actor. anything
+    //else waits for what the user already posted, so it can't get ahead of it
+    byactor = actor_enabled() && numtargets == 1 && targets[0].error == NULL && targets[0].chan != NULL;
+    if (byactor)
+        actor_send(targets[0].chan, user, targets[0].relay, 1);
+    else if (actor_enabled())
+        actor_flush(user);
+    
+    //each recipient is reached through the first target that names them
+    CHIRC_TRACE2(fanout__start, params[1], strlen(params[2]));
+    chirc_lock(&lock);
+    //most messages reach few enough people to keep track of them on the stack
+    for(t = 0; t < numtargets; t++){
+        if (targets[t].error != NULL)
+            continue;
+        if (targets[t].recip != NULL)
+            maxrecips++;
+        else if (!byactor)
+            maxrecips += list_size(targets[t].chan->members);
+    }
+    if (maxrecips > FANOUT_STACK) {
+        recips = malloc(maxrecips * sizeof(person *));
+        via = malloc(maxrecips * sizeof(int));
+    }
+    fanout_begin();
+    for(t = 0; t < numtargets; t++){
+        if (targets[t].error != NULL)
+            continue;
+        if (targets[t].recip != NULL) {
+            if (fanout_mark(targets[t].recip)) {
+                user_ref(targets[t].recip);
+                recips[numrecips] = targets[t].recip;
+                via[numrecips++] = t;
             }
+            continue;
         }
-        else{       //recipient is a channel
-            //check that user is member of channel
-            if (!list_contains(user->my_chans, dummy)) {
-                constr_reply(ERR_CANNOTSENDTOCHAN, user, reply, server, target_name);
-                
-                pthread_mutex_lock(&(user->c_lock));
-                if(send(senderSocket, reply, strlen(reply), 0) == -1)
-                {
-                    perror("Socket send() failed");
-                    user_exit(server, user);
-                }
-                pthread_mutex_unlock(&(user->c_lock));
-                
-                return 0;
+        if (byactor)
+            continue;
+        list_iter_start(&it, targets[t].chan->members);
+        while (list_iter_hasnext(&it)) {
+            someone = (person *)list_iter_next(&it);
+            if (someone != user && fanout_mark(someone)) {
+                user_ref(someone);
+                recips[numrecips] = someone;
+                via[numrecips++] = t;
             }
-            
-            // check that the sender has the appropriate mode for channel
-            if(strchr(chanpt->mode,'m') != NULL) {
-            	if(strchr(user->mode,'o') == NULL) {
-            		seek_arg->field = USERCHAN;      
-    				seek_arg->value = params[1];   
-   					pthread_mutex_lock(&lock);
-    				mychan *mychanpt = (mychan *)list_seek(user->my_chans, seek_arg);
-    				pthread_mutex_unlock(&lock);
-    				if( (strchr(mychanpt->mode,'o')==NULL) && (strchr(mychanpt->mode,'v')==NULL)) {
-    					constr_reply(ERR_CANNOTSENDTOCHAN, user, reply, server, target_name);
-                
-                		pthread_mutex_lock(&(user->c_lock));
-                		if(send(senderSocket, reply, strlen(reply), 0) == -1)
-                		{
-                		    perror("Socket send() failed");
-                		    user_exit(server, user);
-                		}
-                		pthread_mutex_unlock(&(user->c_lock));
-                        
-                        free(seek_arg);
-                        free(dummy);
-                        return 0;
-                	}
-            	}
+        }
+        history_add(targets[t].chan, targets[t].relay);
+    }
+    chirc_unlock(&lock);
+    
+    for(i = 0; i < numrecips; i++){
+        user_send(server, recips[i], targets[via[i]].relay);
+        user_put(recips[i]);
+    }
+    CHIRC_TRACE2(fanout__done, params[1], numrecips);
+    if (recips != stack_recips) {
+        free(recips);
+        free(via);
+    }
+    for(t = 0; t < numtargets; t++)
+        if (targets[t].chan != NULL)
+            chanmap_put(server->chans, targets[t].chan);
+    
+    if (notice) {
+        for(t = 0; t < numtargets; t++)
+            if (targets[t].recip != NULL)
+                user_put(targets[t].recip);
+        return 0;
+    }
+    
+    //errors and away messages go back to the sender in target order
+    for(t = 0; t < numtargets; t++){
+        if (targets[t].error != NULL) {
+            constr_reply(targets[t].error, user, reply, server,
+                         targets[t].name[0] == '\0' ? params[0] : targets[t].name);
+            user_send(server, user, reply);
+        }
+        else if (targets[t].recip != NULL) {
+            someone = targets[t].recip;
+            chirc_lock(&(someone->c_lock));
+            awaymsg[0] = '\0';
+            if (someone->mode & MODE_AWAY)
+                snprintf(awaymsg, MAXMSG, "%s %s", someone->nick, someone->away);
+            chirc_unlock(&(someone->c_lock));
+            user_put(someone);
+            if (awaymsg[0] != '\0') {
+                constr_reply(RPL_AWAY, user, reply, server, awaymsg);
+                user_send(server, user, reply);
             }
-            sendtochannel(server, chanpt, priv_msg, user->nick);
         }
     }
-        
-    free(seek_arg);
-    free(dummy);    
+    too_many_targets(server, user, rest);
     return 0;
 }
 
+int chirc_handle_PRIVMSG(chirc_server *server, //current server
+                         person *user,          //current user
+                         chirc_message params)  //message received
+{
+    return relay_message(server, user, params, 0);
+}
+
 int chirc_handle_NOTICE(chirc_server *server,  //current server
                         person *user,          //current user
                         chirc_message params)  //message received
 {
-    int clientSocket = user->clientSocket;
-    char notice[MAXMSG];
-    char reply[MAXMSG];
-    char *target_name = params[1];
-    mychan *dummy = malloc(sizeof(mychan));
-    strcpy(dummy->name, target_name);
-    
-    //get pointer to recipient
-    el_indicator *seek_arg = malloc(sizeof(el_indicator));
-    seek_arg->field = NICK;
-    seek_arg->value = target_name;
-    pthread_mutex_lock(&lock);
-    person *recippt = (person *)list_seek(server->userlist, seek_arg);
-    seek_arg->field = CHAN;
-    channel *chanpt = (channel *)list_seek(server->chanlist, seek_arg);
-    pthread_mutex_unlock(&lock);
-    free(seek_arg);
-    
-    //check that sender is registered--although this is a notice, the reference server indicates that ERR_NOTREGISTERED should still be returned to unregistered user
-    if(!(strlen(user->nick) && strlen(user->user))){
-        constr_reply(ERR_NOTREGISTERED, user, reply, server, NULL);
-        pthread_mutex_lock(&(user->c_lock));
-        if(send(clientSocket, reply, strlen(reply), 0) == -1)
-        {
-            perror("Socket send() failed");
-            user_exit(server, user);
-        }
-        pthread_mutex_unlock(&(user->c_lock));
-        free(dummy);
-        return 0;
-    }
-    
-    //construct message
-    snprintf(notice, MAXMSG - 2, ":%s!%s@%s %s %s %s", user->nick,
-             user->user,
-             user->address,
-             params[0],
-             params[1],
-             params[2]
-             );
-    
-    strcat(notice, "\r\n");
-    
-    //do nothing if recipient does not exist
-    
-    //if the recipient is a user
-    if (recippt)
-    {
-        pthread_mutex_lock(&(recippt->c_lock));
-        if(send(recippt->clientSocket, notice, strlen(notice), 0) == -1)
-        {
-            perror("Socket send() failed");
-            user_exit(server, recippt);
-        }
-        pthread_mutex_unlock(&(recippt->c_lock));
-    }
-    
-    //if the recipient is a channel
-    if (chanpt){
-        
-			// check that the sender has the appropriate mode for channel
-         if(strchr(chanpt->mode,'m') != NULL) {
-         	if(strchr(user->mode,'o') == NULL) {
-            	seek_arg->field = USERCHAN;      
-    				seek_arg->value = params[1];   
-   				pthread_mutex_lock(&lock);
-    				mychan *mychanpt = (mychan *)list_seek(user->my_chans, seek_arg);
-    				pthread_mutex_unlock(&lock);
-    				if( (strchr(mychanpt->mode,'o')==NULL) && (strchr(mychanpt->mode,'v')==NULL)) {
-    					free(dummy);
-    					return 0;
-                }
-            }
-        }        
-        
-        //only send if user is member of channel; otherwise do nothing
-        if (list_contains(user->my_chans, dummy)) 
-            sendtochannel(server, chanpt, notice, user->nick);
-    }
-    free(dummy);
-    return 0;
+    return relay_message(server, user, params, 1);
 }
 
 int chirc_handle_PING(chirc_server *server, //current server
@@ -464,39 +492,26 @@ int chirc_handle_PING(chirc_server *server, //current server
                       chirc_message params) //message received
 {
     char PONGback[MAXMSG];
-    int clientSocket = user->clientSocket;
     char *servername = malloc(strlen(server->servername) + 1);
     
     //get servername
-    pthread_mutex_lock(&lock);
+    chirc_lock(&lock);
     strcpy(servername, server->servername);
     snprintf(PONGback, MAXMSG - 2, "PONG %s", servername);
     strcat(PONGback, "\r\n");
-    pthread_mutex_unlock(&lock);
+    chirc_unlock(&lock);
     
     free(servername);
     
     //check that sender is registered
     if(!(strlen(user->nick) && strlen(user->user))){
         constr_reply(ERR_NOTREGISTERED, user, PONGback, server, NULL);
-        pthread_mutex_lock(&(user->c_lock));
-        if(send(clientSocket, PONGback, strlen(PONGback), 0) == -1)
-        {
-            perror("Socket send() failed");
-            user_exit(server, user);
-        }
-        pthread_mutex_unlock(&(user->c_lock));
+        user_send(server, user, PONGback);
         
         return 0;
     }
     
-    pthread_mutex_lock(&(user->c_lock));
-    if(send(clientSocket, PONGback, strlen(PONGback), 0) == -1)
-    {
-        perror("Socket send() failed");
-        user_exit(server, user);
-    }
-    pthread_mutex_unlock(&(user->c_lock));
+    user_send(server, user, PONGback);
     
     return 0;
 }
@@ -507,48 +522,34 @@ int chirc_handle_MOTD(chirc_server *server,     //current server
 {
     char motd[80];
     char reply[MAXMSG];
-    int clientSocket = user->clientSocket;
+    char path[CONFLINE];
     
     FILE *fp;
     
     //check that sender is registered
     if(!(strlen(user->nick) && strlen(user->user))){
         constr_reply(ERR_NOTREGISTERED, user, reply, server, NULL);
-        pthread_mutex_lock(&(user->c_lock));
-        if(send(clientSocket, reply, strlen(reply), 0) == -1)
-        {
-            perror("Socket send() failed");
-            user_exit(server, user);
-        }
-        pthread_mutex_unlock(&(user->c_lock));
+        user_send(server, user, reply);
         
         return 0;
     }
     
+    rcu_read_lock();
+    strcpy(path, config_get()->motd);
+    rcu_read_unlock();
+    
     //error message for no MOTD
-    if((fp = fopen("motd.txt", "r")) == NULL)
+    if((fp = fopen(path, "r")) == NULL)
     {
         constr_reply(ERR_NOMOTD, user, reply, server, NULL);
         
-        pthread_mutex_lock(&(user->c_lock));
-        if(send(clientSocket, reply, strlen(reply), 0) == -1)
-        {
-            perror("Socket send() failed");
-            user_exit(server, user);
-        }
-        pthread_mutex_unlock(&(user->c_lock));
+        user_send(server, user, reply);
     }
     
     else
     {   
         constr_reply(RPL_MOTDSTART, user, reply, server, NULL);
-        pthread_mutex_lock(&(user->c_lock));
-        if(send(clientSocket, reply, strlen(reply), 0) == -1)
-        {
-            perror("Socket send() failed");
-            user_exit(server, user);
-        }
-        pthread_mutex_unlock(&(user->c_lock));
+        user_send(server, user, reply);
         
         while(fgets(motd,sizeof(motd),fp) != NULL) // loops through lines of MOTD, constructing a RPL_MOTD for each line
         {
@@ -557,23 +558,11 @@ int chirc_handle_MOTD(chirc_server *server,     //current server
             }
             
             constr_reply(RPL_MOTD, user, reply, server, motd);
-            pthread_mutex_lock(&(user->c_lock));
-            if(send(clientSocket, reply, strlen(reply), 0) == -1)
-            {
-                perror("Socket send() failed");
-                user_exit(server, user);
-            }
-            pthread_mutex_unlock(&(user->c_lock));
+            user_send(server, user, reply);
         }
         
         constr_reply(RPL_ENDOFMOTD, user, reply, server, NULL);
-        pthread_mutex_lock(&(user->c_lock));
-        if(send(clientSocket, reply, strlen(reply), 0) == -1)
-        {
-            perror("Socket send() failed");
-            user_exit(server, user);
-        }
-        pthread_mutex_unlock(&(user->c_lock));
+        user_send(server, user, reply);
     }
     return 0;
 }
@@ -588,153 +577,104 @@ int chirc_handle_WHOIS(chirc_server *server, //current server
     char wiserver[MAXMSG];      //WHOISSERVER message
     char wichannels[MAXMSG];    //WHOISCHANNELS message
     char wiaway[MAXMSG];        //RPL_AWAY message
-    int clientSocket = user->clientSocket;
     char *target_nick = params[1];
+    char *prefix;
+    list_iter_t it;
     mychan *whochan;
-    int buff = MAXMSG - 1;          //to keep track of space left in wichannels buffer
-    int numchans = 0;
-    
-    //get pointer to person we're asking about
-    el_indicator *seek_arg = malloc(sizeof(el_indicator));
-    seek_arg->field = NICK;
-    seek_arg->value = target_nick;
-    
-    pthread_mutex_lock(&lock);
-    person *whoispt = (person *)list_seek(server->userlist, seek_arg);
-    pthread_mutex_unlock(&lock);
+    outbuf out;
+    int len, start;
+    el_indicator seek_arg;
     
     //check that sender is registered
     if(!(strlen(user->nick) && strlen(user->user))){
         constr_reply(ERR_NOTREGISTERED, user, reply, server, NULL);
-        pthread_mutex_lock(&(user->c_lock));
-        if(send(clientSocket, reply, strlen(reply), 0) == -1)
-        {
-            perror("Socket send() failed");
-            user_exit(server, user);
-        }
-        pthread_mutex_unlock(&(user->c_lock));
-        
-        free(seek_arg);
+        user_send(server, user, reply);
         return 0;
     }
     
+    //get pointer to person we're asking about
+    seek_arg.field = NICK;
+    seek_arg.value = target_nick;
+    
+    outbuf_init(&out);
+    chirc_lock(&lock);
+    person *whoispt = (person *)list_seek(server->userlist, &seek_arg);
+    
     //no such person
     if (!whoispt) {
+        chirc_unlock(&lock);
         constr_reply(ERR_NOSUCHNICK, user, reply, server, target_nick);
-        
-        pthread_mutex_lock(&(user->c_lock));
-        if(send(clientSocket, reply, strlen(reply), 0) == -1)
-        {
-            perror("Socket send() failed");
-            user_exit(server, user);
-        }
-        pthread_mutex_unlock(&(user->c_lock));    
+        user_send(server, user, reply);
+        return 0;
     }
     
-    else
-    {
-        //WHOISUSER
-        snprintf(wiuser, MAXMSG - 2, "%s %s %s * :%s", params[1],
-                                                       whoispt->user,
-                                                       whoispt->address,
-                                                       whoispt->fullname
-        ); 
-        
-        constr_reply(RPL_WHOISUSER, user, reply, server, wiuser); // passes the whois lookup for user to constr_reply
-        pthread_mutex_lock(&(user->c_lock));
-        if(send(clientSocket, reply, strlen(reply), 0) == -1)
-        {
-            perror("Socket send() failed");
-            user_exit(server, user);
-        }
-        pthread_mutex_unlock(&(user->c_lock));
-        
-        //WHOISCHANNELS
-        snprintf(wichannels, buff, "%s :", target_nick);
-        pthread_mutex_lock(&(whoispt->c_lock));
-        list_iterator_start(whoispt->my_chans);
-        while(list_iterator_hasnext(whoispt->my_chans) && buff > 0){
-            numchans++;
-            whochan = (mychan *)list_iterator_next(whoispt->my_chans);
-            if(strchr(whochan->mode, (int) 'o') != NULL){       //if operator of a channel, put that channel first
-                strcat(wichannels, "@");
-            }
-            if(strchr(whochan->mode, (int) 'v') !=NULL){
-                strcat(wichannels, "+");
-            }
-            buff = MAXMSG - strlen(wichannels);
-            strncat(wichannels, whochan->name, buff);
-            //if (buff > 0 && list_iterator_hasnext(whoispt->my_chans)){
-              //  strcat(wichannels, " ");
-            //}
-            strcat(wichannels, " ");
-        }
-        pthread_mutex_unlock(&(whoispt->c_lock));
-        
-        //only send WHOISCHANNELS if user is on channels
-        if(numchans){
+    //everything is read with whoispt's c_lock held and sent after both locks are released
+    chirc_lock(&(whoispt->c_lock));
+    
+    //WHOISUSER
+    snprintf(wiuser, MAXMSG - 2, "%s %s %s * :%s", params[1],
+                                                   whoispt->user,
+                                                   whoispt->address,
+                                                   whoispt->fullname
+    ); 
+    
+    constr_reply(RPL_WHOISUSER, user, reply, server, wiuser); // passes the whois lookup for user to constr_reply
+    outbuf_add(&out, reply);
+    
+    //WHOISCHANNELS, split over as many replies as it takes
+    start = len = snprintf(wichannels, MAXMSG, "%s :", target_nick);
+    list_iter_start(&it, whoispt->my_chans);
+    while(list_iter_hasnext(&it)){
+        whochan = (mychan *)list_iter_next(&it);
+        if(whochan->mode & MODE_OPER)
+            prefix = "@";
+        else if(whochan->mode & MODE_VOICE)
+            prefix = "+";
+        else
+            prefix = "";
+        if (len > start && len + strlen(prefix) + strlen(whochan->name) + 1 > MAXCHANLINE) {
             constr_reply(RPL_WHOISCHANNELS, user, reply, server, wichannels);
-            pthread_mutex_lock(&(user->c_lock));
-            if(send(clientSocket, reply, strlen(reply), 0) == -1)
-            {
-                perror("Socket send() failed");
-                user_exit(server, user);
-            }
-            pthread_mutex_unlock(&(user->c_lock));
-        }
-        
-        //WHOISSERVER
-        snprintf(wiserver, MAXMSG - 2, "%s %s :%s", params[1],
-                                                    whoispt->address,
-                                                    "chirc-0.3"   // should probably actually store this someplace, like server struct
-        );
-        //pthread_mutex_unlock(&(user->c_lock));    
-        
-        constr_reply(RPL_WHOISSERVER, user, reply, server, wiserver);
-        pthread_mutex_lock(&(user->c_lock));
-        if(send(clientSocket, reply, strlen(reply), 0) == -1)
-        {
-            perror("Socket send() failed");
-            user_exit(server, user);
-        }
-        pthread_mutex_unlock(&(user->c_lock));
-        
-        //AWAY
-        if(strchr(whoispt->mode, (int) 'a') != NULL){
-            snprintf(wiaway, MAXMSG - 2, "%s %s", target_nick, whoispt->away);
-            constr_reply(RPL_AWAY, user, reply, server, wiaway);
-            pthread_mutex_lock(&(user->c_lock));
-            if(send(clientSocket, reply, strlen(reply), 0) == -1)
-            {
-                perror("Socket send() failed");
-                user_exit(server, user);
-            }
-            pthread_mutex_unlock(&(user->c_lock));
-        }
-        //WHOISOPERATOR
-        if(strchr(whoispt->mode, (int)'o') != NULL){
-            constr_reply(RPL_WHOISOPERATOR, user, reply, server, target_nick);
-            pthread_mutex_lock(&(user->c_lock));
-            if(send(clientSocket, reply, strlen(reply), 0) == -1)
-            {
-                perror("Socket send() failed");
-                user_exit(server, user);
-            }
-            pthread_mutex_unlock(&(user->c_lock));
-        }
-        
-        //ENDOFWHOIS
-        constr_reply(RPL_ENDOFWHOIS, user, reply, server, target_nick);
-        pthread_mutex_lock(&(user->c_lock));
-        if(send(clientSocket, reply, strlen(reply), 0) == -1)
-        {
-            perror("Socket send() failed");
-            user_exit(server, user);
+            outbuf_add(&out, reply);
+            len = start;
         }
-        pthread_mutex_unlock(&(user->c_lock));
-        
+        len += snprintf(wichannels + len, MAXMSG - len, "%s%s ", prefix, whochan->name);
     }
-    free(seek_arg);
+    
+    //only send WHOISCHANNELS if user is on channels
+    if(len > start){
+        constr_reply(RPL_WHOISCHANNELS, user, reply, server, wichannels);
+        outbuf_add(&out, reply);
+    }
+    
+    //WHOISSERVER
+    rcu_read_lock();
+    snprintf(wiserver, MAXMSG - 2, "%s %s :%s", params[1],
+                                                whoispt->address,
+                                                config_get()->version
+    );
+    rcu_read_unlock();
+    
+    constr_reply(RPL_WHOISSERVER, user, reply, server, wiserver);
+    outbuf_add(&out, reply);
+    
+    //AWAY
+    if(whoispt->mode & MODE_AWAY){
+        snprintf(wiaway, MAXMSG - 2, "%s %s", target_nick, whoispt->away);
+        constr_reply(RPL_AWAY, user, reply, server, wiaway);
+        outbuf_add(&out, reply);
+    }
+    //WHOISOPERATOR
+    if(whoispt->mode & MODE_OPER){
+        constr_reply(RPL_WHOISOPERATOR, user, reply, server, target_nick);
+        outbuf_add(&out, reply);
+    }
+    chirc_unlock(&(whoispt->c_lock));
+    chirc_unlock(&lock);
+    
+    //ENDOFWHOIS
+    constr_reply(RPL_ENDOFWHOIS, user, reply, server, target_nick);
+    outbuf_add(&out, reply);
+    outbuf_send(server, user, &out);
     return 0;
 }
 
@@ -743,38 +683,31 @@ int chirc_handle_LUSERS(chirc_server *server,   //current server
                         chirc_message params){  //message received
     char reply[MAXMSG];
     char stats[5];
-    int clientSocket = user->clientSocket;
     unsigned int numops = 0;
     unsigned int unknown;
+    list_iter_t it;
     person *maybeop;
     
     //check number of known connections
-    pthread_mutex_lock(&lock);
+    chirc_lock(&lock);
     unsigned int userme = list_size(server->userlist);
-    unsigned int numchannels = list_size(server->chanlist);
+    unsigned int numchannels = chanmap_size(server->chans);
     unsigned int known = server->numregistered;
-    list_iterator_start(server->userlist);
-    while (list_iterator_hasnext(server->userlist)){
-        maybeop = (person *)list_iterator_next(server->userlist);
-        pthread_mutex_lock(&(maybeop->c_lock));
-        if (strchr(maybeop->mode, (int) 'o') != NULL) {
+    list_iter_start(&it, server->userlist);
+    while (list_iter_hasnext(&it)){
+        maybeop = (person *)list_iter_next(&it);
+        chirc_lock(&(maybeop->c_lock));
+        if (maybeop->mode & MODE_OPER) {
             numops++;
         }
-        pthread_mutex_unlock(&(maybeop->c_lock));
+        chirc_unlock(&(maybeop->c_lock));
     }
-    list_iterator_stop(server->userlist);
-    pthread_mutex_unlock(&lock);
+    chirc_unlock(&lock);
     
     //check that sender is registered
     if(!(strlen(user->nick) && strlen(user->user))){
         constr_reply(ERR_NOTREGISTERED, user, reply, server, NULL);
-        pthread_mutex_lock(&(user->c_lock));
-        if(send(clientSocket, reply, strlen(reply), 0) == -1)
-        {
-            perror("Socket send() failed");
-            user_exit(server, user);
-        }
-        pthread_mutex_unlock(&(user->c_lock));
+        user_send(server, user, reply);
         
         return 0;
     }
@@ -782,13 +715,7 @@ int chirc_handle_LUSERS(chirc_server *server,   //current server
     //RPL_LUSERCLIENT
     sprintf(stats, "%u", known);
     constr_reply(RPL_LUSERCLIENT, user, reply, server, stats);
-    pthread_mutex_lock(&(user->c_lock));
-    if(send(clientSocket, reply, strlen(reply), 0) == -1)
-    {
-        perror("Socket send() failed");
-        user_exit(server, user);
-    }
-    pthread_mutex_unlock(&(user->c_lock));
+    user_send(server, user, reply);
     
     //RPL_LUSEROP
     //we'll check for operators in server struct
@@ -796,13 +723,7 @@ int chirc_handle_LUSERS(chirc_server *server,   //current server
     
     constr_reply(RPL_LUSEROP, user, reply, server, stats);
     
-    pthread_mutex_lock(&(user->c_lock));
-    if(send(clientSocket, reply, strlen(reply), 0) == -1)
-    {
-        perror("Socket send() failed");
-        user_exit(server, user);
-    }
-    pthread_mutex_unlock(&(user->c_lock));
+    user_send(server, user, reply);
     
     
     //RPL_LUSERUNKNOWN
@@ -815,36 +736,18 @@ int chirc_handle_LUSERS(chirc_server *server,   //current server
     
     constr_reply(RPL_LUSERUNKNOWN, user, reply, server, stats);
     
-    pthread_mutex_lock(&(user->c_lock));
-    if(send(clientSocket, reply, strlen(reply), 0) == -1)
-    {
-        perror("Socket send() failed");
-        user_exit(server, user);
-    }
-    pthread_mutex_unlock(&(user->c_lock));
+    user_send(server, user, reply);
     
     //RPL_LUSERCHANNELS
     sprintf(stats, "%u", numchannels);
     
     constr_reply(RPL_LUSERCHANNELS, user, reply, server, stats);
-    pthread_mutex_lock(&(user->c_lock));
-    if(send(clientSocket, reply, strlen(reply), 0) == -1)
-    {
-        perror("Socket send() failed");
-        user_exit(server, user);
-    }
-    pthread_mutex_unlock(&(user->c_lock));
+    user_send(server, user, reply);
     
     //RPL_LUSERME
     sprintf(stats, "%u", userme);
     constr_reply(RPL_LUSERME, user, reply, server, stats);
-    pthread_mutex_lock(&(user->c_lock));
-    if(send(clientSocket, reply, strlen(reply), 0) == -1)
-    {
-        perror("Socket send() failed");
-        user_exit(server, user);
-    }
-    pthread_mutex_unlock(&(user->c_lock));
+    user_send(server, user, reply);
     
     return 0;
 }
@@ -854,157 +757,139 @@ int chirc_handle_JOIN(chirc_server *server,  //current server
                          person *user,          //current user
                          chirc_message params)  //message received
 {
-    channel_join(user, server, params[1]);
+    char reply[MAXMSG];
+    char *names[MAXTARGETS];
+    char *rest;
+    int i, numchans;
+    
+    numchans = split_list(params[1], names, MAXTARGETS, &rest);
+    for(i = 0; i < numchans; i++){
+        if (names[i][0] == '\0') {
+            constr_reply(ERR_NOSUCHCHANNEL, user, reply, server, names[i]);
+            user_send(server, user, reply);
+        }
+        else
+            channel_join(user, server, names[i]);
+    }
+    too_many_targets(server, user, rest);
     return 0;
 }
 
-int chirc_handle_PART(chirc_server *server, person *user, chirc_message params)
+//removes user from one channel, telling its members
+static void channel_part(chirc_server *server, person *user, char *cname, char *partmsg)
 {
 	char reply[MAXMSG];
-    int clientSocket = user->clientSocket;
-    mychan *dummy = malloc(sizeof(dummy));
-    char *cname = malloc(strlen(params[1]));
-    strcpy(cname, params[1]);
-    strcpy(dummy->name, cname);
-    
-    // needs to check that the channel exists
-    el_indicator *seek_arg = malloc(sizeof(el_indicator));
-    seek_arg->field = CHAN;      // used in list seek
-    seek_arg->value = cname;   // used in list seek
-    pthread_mutex_lock(&lock);
-    channel *channelpt = (channel *)list_seek(server->chanlist, seek_arg);
-    pthread_mutex_unlock(&lock);
-    free(seek_arg);
-    
-    if(channelpt == NULL){
-    	constr_reply(ERR_NOSUCHCHANNEL, user, reply, server, cname);
-        pthread_mutex_lock(&(user->c_lock));
-        if(send(clientSocket, reply, strlen(reply), 0) == -1)
-        {
-            perror("Socket send() failed");
-            user_exit(server, user);
-        }
-        pthread_mutex_unlock(&(user->c_lock));
-        free(dummy);
-        free(cname);
-        return 0;
-    }
-    
-    // needs to check that the user is in the channel
-    if (!list_contains(user->my_chans, dummy)){
-    	constr_reply(ERR_NOTONCHANNEL, user, reply, server, cname);
-        pthread_mutex_lock(&(user->c_lock));
-        if(send(clientSocket, reply, strlen(reply), 0) == -1)
-        {
-            perror("Socket send() failed");
-            user_exit(server, user);
+    mychan dummy;
+    mychan *userchan;
+    el_indicator seek_arg;
+    channel *channelpt;
+    strcpy(dummy.name, cname);
+    
+    // needs to check that the user is in the channel, and failing that that the channel exists
+    seek_arg.field = USERCHAN;
+    seek_arg.value = cname;
+    chirc_lock(&(user->c_lock));
+    userchan = (mychan *)list_seek(user->my_chans, &seek_arg);
+    chirc_unlock(&(user->c_lock));
+    if(userchan == NULL){
+        if((channelpt = chanmap_get(server->chans, cname)) == NULL)
+            constr_reply(ERR_NOSUCHCHANNEL, user, reply, server, cname);
+        else {
+            chanmap_put(server->chans, channelpt);
+            constr_reply(ERR_NOTONCHANNEL, user, reply, server, cname);
         }
-        pthread_mutex_unlock(&(user->c_lock));
-        free(dummy);
-        free(cname);
-        return 0;
+        user_send(server, user, reply);
+        return;
     }
+    channelpt = userchan->chan;
     
     // send the part message to the channel
-    if(params[2][0]=='\0')
-    	snprintf(reply,MAXMSG-1,":%s!%s@%s PART %s",user->nick,user->user,user->address,params[1]);
+    if(partmsg[0]=='\0')
+    	snprintf(reply,MAXMSG-1,":%s!%s@%s PART %s",user->nick,user->user,user->address,cname);
     else
-    	snprintf(reply,MAXMSG-1,":%s!%s@%s PART %s %s",user->nick,user->user,user->address,params[1],params[2]);
+    	snprintf(reply,MAXMSG-1,":%s!%s@%s PART %s %s",user->nick,user->user,user->address,cname,partmsg);
     
     strcat(reply, "\r\n"); 
-    sendtochannel(server, channelpt, reply, NULL);
+    // the rest of the channel hears about it now, and the user once the channel is
+    // gone if they were the last one on it. the channel's actor does both this and
+    // taking the user off it
+    if (actor_enabled())
+        actor_part(channelpt, user, reply);
+    else
+        sendtochannel(server, channelpt, reply, user->nick);
     
     // delete the user from the channel
     // delete the channel from the user's list of channels
-    pthread_mutex_lock(&(user->c_lock));
-    list_delete(user->my_chans, dummy);
-    pthread_mutex_unlock(&(user->c_lock));
+    chirc_lock(&(user->c_lock));
+    list_delete(user->my_chans, &dummy);
+    chirc_unlock(&(user->c_lock));
+    pool_free(POOL_MYCHAN, userchan);
+    mem_charge(user, MEM_CHANNELS, -(long) sizeof(mychan));
+    if (!actor_enabled()) {
+        chirc_lock(&lock);
+        list_delete(channelpt->members, user);
+        names_patch(channelpt, user->nick, NULL, 0);
+        chirc_unlock(&lock);
+    }
     
-    pthread_mutex_lock(&(channelpt->chan_lock));
+    chirc_lock(&(channelpt->chan_lock));
     (channelpt->numusers)--;
-    pthread_mutex_unlock(&(channelpt->chan_lock));
-    
-    // if the channel is empty, destroy the channel
-    
-    if(channelpt->numusers==0) {
-    	channel_destroy(server, channelpt);
-    }
+    chirc_unlock(&(channelpt->chan_lock));
+    directory_changed(server);
     
-    free(cname);
-    free(dummy);
+    // drop the membership's reference, destroying the channel if it was the last
+    chanmap_put(server->chans, channelpt);
+    user_send(server, user, reply);
+}
+
+int chirc_handle_PART(chirc_server *server, person *user, chirc_message params)
+{
+    char *names[MAXTARGETS];
+    char *rest;
+    int i, numchans;
+    
+    numchans = split_list(params[1], names, MAXTARGETS, &rest);
+    for(i = 0; i < numchans; i++)
+        channel_part(server, user, names[i], params[2]);
+    too_many_targets(server, user, rest);
     return 0;
 }
 
 int chirc_handle_AWAY(chirc_server *server, person *user, chirc_message params){
     char reply[MAXMSG];
-    int clientSocket = user->clientSocket;
-    char *away = NULL;
-    char *c;
     
     //check that sender is registered
     if(!(strlen(user->nick) && strlen(user->user))){
         constr_reply(ERR_NOTREGISTERED, user, reply, server, NULL);
-        pthread_mutex_lock(&(user->c_lock));
-        if(send(clientSocket, reply, strlen(reply), 0) == -1)
-        {
-            perror("Socket send() failed");
-            user_exit(server, user);
-        }
-        pthread_mutex_unlock(&(user->c_lock));
+        user_send(server, user, reply);
         
         return 0;
     }
     
-    //check whether sender is already away
-    if (strlen(user->mode) != 0)
-            away = strchr(user->mode, (int) 'a'); 
-    
     //determine whether they're setting or removing away message
     if(strlen(params[1]) == 0){     //no away param, so removing away message
-        //if mode is away, change it
-        if(away != NULL){
-            pthread_mutex_lock(&(user->c_lock));
-                for(c = away; *c != '\0'; c++)
-                    *c = *(c+1);
-            pthread_mutex_unlock(&(user->c_lock));
-        }
+        chirc_lock(&(user->c_lock));
+        user->mode &= ~MODE_AWAY;
+        chirc_unlock(&(user->c_lock));
 
         //send RPL_UNAWAY
         constr_reply(RPL_UNAWAY, user, reply, server, NULL);
         
-        pthread_mutex_lock(&(user->c_lock));
-        if(send(clientSocket, reply, strlen(reply), 0) == -1)
-        {
-            perror("Socket send() failed");
-            user_exit(server, user);
-        }
-        pthread_mutex_unlock(&(user->c_lock));
+        user_send(server, user, reply);
     }
     
     else{
-        //if mode isn't away, set it to away
-        if(away == NULL){
-            pthread_mutex_lock(&(user->c_lock));
-            strcat(user->mode, "a");
-            pthread_mutex_unlock(&(user->c_lock));
-        }
-            
         //set away message to params[1]
-        pthread_mutex_lock(&(user->c_lock));
+        chirc_lock(&(user->c_lock));
+        user->mode |= MODE_AWAY;
         strcpy(user->away, params[1]);
-        pthread_mutex_unlock(&(user->c_lock));
+        chirc_unlock(&(user->c_lock));
         
         
         //send RPL_NOWAWAY
         constr_reply(RPL_NOWAWAY, user, reply, server, NULL);
         
-        pthread_mutex_lock(&(user->c_lock));
-        if(send(clientSocket, reply, strlen(reply), 0) == -1)
-        {
-            perror("Socket send() failed");
-            user_exit(server, user);
-        }
-        pthread_mutex_unlock(&(user->c_lock));
+        user_send(server, user, reply);
     }
                         
     return 0;
@@ -1013,392 +898,434 @@ int chirc_handle_AWAY(chirc_server *server, person *user, chirc_message params){
 int chirc_handle_TOPIC(chirc_server *server, person *user, chirc_message params)
 {
     char reply[MAXMSG];
-    int clientSocket = user->clientSocket;
-    char *cname = malloc(strlen(params[1]));
-    strcpy(cname, params[1]);
-    el_indicator *seek_arg = malloc(sizeof(el_indicator));
-    mychan *dummy = malloc(sizeof(mychan));
+    char *cname = params[1];
+    el_indicator seek_arg;
     mychan *topichan;
-    strcpy(dummy->name, cname);
-    
+    channel *channelpt;
+    unsigned int topiclock;
     
-    // get a pointer to the requested channel
-    seek_arg->field = CHAN;      // used in list seek
-    seek_arg->value = cname;   // used in list seek
-    pthread_mutex_lock(&lock);
-    channel *channelpt = (channel *)list_seek(server->chanlist, seek_arg);
-    pthread_mutex_unlock(&lock);
     
-    // check to make sure the user is in the channel
-    if (!list_contains(user->my_chans, dummy)){
+    // check to make sure the user is in the channel, which also gets us the channel
+    seek_arg.field = USERCHAN;      // used in list seek
+    seek_arg.value = cname;   // used in list seek
+    chirc_lock(&(user->c_lock));
+    topichan = (mychan *)list_seek(user->my_chans, &seek_arg);
+    chirc_unlock(&(user->c_lock));
+    if (topichan == NULL){
     	constr_reply(ERR_NOTONCHANNEL, user, reply, server, cname);
-        pthread_mutex_lock(&(user->c_lock));
-        if(send(clientSocket, reply, strlen(reply), 0) == -1)
-        {
-            perror("Socket send() failed");
-            user_exit(server, user);
-        }
-        pthread_mutex_unlock(&(user->c_lock));
-        free(seek_arg);
-        free(dummy);
-        free(cname);
+        user_send(server, user, reply);
         return 0;
     }
+    channelpt = topichan->chan;
     
     // if there is a topic mode, check if the user is operator
     // if they are, they can set the topic
     if(params[2][0] != '\0') {
     	// check if channel is moderated             
-        if(strchr(channelpt->mode,(int) 't') != NULL){
-            seek_arg->field = USERCHAN;
-            pthread_mutex_lock(&(user->c_lock));
-            topichan = (mychan *)list_seek(user->my_chans, seek_arg);
-            if (strchr(topichan->mode, (int) 'o') == NULL && strchr(user->mode, (int) 'o') == NULL) {
+        rcu_read_lock();
+        topiclock = rcu_dereference(channelpt->meta)->mode & MODE_TOPICLOCK;
+        rcu_read_unlock();
+        if(topiclock){
+            chirc_lock(&(user->c_lock));
+            if (!(topichan->mode & MODE_OPER) && !(user->mode & MODE_OPER)) {
+                chirc_unlock(&(user->c_lock));
                 constr_reply(ERR_CHANOPRIVISNEEDED, user, reply, server, cname);
-                if(send(clientSocket, reply, strlen(reply), 0) == -1)
-                {
-                    perror("Socket send() failed");
-                    user_exit(server, user);
-                }
-                pthread_mutex_unlock(&(user->c_lock));
-                free(seek_arg);
-                free(dummy);
-                free(cname);
+                user_send(server, user, reply);
                 return 0;
             }
-            pthread_mutex_unlock(&(user->c_lock));
+            chirc_unlock(&(user->c_lock));
         }
         
         // if topic is changed, relay it to the channel
-    	strcpy(channelpt->topic, params[2]);
+    	channel_update(channelpt, params[2], 0, 0);
+    	directory_changed(server);
     	snprintf(reply,MAXMSG-1, ":%s!%s@%s TOPIC %s %s",user->nick,user->user,user->address,
-    	                                                 cname,channelpt->topic);
+    	                                                 cname,params[2]);
     	strcat(reply, "\r\n");
         sendtochannel(server, channelpt, reply, NULL);
     }
     	
     
     // then determine the correct reply
-    if(channelpt->topic[0] == '\0'){
+    rcu_read_lock();
+    snprintf(reply,MAXMSG-1, "%s %s", cname, rcu_dereference(channelpt->meta)->topic);
+    rcu_read_unlock();
+    if(reply[strlen(cname) + 1] == '\0'){
     	constr_reply(RPL_NOTOPIC, user, reply, server, cname);
-        pthread_mutex_lock(&(user->c_lock));
-        if(send(clientSocket, reply, strlen(reply), 0) == -1)
-        {
-            perror("Socket send() failed");
-            user_exit(server, user);
-        }
-        pthread_mutex_unlock(&(user->c_lock));
+        user_send(server, user, reply);
     }
     else {
-    	snprintf(reply,MAXMSG-1, "%s %s", cname, channelpt->topic);
         constr_reply(RPL_TOPIC, user, reply, server, NULL);
-        pthread_mutex_lock(&(user->c_lock));
-        if(send(clientSocket, reply, strlen(reply), 0) == -1)
-        {
-            perror("Socket send() failed");
-            user_exit(server, user);
-        }
-        pthread_mutex_unlock(&(user->c_lock));
+        user_send(server, user, reply);
     }
-    free(seek_arg);
-    free(dummy);
-    free(cname);
     return 0;
 }
     
-int chirc_handle_LIST(chirc_server *server, person *user, chirc_message params)
+//true if name matches mask, where * stands for any run of characters and ? for
+//any one. everything else, [ included, only matches itself
+static int mask_match(const char *mask, const char *name)
 {
-    char reply[MAXMSG];
-    int clientSocket = user->clientSocket;
-    char *cname = malloc(strlen(params[1]));
-    char extra[MAXMSG];
-    strcpy(cname, params[1]);
-    el_indicator *seek_arg = malloc(sizeof(el_indicator));
-    
-    // if we get a specific channel request
-    if(params[1][0] != '\0') {
-    	seek_arg->field = CHAN;      // used in list seek
-    	seek_arg->value = cname;   // used in list seek
-    	pthread_mutex_lock(&lock);
-    	channel *channelpt = (channel *)list_seek(server->chanlist, seek_arg);
-    	pthread_mutex_unlock(&lock);
-		
-		if(channelpt->topic[0] == '\0') sprintf(extra,"%s %i :", channelpt->name, channelpt->numusers);
-		else sprintf(extra,"%s %i %s", channelpt->name, channelpt->numusers, channelpt->topic);
-		
-		constr_reply(RPL_LIST, user, reply, server, extra);
-        pthread_mutex_lock(&(user->c_lock));
-        if(send(clientSocket, reply, strlen(reply), 0) == -1)
-        {
-            perror("Socket send() failed");
-            user_exit(server, user);
+    const char *star = NULL, *resume = NULL;
+    
+    while (*name != '\0') {
+        if (*mask == '*') {
+            star = mask++;
+            resume = name;
         }
-        pthread_mutex_unlock(&(user->c_lock));
-        
-        constr_reply(RPL_LISTEND, user, reply, server, NULL);
-        pthread_mutex_lock(&(user->c_lock));
-        if(send(clientSocket, reply, strlen(reply), 0) == -1)
-        {
-            perror("Socket send() failed");
-            user_exit(server, user);
+        else if (*mask == '?' || *mask == *name) {
+            mask++;
+            name++;
         }
-        pthread_mutex_unlock(&(user->c_lock));
-        
-        free(seek_arg);
-        free(cname);
+        else if (star != NULL) {
+            //let the last * take one more character and try again from there
+            mask = star + 1;
+            name = ++resume;
+        }
+        else
+            return 0;
+    }
+    while (*mask == '*')
+        mask++;
+    return *mask == '\0';
+}
+
+//true if chan passes every filter and matches one of the names or masks (or there are none)
+static int list_match(dir_entry *chan, char **names, int numnames, int minusers, int maxusers,
+                      time_t topic_after, time_t topic_before)
+{
+    int i;
+    
+    if (chan->numusers < minusers || chan->numusers > maxusers)
         return 0;
+    if (chan->topic_time < topic_after || chan->topic_time > topic_before)
+        return 0;
+    if (numnames == 0)
+        return 1;
+    for (i = 0; i < numnames; i++)
+        if (mask_match(names[i], chan->name))
+            return 1;
+    return 0;
+}
+
+//LIST [<filter>{,<filter>}], where a filter is a channel name or mask, >n or <n
+//(more or fewer than n users), or T>n or T<n (topic changed more or less than n
+//minutes ago). filters past the first MAXTARGETS are answered with ERR_TOOMANYTARGETS
+int chirc_handle_LIST(chirc_server *server, person *user, chirc_message params)
+{
+    char reply[MAXMSG];
+    char *filters[MAXTARGETS];
+    char *names[MAXTARGETS];
+    char *rest;
+    int numfilters, numnames = 0;
+    int minusers = 0, maxusers = INT_MAX;
+    time_t now = time(NULL);
+    time_t topic_after = 0, topic_before = now;
+    directory *dir;
+    outbuf out;
+    size_t chunk;
+    int i;
+    
+    rcu_read_lock();
+    chunk = config_get()->list_chunk;
+    rcu_read_unlock();
+    numfilters = split_list(params[1], filters, MAXTARGETS, &rest);
+    for (i = 0; i < numfilters; i++) {
+        if (filters[i][0] == '\0')
+            continue;
+        else if (filters[i][0] == '>')
+            minusers = atoi(filters[i] + 1) + 1;
+        else if (filters[i][0] == '<')
+            maxusers = atoi(filters[i] + 1) - 1;
+        else if (strncmp(filters[i], "T>", 2) == 0)
+            topic_before = now - 60 * atoi(filters[i] + 2);
+        else if (strncmp(filters[i], "T<", 2) == 0)
+            topic_after = now - 60 * atoi(filters[i] + 2);
+        else
+            names[numnames++] = filters[i];
     }
-    	
-    pthread_mutex_lock(&lock);
-    list_iterator_start(server->chanlist);
-    while (list_iterator_hasnext(server->chanlist)) {
-        channel *channelpt = (channel *)list_iterator_next(server->chanlist);
-        pthread_mutex_unlock(&lock);
-        
-        if(channelpt->topic[0] == '\0') sprintf(extra,"%s %i :", channelpt->name, channelpt->numusers);
-		else sprintf(extra,"%s %i %s", channelpt->name, channelpt->numusers, channelpt->topic);
-		
-		constr_reply(RPL_LIST, user, reply, server, extra);
-        pthread_mutex_lock(&(user->c_lock));
-        if(send(clientSocket, reply, strlen(reply), 0) == -1)
-        {
-            perror("Socket send() failed");
-            user_exit(server, user);
-        }
-        pthread_mutex_unlock(&(user->c_lock));
-        
-        pthread_mutex_lock(&lock);
+    
+    too_many_targets(server, user, rest);
+    
+    //no lock is held while the listing is sent, a chunk at a time
+    dir = directory_get(server);
+    outbuf_init(&out);
+    for (i = 0; i < dir->numentries; i++) {
+        if (!list_match(&(dir->entries[i]), names, numnames, minusers, maxusers, topic_after, topic_before))
+            continue;
+        constr_reply(RPL_LIST, user, reply, server, dir->entries[i].listing);
+        outbuf_add(&out, reply);
+        if (out.len >= chunk)
+            outbuf_send(server, user, &out);
     }
-    list_iterator_stop(server->chanlist);
-    pthread_mutex_unlock(&lock);
+    directory_put(dir);
     
     constr_reply(RPL_LISTEND, user, reply, server, NULL);
-    pthread_mutex_lock(&(user->c_lock));
-    if(send(clientSocket, reply, strlen(reply), 0) == -1)
-    {
-        perror("Socket send() failed");
-        user_exit(server, user);
-    }
-    pthread_mutex_unlock(&(user->c_lock));
-        
-    free(seek_arg);
-	free(cname);
+    outbuf_add(&out, reply);
+    outbuf_send(server, user, &out);
 	return 0;
 }
 
+//what NAMES with no channel passes to names_add
+typedef struct {
+    chirc_server *server;
+    person *user;
+    outbuf *out;
+} names_walk;
+
+//chanmap_foreach callback adding one channel's names to the reply
+static void names_add(channel *chan, void *arg)
+{
+    names_walk *w = arg;
+    if (chan->numusers > 0)
+        names_reply(w->server, chan, w->user, w->out);
+}
+
 int chirc_handle_NAMES(chirc_server *server, person *user, chirc_message params)
 {
-    int buff;
-    int clientSocket = user->clientSocket;
-    int first = 1;
+    int start, len;
     char reply[MAXMSG];
     char antisocial[MAXMSG];  //list of people not on channels
     channel *chan;
+    list_iter_t it;
     person *someone;
-    el_indicator *seek_arg = malloc(sizeof(seek_arg));
-    seek_arg->field = CHAN;
+    outbuf out;
+    names_walk walk;
     
     
     //check that sender is registered
     if(!(strlen(user->nick) && strlen(user->user))){
         constr_reply(ERR_NOTREGISTERED, user, reply, server, NULL);
-        pthread_mutex_lock(&(user->c_lock));
-        if(send(clientSocket, reply, strlen(reply), 0) == -1)
-        {
-            perror("Socket send() failed");
-            user_exit(server, user);
-        }
-        pthread_mutex_unlock(&(user->c_lock));
-        
-        free(seek_arg);
+        user_send(server, user, reply);
         return 0;
     }
     
+    outbuf_init(&out);
+    chirc_lock(&lock);
     if(strlen(params[1]) == 0){  //no channel given
         //iterate through all channels
-        pthread_mutex_lock(&lock);
-        list_iterator_start(server->chanlist);
-        while (list_iterator_hasnext(server->chanlist)) {
-            chan = (channel *)list_iterator_next(server->chanlist);
-            pthread_mutex_unlock(&lock);
-            send_names(server, chan, user);
-            pthread_mutex_lock(&lock);
-        }
-        list_iterator_stop(server->chanlist);
+        walk.server = server;
+        walk.user = user;
+        walk.out = &out;
+        chanmap_foreach(server->chans, names_add, &walk);
         
-        strcpy(antisocial, "* * :");
+        start = len = snprintf(antisocial, MAXMSG, "* * :");
         //iterate through users not on any channel
-        list_iterator_start(server->userlist);
-        while (list_iterator_hasnext(server->userlist) && MAXMSG - strlen(antisocial) > 1) {
-            someone = (person *)list_iterator_next(server->userlist);
-            pthread_mutex_lock(&(someone->c_lock));
-            if(list_size(someone->my_chans) == 0){
-                if (!first) {
-                    strcat(antisocial, " ");
-                }
-                first = 0;
-                buff = MAXMSG - strlen(antisocial);
-                strncat(antisocial, someone->nick, buff);
+        list_iter_start(&it, server->userlist);
+        while (list_iter_hasnext(&it)) {
+            someone = (person *)list_iter_next(&it);
+            if(list_size(someone->my_chans) != 0)
+                continue;
+            if (len > start && len + strlen(someone->nick) + 1 > MAXCHANLINE) {
+                constr_reply(RPL_NAMREPLY, user, reply, server, antisocial);
+                outbuf_add(&out, reply);
+                len = start;
             }
-            pthread_mutex_unlock(&(someone->c_lock));
+            len += snprintf(antisocial + len, MAXMSG - len, len > start ? " %s" : "%s", someone->nick);
         }
-        list_iterator_stop(server->userlist);
-        pthread_mutex_unlock(&lock);
-        if(strlen(antisocial) > strlen("* * :")){
+        if(len > start){
             constr_reply(RPL_NAMREPLY, user, reply, server, antisocial);
-            pthread_mutex_lock(&(user->c_lock));
-            if(send(clientSocket, reply, strlen(reply), 0) == -1){
-                perror("Socket send() failed");
-                user_exit(server, user);
-            }
-            pthread_mutex_unlock(&(user->c_lock));
+            outbuf_add(&out, reply);
         }
     }
     else{   //only give NAMES reply for one channel
-        seek_arg->value = params[1];
-        pthread_mutex_lock(&lock);
-        chan = (channel *)list_seek(server->chanlist, seek_arg);
-        pthread_mutex_unlock(&lock);
-        if(chan != NULL)
-            send_names(server, chan, user);
+        chan = chanmap_get(server->chans, params[1]);
+        if(chan != NULL){
+            names_reply(server, chan, user, &out);
+            chanmap_put(server->chans, chan);
+        }
     }
+    chirc_unlock(&lock);
     
     //send RPL_ENDOFNAMES
     constr_reply(RPL_ENDOFNAMES, user, reply, server, "*");
-    if(send(clientSocket, reply, strlen(reply), 0) == -1){
-        perror("Socket send() failed");
-        user_exit(server, user);
-    }
-    pthread_mutex_unlock(&(user->c_lock));
-    
-    free(seek_arg);
+    outbuf_add(&out, reply);
+    outbuf_send(server, user, &out);
     
     return 0;
 }
 
-int chirc_handle_WHO(chirc_server *server, person *user, chirc_message params)
+//appends one RPL_WHOREPLY for whouser to out. call with whouser's c_lock held
+static void add_whoreply(chirc_server *server, person *user, outbuf *out, char *channame, person *whouser, mychan *whochan)
 {
-    int skip = 0;
     char reply[MAXMSG];
     char whoreply[MAXMSG];
-    char channame[MAXMSG];
     char flags[10];
-    person *whouser;
+    
+    //construct flags
+    memset(flags, (int) '\0', 10);
+    if (!(whouser->mode & MODE_AWAY))
+        strcpy(flags, "H");
+    else
+        strcpy(flags, "G");
+    if(whouser->mode & MODE_OPER)
+        strcat(flags, "*");
+    if (whochan != NULL && (whochan->mode & MODE_OPER))
+        strcat(flags, "@");
+    if (whochan != NULL && (whochan->mode & MODE_VOICE))
+        strcat(flags, "+");
+    snprintf(whoreply, MAXMSG - 2, "%s %s %s %s %s %s :0 %s", channame, whouser->user, whouser->address, server->servername, whouser->nick, flags, whouser->fullname);
+    constr_reply(RPL_WHOREPLY, user, reply, server, whoreply);
+    outbuf_add(out, reply);
+}
+
+//appends an RPL_WHOREPLY for each of the n users in whos to out, sending out whenever
+//it reaches chunk bytes. whos were user_ref'd by the caller and are put here. for a
+//channel, each user's membership flags are included and anyone who has since left
+//it is skipped. called without lock, so the formatting holds up nobody else
+static void send_whoreplies(chirc_server *server, person *user, outbuf *out, char *channame,
+                            person **whos, int n, size_t chunk)
+{
+    el_indicator seek_arg;
     mychan *whochan;
-    int clientSocket = user->clientSocket;
-    el_indicator *seek_arg = malloc(sizeof(el_indicator));
-    seek_arg->field = USERCHAN;
-    seek_arg->value = params[1];
+    int i;
+    
+    seek_arg.field = USERCHAN;
+    seek_arg.value = channame;
+    for (i = 0; i < n; i++) {
+        chirc_lock(&(whos[i]->c_lock));
+        if (channame[0] == '*')
+            add_whoreply(server, user, out, channame, whos[i], NULL);
+        else if ((whochan = (mychan *)list_seek(whos[i]->my_chans, &seek_arg)) != NULL)
+            add_whoreply(server, user, out, channame, whos[i], whochan);
+        chirc_unlock(&(whos[i]->c_lock));
+        user_put(whos[i]);
+        if (out->len >= chunk)
+            outbuf_send(server, user, out);
+    }
+}
+
+int chirc_handle_WHO(chirc_server *server, person *user, chirc_message params)
+{
+    char reply[MAXMSG];
+    char channame[MAXMSG];
+    list_iter_t chanit, it;
+    person *whouser;
+    person **whos = NULL;
+    int numwhos = 0;
+    channel *chan;
+    outbuf out;
+    size_t chunk;
     
     //need to check that they're registered
     
+    rcu_read_lock();
+    chunk = config_get()->list_chunk;
+    rcu_read_unlock();
+    //who to report on is worked out under lock, and everyone found is held with
+    //user_ref while their replies are formatted and sent, a chunk at a time, after it
+    outbuf_init(&out);
     if(params[1][0] == '\0' || params[1][0] == '*'){
         strcpy(channame, "*");
-        //return RPL_WHOREPLY for everyone who doesn't have a channel in common with user
-        pthread_mutex_lock(&lock);
-        list_iterator_start(server->userlist);
-        while (list_iterator_hasnext(server->userlist)) {
-            skip = 0;
-            whouser = (person *)list_iterator_next(server->userlist);
-            pthread_mutex_lock(&(whouser->c_lock));
-            //go through every channel in whouser's list, see if it's also in user's list
-            if(whouser == user){
-                if(list_size(user->my_chans) != 0)
-                    skip = 1;
-            }
-            else{
-                list_iterator_start(whouser->my_chans);
-                while (list_iterator_hasnext(whouser->my_chans)) {
-                    whochan = (mychan *)list_iterator_next(whouser->my_chans);
-                    pthread_mutex_lock(&(user->c_lock));
-                    if(list_contains(user->my_chans, whochan)){
-                        skip = 1;
-                        pthread_mutex_unlock(&(user->c_lock));
-                        break;
-                    }
-                    pthread_mutex_unlock(&(user->c_lock));
-                }
-                list_iterator_stop(whouser->my_chans);
-            }
-                   
-            //construct flags
-            if (!skip){
-                memset(flags, (int) '\0', 10);
-                if (strchr(whouser->mode, (int) 'a') == NULL)
-                    strcpy(flags, "H");
-                else
-                    strcpy(flags, "G");
-                if(strchr(whouser->mode, (int) 'o') != NULL)
-                    strcat(flags, "*");
-                //send RPL_WHOREPLY
-                snprintf(whoreply, MAXMSG - 2, "* %s %s %s %s %s :0 %s", whouser->user, whouser->address, server->servername, whouser->nick, flags, whouser->fullname);
-                pthread_mutex_unlock(&(whouser->c_lock));
-                constr_reply(RPL_WHOREPLY, user, reply, server, whoreply); 
-                pthread_mutex_lock(&(user->c_lock));
-                if(send(clientSocket, reply, strlen(reply), 0) == -1){
-                    perror("Socket send() failed");
-                    user_exit(server, user);
-                }
-                pthread_mutex_unlock(&(user->c_lock));
-            }
-            else{
-                pthread_mutex_unlock(&(whouser->c_lock));
+        //return RPL_WHOREPLY for everyone who doesn't have a channel in common with user.
+        //mark user's neighbors by walking the members of user's channels, then report the unmarked
+        chirc_lock(&lock);
+        fanout_begin();
+        //only this thread changes user's channels, so they can be read without c_lock
+        list_iter_start(&chanit, user->my_chans);
+        while(list_iter_hasnext(&chanit)){
+            chan = ((mychan *)list_iter_next(&chanit))->chan;
+            list_iter_start(&it, chan->members);
+            while (list_iter_hasnext(&it))
+                fanout_mark((person *)list_iter_next(&it));
+        }
+        whos = malloc((list_size(server->userlist) + 1) * sizeof(person *));
+        list_iter_start(&it, server->userlist);
+        while (list_iter_hasnext(&it)) {
+            whouser = (person *)list_iter_next(&it);
+            if (fanout_mark(whouser)) {
+                user_ref(whouser);
+                whos[numwhos++] = whouser;
             }
         }
-        list_iterator_stop(server->userlist);
-        pthread_mutex_unlock(&lock);
+        chirc_unlock(&lock);
     }
     else{
         strcpy(channame, params[1]);
         //return RPL_WHOREPLY just for given channel
-        //iterate through users, check whether each is on that channel
-        pthread_mutex_lock(&lock);
-        list_iterator_start(server->userlist);
-        while(list_iterator_hasnext(server->userlist)){
-            whouser = (person *)list_iterator_next(server->userlist); 
-            pthread_mutex_lock(&(whouser->c_lock));
-            whochan = (mychan *)list_seek(whouser->my_chans, seek_arg);
-            if (whochan != NULL) {
-                //construct flags
-                memset(flags, (int) '\0', 10);
-                if (strchr(whouser->mode, (int) 'a') == NULL)
-                    strcpy(flags, "H");
-                else
-                    strcpy(flags, "G");
-                if(strchr(whouser->mode, (int) 'o') != NULL)
-                    strcat(flags, "*");
-                if (strchr(whochan->mode, (int) 'o') != NULL)
-                    strcat(flags, "@");
-                if (strchr(whochan->mode, (int) 'v') != NULL)
-                    strcat(flags, "+");
-                //send RPL_WHOREPLY
-                snprintf(whoreply, MAXMSG - 2, "%s %s %s %s %s %s :0 %s", params[1], whouser->user, whouser->address, server->servername, whouser->nick, flags, whouser->fullname);
-                constr_reply(RPL_WHOREPLY, user, reply, server, whoreply);
-                if (strcmp(whouser->nick, user->nick) != 0) 
-                    pthread_mutex_lock(&(user->c_lock));
-                if(send(clientSocket, reply, strlen(reply), 0) == -1){
-                    perror("Socket send() failed");
-                    user_exit(server, user);
-                }
-                if (strcmp(whouser->nick, user->nick) != 0) 
-                    pthread_mutex_unlock(&(user->c_lock));
+        chan = chanmap_get(server->chans, params[1]);
+        if (chan != NULL) {
+            chirc_lock(&lock);
+            whos = malloc((list_size(chan->members) + 1) * sizeof(person *));
+            list_iter_start(&it, chan->members);
+            while (list_iter_hasnext(&it)) {
+                whouser = (person *)list_iter_next(&it);
+                user_ref(whouser);
+                whos[numwhos++] = whouser;
             }
-            pthread_mutex_unlock(&(whouser->c_lock));
+            chirc_unlock(&lock);
+            chanmap_put(server->chans, chan);
         }
-        list_iterator_stop(server->userlist);
-        pthread_mutex_unlock(&lock);
     }
+    send_whoreplies(server, user, &out, channame, whos, numwhos, chunk);
+    free(whos);
     
     //send RPL_ENDOFWHO regardless
     constr_reply(RPL_ENDOFWHO, user, reply, server, channame);
-    pthread_mutex_lock(&(user->c_lock));
-    if(send(clientSocket, reply, strlen(reply), 0) == -1){
-        perror("Socket send() failed");
-        user_exit(server, user);
+    outbuf_add(&out, reply);
+    outbuf_send(server, user, &out);
+    return 0;
+}
+
+//MODE on a channel. returns 0 if the mode string has no sign, leaving it to be
+//treated as a user mode
+static int channel_mode(chirc_server *server, person *user, chirc_message params, channel *channelpt)
+{
+    char reply[MAXMSG];
+    char *c;
+    unsigned int modes = 0;
+    el_indicator seek_arg;
+    
+	if(params[2][0] == '\0') // asking for channel mode
+	{
+		char channelmodes[MAXMSG];
+		char modes[27];
+		rcu_read_lock();
+		mode_string(rcu_dereference(channelpt->meta)->mode, modes);
+		rcu_read_unlock();
+		sprintf(channelmodes, "%s +%s", channelpt->name, modes);
+		constr_reply(RPL_CHANNELMODEIS, user, reply, server, channelmodes);
+    	user_send(server, user, reply);
+		return 1;
+	}
+	// check for operator priv
+	if(!(user->mode & MODE_OPER)){ // not an operator
+		
+		seek_arg.field = USERCHAN;      
+		seek_arg.value = params[1];   
+			chirc_lock(&lock);
+		mychan *mychanpt = (mychan *)list_seek(user->my_chans, &seek_arg);
+		chirc_unlock(&lock);
+		
+		if(mychanpt == NULL || !(mychanpt->mode & MODE_OPER)){ // not a channel operator
+			constr_reply(ERR_CHANOPRIVISNEEDED, user, reply, server, channelpt->name);
+    		user_send(server, user, reply);
+    		return 1;
+    	}
     }
-    pthread_mutex_unlock(&(user->c_lock));
-    
-    free(seek_arg);
+	// check for a valid mode
+	if(!(MODE_BIT(params[2][1]) & CHANNEL_MODES)){ // not a valid mode
+	    sprintf(reply, "%c", params[2][1]);
+    	constr_reply(ERR_UNKNOWNMODE, user, reply, server, channelpt->name);
+    	user_send(server, user, reply);
+    	return 1;
+	}
+	// change the mode, relay the message
+	for(c = params[2] + 1; *c != '\0'; c++)
+	    modes |= MODE_BIT(*c) & CHANNEL_MODES;
+	if(params[2][0] == '+'){
+    	channel_update(channelpt, NULL, modes, 0);
+    	sprintf(reply, ":%s!%s@%s MODE %s %s",user->nick,user->user,user->address,channelpt->name,params[2]);
+    	strcat(reply, "\r\n");
+    	sendtochannel(server, channelpt, reply, NULL);
+    	return 1;
+	}
+	if(params[2][0] == '-'){
+    	channel_update(channelpt, NULL, 0, modes);
+    	sprintf(reply, ":%s!%s@%s MODE %s %s",user->nick,user->user,user->address,channelpt->name,params[2]);
+    	strcat(reply, "\r\n");
+    	sendtochannel(server, channelpt, reply, NULL);
+	    return 1;
+	}
     return 0;
 }
 
@@ -1406,90 +1333,72 @@ int chirc_handle_MODE(chirc_server *server, person *user, chirc_message params)
 {
     char reply[MAXMSG];
     char reply_param[MAXMSG];
-    char *delmode;
-    char *c;
+    int handled;
     person *modeuser;
     channel *channelpt;
     mychan *userchan;
-    mychan *dummy;
-    int clientSocket = user->clientSocket;
-    el_indicator *seek_arg = malloc(sizeof(el_indicator));
+    unsigned int newmode = 0;
+    el_indicator seek_arg;
     
     // member status modes
     if(params[3][0] != '\0'){
         //does the channel exist?
-        seek_arg->field = CHAN;      
-        seek_arg->value = params[1];   
-        pthread_mutex_lock(&lock);
-        channelpt = (channel *)list_seek(server->chanlist, seek_arg);
-        pthread_mutex_unlock(&lock);
+        seek_arg.value = params[1];   
+        channelpt = chanmap_get(server->chans, params[1]);
         
         if (channelpt == NULL) {                                                    //no, the channel does not exist
             constr_reply(ERR_NOSUCHCHANNEL, user, reply, server, params[1]);
-            pthread_mutex_lock(&(user->c_lock));
-            if(send(clientSocket, reply, strlen(reply), 0) == -1)
-            {
-                perror("Socket send() failed");
-                user_exit(server, user); 
-            }
-            pthread_mutex_unlock(&(user->c_lock));
+            user_send(server, user, reply);
         }
         else{                                                                       //yes, the channel exists
                                                                                     //are you a channel operator or IRC operator?
-            seek_arg->field = USERCHAN;
+            seek_arg.field = USERCHAN;
             //value is already params[1]
-            pthread_mutex_lock(&(user->c_lock));
-            userchan = (mychan *)list_seek(user->my_chans, seek_arg);
-            pthread_mutex_unlock(&(user->c_lock));
-            if (userchan == NULL || (strchr(user->mode, (int) 'o') == NULL && strchr(userchan->mode, (int) 'o') == NULL)) {    //no, you're not a chanop or IRC op
+            chirc_lock(&(user->c_lock));
+            userchan = (mychan *)list_seek(user->my_chans, &seek_arg);
+            if (userchan != NULL)
+                newmode = user->mode | userchan->mode;
+            chirc_unlock(&(user->c_lock));
+            if (userchan == NULL || !(newmode & MODE_OPER)) {                           //no, you're not a chanop or IRC op
                 constr_reply(ERR_CHANOPRIVISNEEDED, user, reply, server, params[1]);
-                if(send(clientSocket, reply, strlen(reply), 0) == -1)
-                {
-                    perror("Socket send() failed");
-                    user_exit(server, user); 
-                }
-                pthread_mutex_unlock(&(user->c_lock));
+                user_send(server, user, reply);
             }
             else{                                                                   //yes, you're a chanop or IRC op
                                                                                     //does user exist? if so, are they on the channel?
-                dummy = malloc(sizeof(mychan));
-                strcpy(dummy->name, params[1]);
-                seek_arg->field = USER;
-                seek_arg->value = params[3];
-                pthread_mutex_lock(&lock);
-                modeuser = (person *)list_seek(server->userlist, seek_arg);
-                pthread_mutex_unlock(&lock);
-                if (modeuser == NULL || (!list_contains(modeuser->my_chans, dummy))){  //no, the user is not on the channel
+                seek_arg.field = USER;
+                seek_arg.value = params[3];
+                chirc_lock(&lock);
+                modeuser = (person *)list_seek(server->userlist, &seek_arg);
+                if (modeuser != NULL)
+                    user_ref(modeuser);
+                chirc_unlock(&lock);
+                //membership is looked up and changed in one go, so a PART can't free it in between
+                userchan = NULL;
+                if (modeuser != NULL) {
+                    seek_arg.field = USERCHAN;
+                    seek_arg.value = params[1];
+                    chirc_lock(&(modeuser->c_lock));
+                    userchan = (mychan *)list_seek(modeuser->my_chans, &seek_arg);
+                    if (userchan != NULL && (MODE_BIT(params[2][1]) & MEMBER_MODES)) {
+                        if(params[2][0] == '+')
+                            userchan->mode |= MODE_BIT(params[2][1]);
+                        else if(params[2][0]  == '-')
+                            userchan->mode &= ~MODE_BIT(params[2][1]);
+                        newmode = userchan->mode;
+                    }
+                    chirc_unlock(&(modeuser->c_lock));
+                }
+                if (userchan == NULL){                                               //no, the user is not on the channel
                     sprintf(reply_param, "%s %s", params[3], params[1]);
                     constr_reply(ERR_USERNOTINCHANNEL, user, reply, server, reply_param);
-                    if(send(clientSocket, reply, strlen(reply), 0) == -1)
-                    {
-                        perror("Socket send() failed");
-                        user_exit(server, user); 
-                    }
-                    pthread_mutex_unlock(&(user->c_lock));
+                    user_send(server, user, reply);
                 }
                 else{                                                                //yes, the user exists
                                                                                      //is the mode string valid?
-                    if(strpbrk(params[2], "ov") != NULL){                            //yes, the mode string is valid
-                        seek_arg->field = USERCHAN;
-                        seek_arg->value = params[1];
-                        pthread_mutex_lock(&(modeuser->c_lock));
-                        userchan = (mychan *)list_seek(modeuser->my_chans, seek_arg);
-                        pthread_mutex_unlock(&(modeuser->c_lock));
-                        
-                        if(params[2][0] == '+'){                                     //add the mode, if they don't already have it
-                            if(strchr(userchan->mode, (int) params[2][1]) == NULL)
-                                strcat(userchan->mode, params[2] + 1);
-                        }
-                        else if(params[2][0]  == '-'){
-                            if((delmode = strchr(userchan->mode, (int) params[2][1])) != NULL){ //delete the mode, if they already have it
-                                pthread_mutex_lock(&(user->c_lock));
-                                for(c = delmode; *c != '\0'; c++)
-                                    *c = *(c+1);
-                                pthread_mutex_unlock(&(user->c_lock));
-                            }
-                        }
+                    if(MODE_BIT(params[2][1]) & MEMBER_MODES){                      //yes, the mode string is valid
+                        chirc_lock(&lock);
+                        names_patch(channelpt, modeuser->nick, modeuser->nick, newmode);
+                        chirc_unlock(&lock);
                         //relay message to chan
                         snprintf(reply, MAXMSG - 2, ":%s!%s@%s MODE %s %s %s", user->nick, user->user, user->address, params[1], params[2], params[3]);
                         strcat(reply, "\r\n");
@@ -1498,154 +1407,52 @@ int chirc_handle_MODE(chirc_server *server, person *user, chirc_message params)
                     else{                                                            //no, mode string is invalid
                         sprintf(reply, "%c", params[2][1]);
                         constr_reply(ERR_UNKNOWNMODE, user, reply, server, params[1]);
-                        pthread_mutex_lock(&(user->c_lock));
-                        if(send(clientSocket, reply, strlen(reply), 0) == -1)
-                        {
-                            perror("Socket send() failed");
-                            user_exit(server, user); 
-                        }
-                        pthread_mutex_unlock(&(user->c_lock));
+                        user_send(server, user, reply);
                     }
                 }
+                if (modeuser != NULL)
+                    user_put(modeuser);
             }
+            chanmap_put(server->chans, channelpt);
         }
 
-        free(seek_arg);
         return 0;
     }
 
     // channel modes
     if(params[1][0] == '#'){
-    	seek_arg->field = CHAN;      
-    	seek_arg->value = params[1];   
-   		pthread_mutex_lock(&lock);
-    	channel *channelpt = (channel *)list_seek(server->chanlist, seek_arg);
-    	pthread_mutex_unlock(&lock);
+    	channel *channelpt = chanmap_get(server->chans, params[1]);
     	if(channelpt == NULL){
     		constr_reply(ERR_NOSUCHCHANNEL, user, reply, server, params[1]);
-        	pthread_mutex_lock(&(user->c_lock));
-        	if(send(clientSocket, reply, strlen(reply), 0) == -1)
-        	{
-            	perror("Socket send() failed");
-            	user_exit(server, user);
-        	}
-        	pthread_mutex_unlock(&(user->c_lock));
-        	return 0;
-    	}
-    	if(params[2][0] == '\0') // asking for channel mode
-    	{
-    		char channelmodes[MAXMSG];
-    		sprintf(channelmodes, "%s +%s", channelpt->name, channelpt->mode);
-    		constr_reply(RPL_CHANNELMODEIS, user, reply, server, channelmodes);
-        	pthread_mutex_lock(&(user->c_lock));
-    		if(send(clientSocket, reply, strlen(reply), 0) == -1)
-    		{
-        	    perror("Socket send() failed");
-        		user_exit(server, user);
-    		}
-    		pthread_mutex_unlock(&(user->c_lock));
-    		return 0;
-    	}
-    	// check for operator priv
-    	if(strchr(user->mode, 'o') == NULL){ // not an operator
-    		
-    		seek_arg->field = USERCHAN;      
-    		seek_arg->value = params[1];   
-   			pthread_mutex_lock(&lock);
-    		mychan *mychanpt = (mychan *)list_seek(user->my_chans, seek_arg);
-    		pthread_mutex_unlock(&lock);
-    		
-    		if(strchr(mychanpt->mode, 'o') == NULL){ // not a channel operator
-    			constr_reply(ERR_CHANOPRIVISNEEDED, user, reply, server, channelpt->name);
-        		pthread_mutex_lock(&(user->c_lock));
-        		if(send(clientSocket, reply, strlen(reply), 0) == -1)
-        		{
-        	    	perror("Socket send() failed");
-        	    	user_exit(server, user);
-        		}
-        		pthread_mutex_unlock(&(user->c_lock));
-        		return 0;
-        	}
-        }
-    	// check for a valid mode
-    	if(strpbrk(params[2], "mt") == NULL){ // not a valid mode
-    	    sprintf(reply, "%c", params[2][1]);
-        	constr_reply(ERR_UNKNOWNMODE, user, reply, server, channelpt->name);
-        	pthread_mutex_lock(&(user->c_lock));
-        	if(send(clientSocket, reply, strlen(reply), 0) == -1)
-        	{
-        	    perror("Socket send() failed");
-        	    user_exit(server, user);
-        	}
-        	pthread_mutex_unlock(&(user->c_lock));
-        	return 0;
-    	}
-    	// change the mode, relay the message
-    	if(params[2][0] == '+'){
-        	strcat(channelpt->mode, params[2] + 1);
-        	sprintf(reply, ":%s!%s@%s MODE %s %s",user->nick,user->user,user->address,channelpt->name,params[2]);
-        	strcat(reply, "\r\n");
-        	sendtochannel(server, channelpt, reply, NULL);
+        	user_send(server, user, reply);
         	return 0;
     	}
-    	if(params[2][0] == '-'){
-    	    char* delmode = NULL;
-        	char* c;
-        	if((delmode = strchr(channelpt->mode, (int) params[2][1])) != NULL){
-        		for(c = delmode; *c != '\0'; c++)
-        			*c = *(c+1);
-        	}
-        	sprintf(reply, ":%s!%s@%s MODE %s %s",user->nick,user->user,user->address,channelpt->name,params[2]);
-        	strcat(reply, "\r\n");
-        	sendtochannel(server, channelpt, reply, NULL);
+    	handled = channel_mode(server, user, params, channelpt);
+    	chanmap_put(server->chans, channelpt);
+    	if(handled)
     	    return 0;
-    	}
     }
 
     // user modes
     if(strcmp(params[1],user->nick)!=0){ // names don't match
         constr_reply(ERR_USERSDONTMATCH, user, reply, server, NULL);
-        pthread_mutex_lock(&(user->c_lock));
-        if(send(clientSocket, reply, strlen(reply), 0) == -1)
-        {
-            perror("Socket send() failed");
-            user_exit(server, user);
-        }
-        pthread_mutex_unlock(&(user->c_lock));
-        free(seek_arg);
+        user_send(server, user, reply);
         return 0;
     }
-    if(strpbrk(params[2], "ao") == NULL){ // not a valid mode
+    if(!(MODE_BIT(params[2][1]) & USER_MODES)){ // not a valid mode
         constr_reply(ERR_UMODEUNKNOWNFLAG, user, reply, server, NULL);
-        pthread_mutex_lock(&(user->c_lock));
-        if(send(clientSocket, reply, strlen(reply), 0) == -1)
-        {
-            perror("Socket send() failed");
-            user_exit(server, user);
-        }
-        pthread_mutex_unlock(&(user->c_lock));
-        free(seek_arg);
+        user_send(server, user, reply);
         return 0;
     }
     if(strcmp(params[2], "-o") == 0){
-        // check that user is operator, remove mode if so
-        if((delmode = strchr(user->mode, (int) '@')) != NULL){
-            pthread_mutex_lock(&(user->c_lock));
-                for(c = delmode; *c != '\0'; c++)
-                    *c = *(c+1);
-            pthread_mutex_unlock(&(user->c_lock));
-        }
+        // remove operator mode; it's harmless if the user wasn't one
+        chirc_lock(&(user->c_lock));
+        user->mode &= ~MODE_OPER;
+        chirc_unlock(&(user->c_lock));
         //return message to user
         snprintf(reply, MAXMSG - 2, ":%s MODE %s :%s", params[1], params[1], params[2]);
         strcat(reply, "\r\n");
-        pthread_mutex_lock(&(user->c_lock));
-        if(send(clientSocket, reply, strlen(reply), 0) == -1)
-        {
-            perror("Socket send() failed");
-            user_exit(server, user);
-        }
-        pthread_mutex_unlock(&(user->c_lock));
-        free(seek_arg);
+        user_send(server, user, reply);
 
         return 0;
     }
@@ -1656,55 +1463,103 @@ int chirc_handle_MODE(chirc_server *server, person *user, chirc_message params)
 int chirc_handle_OPER(chirc_server *server, person *user, chirc_message params)
 {
     char reply[MAXMSG];
-    int clientSocket = user->clientSocket;
+    int match;
     
-    if (strcmp(params[2], server->pw)!=0) {
+    rcu_read_lock();
+    match = strcmp(params[2], config_get()->oper_password) == 0;
+    rcu_read_unlock();
+    if (!match) {
 	constr_reply(ERR_PASSWDMISMATCH, user, reply, server, params[0]);
-        pthread_mutex_lock(&(user->c_lock));
-        if(send(clientSocket, reply, strlen(reply), 0) == -1)
-        {
-            perror("Socket send() failed");
-            user_exit(server, user);
-        }
-        pthread_mutex_unlock(&(user->c_lock));
+        user_send(server, user, reply);
         return 0;
     }
     else {
         // give the person operator power first
-        if(strchr(user->mode, (int)'o') == NULL) // check to make sure not already operator
-            strcat(user->mode, "o");
+        chirc_lock(&(user->c_lock));
+        user->mode |= MODE_OPER;
+        chirc_unlock(&(user->c_lock));
 
         // then send them their message
         constr_reply(RPL_YOUREOPER, user, reply, server, NULL);
-        pthread_mutex_lock(&(user->c_lock));
-        if(send(clientSocket, reply, strlen(reply), 0) == -1)
-        {
-            perror("Socket send() failed");
-            user_exit(server, user);
-        }
-        pthread_mutex_unlock(&(user->c_lock));
+        user_send(server, user, reply);
         return 0;
     }
 
     return 0;
 }
 
+//argument for stats_emit
+typedef struct
+{
+    chirc_server *server;
+    person *user;
+} stats_target;
+
+//sends one line of a STATS report as RPL_STATSDEBUG
+static void stats_emit(const char *line, void *arg)
+{
+    char reply[MAXMSG];
+    char statline[MAXMSG];
+    stats_target *target = (stats_target *)arg;
+    
+    snprintf(statline, MAXMSG - 2, ":%s", line);
+    constr_reply(RPL_STATSDEBUG, target->user, reply, target->server, statline);
+    user_send(target->server, target->user, reply);
+}
+
+int chirc_handle_STATS(chirc_server *server, person *user, chirc_message params)
+{
+    char reply[MAXMSG];
+    char query[2];
+    stats_target target;
+    
+    //check that sender is registered
+    if(!(strlen(user->nick) && strlen(user->user))){
+        constr_reply(ERR_NOTREGISTERED, user, reply, server, NULL);
+        user_send(server, user, reply);
+        return 0;
+    }
+    
+    //reports are only for IRC operators
+    if(!(user->mode & MODE_OPER)){
+        constr_reply(ERR_NOPRIVILEGES, user, reply, server, NULL);
+        user_send(server, user, reply);
+        return 0;
+    }
+    
+    target.server = server;
+    target.user = user;
+    query[0] = params[1][0] ? params[1][0] : '*';
+    query[1] = '\0';
+    
+    switch (query[0]) {
+        case 'p':   // lock, handler and send profile
+            prof_report(stats_emit, &target);
+            break;
+        case 'm':   // pooled objects in use
+            pool_report(stats_emit, &target);
+            break;
+        case 'z':   // memory held by connections
+            mem_report(stats_emit, &target);
+            break;
+        default:
+            break;
+    }
+    
+    constr_reply(RPL_ENDOFSTATS, user, reply, server, query);
+    user_send(server, user, reply);
+    return 0;
+}
+
 
 int chirc_handle_UNKNOWN(chirc_server *server,  //current server
                          person *user,          //current user
                          chirc_message params)  //message received
 {
     char reply[MAXMSG];
-    int clientSocket = user->clientSocket;
     constr_reply(ERR_UNKNOWNCOMMAND, user, reply, server, params[0]);
     
-    pthread_mutex_lock(&(user->c_lock));
-    if(send(clientSocket, reply, strlen(reply), 0) == -1)
-    {
-        perror("Socket send() failed");
-        user_exit(server, user);
-    }
-    pthread_mutex_unlock(&(user->c_lock));
+    user_send(server, user, reply);
     
     return 0;
 }
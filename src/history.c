@@ -0,0 +1,140 @@
+/*
+ *
+ *  CMSC 23300 / 33300 - Networks and Distributed Systems
+ *
+ *  channel message history for chirc project
+ *
+ *  sachs_sandler
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <pthread.h>
+#include <time.h>
+#include "simclist.h"
+#include "ircstructs.h"
+#include "config.h"
+#include "rcu.h"
+#include "history.h"
+
+void outbuf_addn(outbuf *out, const char *msg, size_t len);
+
+typedef struct {
+    unsigned int off;
+    unsigned int len;
+} hist_line;
+
+typedef struct chan_history {
+    int maxlines;
+    size_t size;        //bytes in data
+    size_t end;         //just past the newest line
+    int first;          //slot in lines of the oldest line
+    int numlines;
+    hist_line *lines;   //maxlines slots, used as a ring
+    char *data;
+} chan_history;
+
+static size_t total = 0;    //bytes allocated to every history, updated atomically
+
+static size_t history_cost(int maxlines, size_t size){
+    return sizeof(chan_history) + maxlines * sizeof(hist_line) + size;
+}
+
+static chan_history *history_new(int maxlines, size_t size, size_t budget){
+    size_t cost = history_cost(maxlines, size);
+    chan_history *hist;
+
+    if (__atomic_add_fetch(&total, cost, __ATOMIC_RELAXED) > budget) {
+        __atomic_sub_fetch(&total, cost, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    hist = malloc(sizeof(chan_history));
+    hist->maxlines = maxlines;
+    hist->size = size;
+    hist->end = 0;
+    hist->first = 0;
+    hist->numlines = 0;
+    hist->lines = malloc(maxlines * sizeof(hist_line));
+    hist->data = malloc(size);
+    return hist;
+}
+
+void history_free(channel *chan){
+    chan_history *hist = chan->history;
+
+    if (hist == NULL)
+        return;
+    __atomic_sub_fetch(&total, history_cost(hist->maxlines, hist->size), __ATOMIC_RELAXED);
+    free(hist->lines);
+    free(hist->data);
+    free(hist);
+    chan->history = NULL;
+}
+
+size_t history_total(void){
+    return __atomic_load_n(&total, __ATOMIC_RELAXED);
+}
+
+void history_add(channel *chan, const char *line){
+    chan_history *hist = chan->history;
+    size_t len = strlen(line), pos, oldend;
+    int maxlines, wrapped;
+    size_t size, budget;
+    hist_line *oldest;
+
+    rcu_read_lock();
+    maxlines = config_get()->history_lines;
+    size = config_get()->history_bytes;
+    budget = config_get()->history_total_bytes;
+    rcu_read_unlock();
+
+    //a reload that changes the shape of rings starts them over
+    if (hist != NULL && (hist->maxlines != maxlines || hist->size != size)) {
+        history_free(chan);
+        hist = NULL;
+    }
+    if (maxlines == 0 || len > size)
+        return;
+    if (hist == NULL && (hist = chan->history = history_new(maxlines, size, budget)) == NULL)
+        return;
+
+    //lines never wrap, so one that doesn't fit before the end of data goes at the start
+    if (hist->numlines == 0)
+        hist->end = 0;
+    oldend = hist->end;
+    wrapped = oldend + len > hist->size;
+    pos = wrapped ? 0 : oldend;
+
+    //the oldest lines are the ones just past end, so dropping from the front frees
+    //the space the new line needs (and, if it wrapped, the unused tail of data)
+    while (hist->numlines > 0) {
+        oldest = &(hist->lines[hist->first]);
+        if (hist->numlines < hist->maxlines
+            && (wrapped ? (oldest->off < oldend && oldest->off >= len)
+                        : (oldest->off < pos || oldest->off >= pos + len)))
+            break;
+        hist->first = (hist->first + 1) % hist->maxlines;
+        hist->numlines--;
+    }
+
+    memcpy(hist->data + pos, line, len);
+    hist->lines[(hist->first + hist->numlines) % hist->maxlines].off = pos;
+    hist->lines[(hist->first + hist->numlines) % hist->maxlines].len = len;
+    hist->numlines++;
+    hist->end = pos + len;
+}
+
+void history_replay(channel *chan, outbuf *out){
+    chan_history *hist = chan->history;
+    hist_line *line;
+    int i;
+
+    if (hist == NULL)
+        return;
+    for (i = 0; i < hist->numlines; i++) {
+        line = &(hist->lines[(hist->first + i) % hist->maxlines]);
+        outbuf_addn(out, hist->data + line->off, line->len);
+    }
+}
@@ -0,0 +1,44 @@
+/*
+ *
+ *  CMSC 23300 / 33300 - Networks and Distributed Systems
+ *
+ *  channel message history for chirc project
+ *
+ *  sachs_sandler
+ *
+ */
+
+/*
+ * With history_lines set (see config.h), every PRIVMSG and NOTICE relayed to a
+ * channel is also kept, exactly as it was sent, in a ring belonging to the
+ * channel, and someone joining gets the ring replayed after RPL_ENDOFNAMES.
+ * Nobody else sees the replay.
+ *
+ * A ring is one buffer of history_bytes holding the lines back to back, plus
+ * an array of history_lines offsets into it. Adding a line drops the oldest
+ * ones until it fits. Rings are allocated by a channel's first message and
+ * freed with the channel, so a channel keeps its history until its last member
+ * leaves. No new ring is allocated while the ones already allocated add up to
+ * history_total_bytes; those channels simply keep no history.
+ *
+ * A ring is only touched with the global lock held, the same lock that covers
+ * channel membership, so a message either reaches a joiner live or through the
+ * replay, never both and never neither.
+ */
+
+#ifndef HISTORY_H_
+#define HISTORY_H_
+
+//keeps line (a complete message, CRLF included) in chan's history. call with lock held
+void history_add(channel *chan, const char *line);
+
+//queues chan's history, oldest first, on out. call with lock held
+void history_replay(channel *chan, outbuf *out);
+
+//frees chan's history, for when nothing can reach chan any more
+void history_free(channel *chan);
+
+//bytes currently allocated to histories
+size_t history_total(void);
+
+#endif /* HISTORY_H_ */
@@ -14,22 +14,43 @@
 
 
 
+//modes are kept as bits, one per mode letter
+#define MODE_BIT(c)     (((c) >= 'a' && (c) <= 'z') ? 1u << ((c) - 'a') : 0)
+#define MODE_AWAY       MODE_BIT('a')   //user is away
+#define MODE_OPER       MODE_BIT('o')   //IRC operator, or channel operator in a membership
+#define MODE_VOICE      MODE_BIT('v')   //may speak in a moderated channel
+#define MODE_MODERATED  MODE_BIT('m')
+#define MODE_TOPICLOCK  MODE_BIT('t')   //only channel operators may set the topic
+
+#define USER_MODES      (MODE_AWAY | MODE_OPER)
+#define CHANNEL_MODES   (MODE_MODERATED | MODE_TOPICLOCK)
+#define MEMBER_MODES    (MODE_OPER | MODE_VOICE)
+
 #define MAXMSG 512
 #define MAXPARAMS 16
+#define MAXTARGETS 20 //comma-separated targets honored in one PRIVMSG/NOTICE/JOIN/PART/LIST. the rest get ERR_TOOMANYTARGETS
+#define FANOUT_STACK 64 //recipients a fan-out keeps track of on the stack before it mallocs
+#define MAXCHANLINE 400 //longest list of nicks or channels put in one reply, leaving room for the prefix
 
 typedef struct {
-    char *pw; //operator password
     char *servername; //canonical name of server
-    char *port; //port we're listening on
-    char *version;
     char *birthday;
     list_t *userlist;
-    list_t *chanlist;
+    struct chanmap *chans;      //every channel, by name (see chanmap.h)
     unsigned int numregistered;
+    unsigned long chanversion;  //bumped whenever LIST output could change (see directory_changed)
 } chirc_server;
  
 typedef char chirc_message[MAXPARAMS][MAXMSG-1];
 
+//a line parse_message has only part of, kept between recv calls
+typedef struct {
+    char msg[MAXMSG - 1];
+    int msglength;
+    int truncated;      //rest of an overlong line is being skipped
+    int CRLFsplit;      //last recv ended in \r
+} client_input;
+
 //element of userlist
 typedef struct {
 	int   clientSocket;
@@ -37,11 +58,17 @@ typedef struct {
 	char  user[MAXMSG];
 	char  fullname[MAXMSG];
 	char* address;
-        char mode[5];
+        unsigned int mode;  //USER_MODES bits
         char away[MAXMSG];  //away message
 	pthread_mutex_t c_lock;
        list_t *my_chans;   //list of mychan structs
        pthread_t tid;
+       unsigned long mark; //last fanout epoch that reached this user (see fanout_begin)
+       client_input *input; //partial input while parked for an upgrade, or handed over by one
+       struct mem_conn *mem; //what the connection is charged for (see mem.h), NULL once it's closing
+       int actor_pending;   //jobs posted to channel actors and not yet done (see actor.h)
+       int closing;         //set once the connection is dead or going; nothing more is sent to it
+       int refs;            //threads using the struct outside lock (see user_ref)
 } person;
 
 //parameter for seeker function
@@ -62,24 +89,63 @@ typedef struct
 typedef struct
 {
     chirc_server *server;
-    char *clientname;
+    char *clientname;   //NULL to look it up from addr
     int socket;
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    struct upgrade_client *restore;  //state handed over by an upgrade, NULL for a new client
+    int node;           //NUMA node the thread was placed on, -1 for none (see affinity.h)
 } workerArgs;
 
+//channel state read without locking (see rcu.h). a published version is never
+//changed: writers copy it, change the copy and swap it in under chan_lock
 typedef struct {
-    char name[MAXMSG];
     char topic[MAXMSG];
-    char mode[5];
+    time_t topic_time;  //when the topic was last set, 0 if never
+    unsigned int mode;  //CHANNEL_MODES bits
+} chan_meta;
+
+typedef struct channel {
+    char name[MAXMSG];
+    chan_meta *meta;
     int numusers;
+    list_t *members;    //person structs on the channel, protected by lock
+    char *names;        //cached NAMES list, protected by lock (see names_patch)
+    size_t nameslen;
+    size_t namessize;
     pthread_mutex_t chan_lock;
+    int refs;               //protected by the chanmap bucket lock
+    struct channel *next;   //next in its chanmap bucket
+    struct chan_history *history;   //recent messages, protected by lock (see history.h)
+    struct actor_box *box;          //mailbox when run by an actor, NULL until first used (see actor.h)
 } channel;
 
 typedef struct {
     char name[MAXMSG];  //name of channel
-    char mode[5];       //member status mode 
+    unsigned int mode;  //member status, MEMBER_MODES bits
+    channel *chan;      //the membership's reference to the channel
 } mychan;
 
+//replies queued up by a handler and sent together (see outbuf_add)
+typedef struct {
+    char *data;
+    size_t len;
+    size_t size;
+} outbuf;
 
+//one channel in a directory snapshot
+typedef struct {
+    char *name;
+    char *listing;          //RPL_LIST parameters, "name numusers :topic"
+    int numusers;
+    time_t topic_time;
+} dir_entry;
 
-
-
+//read-only copy of the channel list used to answer LIST (see directory_get)
+typedef struct {
+    unsigned long version;  //server chanversion it was taken at
+    int refs;               //protected by dirlock in channel.c
+    int numentries;
+    dir_entry *entries;
+    char *data;             //names and listings of every entry
+} directory;
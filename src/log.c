@@ -0,0 +1,329 @@
+/*
+ *
+ *  CMSC 23300 / 33300 - Networks and Distributed Systems
+ *
+ *  asynchronous event log for chirc project
+ *
+ *  sachs_sandler
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include "config.h"
+#include "rcu.h"
+#include "log.h"
+
+#define LOG_RING        128     //records per thread, a power of 2
+#define LOG_INTERVAL    50      //milliseconds between writes
+#define LOG_LINE        256
+
+//one cache line
+typedef struct {
+    int64_t time;       //nanoseconds since the epoch
+    int64_t a0, a1;
+    int32_t fd;
+    uint16_t event;
+    char text[LOG_TEXT + 2];
+} log_record;
+
+//written by one thread and emptied by the writer; reused, never freed
+typedef struct log_ring {
+    unsigned long head __attribute__((aligned(64)));   //next record to write, only moved by the owner
+    unsigned long dropped;                             //records lost to a full ring, added to by the owner and taken off by the writer
+    unsigned long tail __attribute__((aligned(64)));   //next record to read, only moved by the writer
+    int in_use;
+    struct log_ring *next;
+    log_record records[LOG_RING];
+} log_ring;
+
+static const struct {
+    const char *name;
+    int level;
+    const char *a0, *a1, *text;     //field names, NULL if unused
+} events[LOG_NUM_EVENTS] = {
+    [LOG_CONNECT]        = { "connect",        LOG_INFO,  NULL,      NULL,      "host" },
+    [LOG_REGISTER]       = { "register",       LOG_INFO,  NULL,      NULL,      "nick" },
+    [LOG_EOF]            = { "eof",            LOG_DEBUG, NULL,      NULL,      NULL },
+    [LOG_DISCONNECT]     = { "disconnect",     LOG_INFO,  NULL,      NULL,      "nick" },
+    [LOG_RECV_ERROR]     = { "recv-error",     LOG_WARN,  "errno",   NULL,      NULL },
+    [LOG_SEND_ERROR]     = { "send-error",     LOG_WARN,  "errno",   NULL,      NULL },
+    [LOG_SHED]           = { "shed",           LOG_WARN,  "per_ip",  NULL,      "address" },
+    [LOG_ACCEPT_ERROR]   = { "accept-error",   LOG_ERROR, "errno",   NULL,      NULL },
+    [LOG_THREAD_ERROR]   = { "thread-error",   LOG_ERROR, "errno",   NULL,      NULL },
+    [LOG_RELOAD]         = { "reload",         LOG_INFO,  "ok",      NULL,      NULL },
+    [LOG_LISTEN]         = { "listen",         LOG_INFO,  "ok",      NULL,      "port" },
+    [LOG_UPGRADE]        = { "upgrade",        LOG_INFO,  "pid",     "clients", NULL },
+    [LOG_UPGRADED]       = { "upgraded",       LOG_INFO,  "clients", "channels", NULL },
+    [LOG_UPGRADE_FAILED] = { "upgrade-failed", LOG_ERROR, NULL,      NULL,      "reason" },
+    [LOG_DROPPED]        = { "dropped",        LOG_WARN,  "records", NULL,      NULL },
+    [LOG_MEM_PRESSURE]   = { "memory-pressure", LOG_WARN, "bytes",   "budget",  NULL },
+    [LOG_EVICT]          = { "evict",          LOG_WARN,  "bytes",   NULL,      "nick" },
+};
+
+static const char *level_names[] = { "debug", "info", "warn", "error" };
+
+static int threshold = LOG_INFO;        //updated by the writer from the configuration
+static log_ring *rings = NULL;
+static pthread_key_t ring_key;
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static __thread log_ring *self = NULL;
+
+//the writer's state, also used by log_flush
+static pthread_mutex_t write_lock = PTHREAD_MUTEX_INITIALIZER;
+static log_record *batch = NULL;
+static size_t batchsize = 0;
+static char *out = NULL;
+static size_t outsize = 0;
+static int fd = -1;                     //-1 while writing to stderr
+static char path[CONFLINE];
+static size_t written = 0;              //bytes in the current file
+
+//runs when a thread exits. the writer still empties the ring
+static void thread_done(void *arg){
+    __atomic_store_n(&(((log_ring *)arg)->in_use), 0, __ATOMIC_RELEASE);
+}
+
+static void make_key(void){
+    if (pthread_key_create(&ring_key, thread_done) != 0) {
+        perror("Could not create log thread key");
+        exit(-1);
+    }
+}
+
+static log_ring *register_thread(void){
+    log_ring *r;
+
+    pthread_once(&key_once, make_key);
+    for (r = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); r != NULL; r = r->next)
+        if (!__atomic_load_n(&(r->in_use), __ATOMIC_RELAXED) && __sync_bool_compare_and_swap(&(r->in_use), 0, 1))
+            break;
+    if (r == NULL) {
+        r = calloc(1, sizeof(log_ring));
+        r->in_use = 1;
+        do {
+            r->next = rings;
+        } while (!__sync_bool_compare_and_swap(&rings, r->next, r));
+    }
+    pthread_setspecific(ring_key, r);
+    return r;
+}
+
+void log_event(log_event_id event, int fd, int64_t a0, int64_t a1, const char *text){
+    struct timespec now;
+    unsigned long head;
+    log_record *rec;
+    size_t len;
+
+    if (events[event].level < __atomic_load_n(&threshold, __ATOMIC_RELAXED))
+        return;
+    if (self == NULL)
+        self = register_thread();
+    head = self->head;
+    if (head - __atomic_load_n(&(self->tail), __ATOMIC_ACQUIRE) == LOG_RING) {
+        __atomic_add_fetch(&(self->dropped), 1, __ATOMIC_RELAXED);
+        return;
+    }
+    rec = &(self->records[head % LOG_RING]);
+    clock_gettime(CLOCK_REALTIME, &now);
+    rec->time = now.tv_sec * 1000000000LL + now.tv_nsec;
+    rec->event = event;
+    rec->fd = fd;
+    rec->a0 = a0;
+    rec->a1 = a1;
+    len = 0;
+    if (text != NULL) {
+        len = strnlen(text, LOG_TEXT - 1);
+        memcpy(rec->text, text, len);
+    }
+    rec->text[len] = '\0';
+    __atomic_store_n(&(self->head), head + 1, __ATOMIC_RELEASE);
+}
+
+static int by_time(const void *a, const void *b){
+    int64_t ta = ((const log_record *)a)->time, tb = ((const log_record *)b)->time;
+    return (ta > tb) - (ta < tb);
+}
+
+//follows the configuration, reopening the file if it moved. call with write_lock held
+static void configure(size_t *max_bytes, int *keep){
+    char newpath[CONFLINE];
+    int level;
+
+    rcu_read_lock();
+    strcpy(newpath, config_get()->log_file);
+    level = config_get()->log_level;
+    *max_bytes = config_get()->log_max_bytes;
+    *keep = config_get()->log_keep;
+    rcu_read_unlock();
+
+    __atomic_store_n(&threshold, level, __ATOMIC_RELAXED);
+    if (strcmp(newpath, path) == 0 && (fd != -1 || path[0] == '\0'))
+        return;
+    if (fd != -1)
+        close(fd);
+    fd = -1;
+    written = 0;
+    strcpy(path, newpath);
+    if (path[0] == '\0')
+        return;
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) == -1)
+        perror("Could not open log file");  //carries on to stderr, and tries again next time
+    else
+        written = lseek(fd, 0, SEEK_END);
+}
+
+//moves log_file to log_file.1, .1 to .2 and so on. call with write_lock held
+static void rotate(int keep){
+    char from[CONFLINE + 16], to[CONFLINE + 16];
+    int i;
+
+    close(fd);
+    fd = -1;
+    for (i = keep - 1; i >= 1; i--) {
+        snprintf(from, sizeof(from), "%s.%d", path, i);
+        snprintf(to, sizeof(to), "%s.%d", path, i + 1);
+        rename(from, to);
+    }
+    if (keep > 0) {
+        snprintf(to, sizeof(to), "%s.1", path);
+        rename(path, to);
+    }
+    else
+        unlink(path);
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) == -1)
+        perror("Could not open log file");
+    written = 0;
+}
+
+//appends one formatted record to out
+static size_t format(const log_record *rec, char *line){
+    struct tm tm;
+    time_t secs = rec->time / 1000000000LL;
+    size_t len;
+    char err[64];
+    const char *names[2] = { events[rec->event].a0, events[rec->event].a1 };
+    int64_t values[2] = { rec->a0, rec->a1 };
+    int i;
+
+    localtime_r(&secs, &tm);
+    len = strftime(line, LOG_LINE, "%Y-%m-%d %H:%M:%S", &tm);
+    len += snprintf(line + len, LOG_LINE - len, ".%03d %s %s", (int) (rec->time / 1000000 % 1000),
+                    level_names[events[rec->event].level], events[rec->event].name);
+    if (rec->fd != -1)
+        len += snprintf(line + len, LOG_LINE - len, " fd=%d", rec->fd);
+    for (i = 0; i < 2; i++) {
+        if (names[i] == NULL)
+            continue;
+        if (strcmp(names[i], "errno") == 0) {
+            if (strerror_r((int) values[i], err, sizeof(err)) != 0)
+                snprintf(err, sizeof(err), "errno %d", (int) values[i]);
+            len += snprintf(line + len, LOG_LINE - len, " error=\"%s\"", err);
+        }
+        else
+            len += snprintf(line + len, LOG_LINE - len, " %s=%lld", names[i], (long long) values[i]);
+    }
+    if (events[rec->event].text != NULL)
+        len += snprintf(line + len, LOG_LINE - len, " %s=%s", events[rec->event].text, rec->text);
+    if (len > LOG_LINE - 2)
+        len = LOG_LINE - 2;
+    line[len++] = '\n';
+    return len;
+}
+
+//empties every ring and writes what was in them. call with write_lock held
+static void drain(void){
+    unsigned long head, tail, dropped = 0, d;
+    size_t n = 0, len = 0, max_bytes;
+    ssize_t w;
+    log_record extra;
+    log_ring *r;
+    int keep;
+
+    configure(&max_bytes, &keep);
+    for (r = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); r != NULL; r = r->next) {
+        tail = r->tail;
+        head = __atomic_load_n(&(r->head), __ATOMIC_ACQUIRE);
+        if (n + (head - tail) > batchsize) {
+            batchsize = 2 * (n + (head - tail));
+            batch = realloc(batch, batchsize * sizeof(log_record));
+        }
+        for (; tail != head; tail++)
+            batch[n++] = r->records[tail % LOG_RING];
+        __atomic_store_n(&(r->tail), tail, __ATOMIC_RELEASE);
+        if ((d = __atomic_load_n(&(r->dropped), __ATOMIC_RELAXED)) != 0) {
+            dropped += d;
+            __atomic_sub_fetch(&(r->dropped), d, __ATOMIC_RELAXED);
+        }
+    }
+    if (n == 0 && dropped == 0)
+        return;
+    qsort(batch, n, sizeof(log_record), by_time);
+
+    if (outsize < (n + 1) * LOG_LINE) {
+        outsize = 2 * (n + 1) * LOG_LINE;
+        out = realloc(out, outsize);
+    }
+    for (d = 0; d < n; d++)
+        len += format(&batch[d], out + len);
+    if (dropped != 0) {
+        memset(&extra, 0, sizeof(extra));
+        extra.time = n ? batch[n - 1].time : 0;
+        extra.event = LOG_DROPPED;
+        extra.fd = -1;
+        extra.a0 = dropped;
+        len += format(&extra, out + len);
+    }
+
+    for (d = 0; d < len; d += w) {
+        if ((w = write(fd == -1 ? STDERR_FILENO : fd, out + d, len - d)) == -1) {
+            if (errno == EINTR) {
+                w = 0;
+                continue;
+            }
+            if (fd != -1)
+                perror("Could not write log file");
+            break;
+        }
+    }
+    if (fd != -1 && (written += len) >= max_bytes)
+        rotate(keep);
+}
+
+static void *writer(void *args){
+    struct timespec interval = { 0, LOG_INTERVAL * 1000000L };
+
+    while (1) {
+        nanosleep(&interval, NULL);
+        pthread_mutex_lock(&write_lock);
+        drain();
+        pthread_mutex_unlock(&write_lock);
+    }
+    return NULL;
+}
+
+void log_start(void){
+    pthread_t tid;
+    size_t max_bytes;
+    int keep;
+
+    pthread_mutex_lock(&write_lock);
+    configure(&max_bytes, &keep);
+    pthread_mutex_unlock(&write_lock);
+    if (pthread_create(&tid, NULL, writer, NULL) != 0) {
+        perror("Could not create log thread");
+        exit(-1);
+    }
+    pthread_detach(tid);
+}
+
+void log_flush(void){
+    pthread_mutex_lock(&write_lock);
+    drain();
+    pthread_mutex_unlock(&write_lock);
+}
@@ -0,0 +1,74 @@
+/*
+ *
+ *  CMSC 23300 / 33300 - Networks and Distributed Systems
+ *
+ *  asynchronous event log for chirc project
+ *
+ *  sachs_sandler
+ *
+ */
+
+/*
+ * log_event records that something happened: which event, the socket it
+ * happened on, up to two numbers and a short piece of text (cut to
+ * LOG_TEXT - 1 bytes). It copies those into a fixed-size record in a ring
+ * belonging to the calling thread and returns, without taking a lock or
+ * formatting anything. A full ring drops the record and counts it.
+ *
+ * A writer thread empties every ring a few times a second, puts the records
+ * in time order, formats them one line per event,
+ *
+ *   2026-10-19 06:18:00.123 info connect fd=5 host=localhost
+ *
+ * and writes them all at once to log_file, or to stderr if it is empty.
+ * Once log_file reaches log_max_bytes it is renamed to log_file.1 (and .1 to
+ * .2 and so on, keeping log_keep of them) and a new one is started.
+ *
+ * log_level, log_file and the rotation settings (see config.h) can all be
+ * changed with a reload. Fatal errors at startup still go straight to stderr.
+ */
+
+#ifndef LOG_H_
+#define LOG_H_
+
+#include <stdint.h>
+
+#define LOG_TEXT 32
+
+#define LOG_DEBUG   0
+#define LOG_INFO    1
+#define LOG_WARN    2
+#define LOG_ERROR   3
+
+//what log_event records. each has a level and names for its fields (see log.c)
+typedef enum {
+    LOG_CONNECT,        //text: client's host name
+    LOG_REGISTER,       //text: nick
+    LOG_EOF,            //client closed its end
+    LOG_DISCONNECT,     //text: nick
+    LOG_RECV_ERROR,     //a0: errno
+    LOG_SEND_ERROR,     //a0: errno
+    LOG_SHED,           //a0: 0 server full, 1 too many from the address; text: address
+    LOG_ACCEPT_ERROR,   //a0: errno
+    LOG_THREAD_ERROR,   //a0: errno
+    LOG_RELOAD,         //a0: 1 if the configuration was reloaded, 0 if it was kept
+    LOG_LISTEN,         //a0: 1 if listening, 0 if a new listening socket failed; text: port
+    LOG_UPGRADE,        //a0: process handed over to; a1: clients
+    LOG_UPGRADED,       //a0: clients taken over; a1: channels
+    LOG_UPGRADE_FAILED, //text: why
+    LOG_DROPPED,        //a0: records dropped by full rings since the last report
+    LOG_MEM_PRESSURE,   //a0: bytes held; a1: mem_budget
+    LOG_EVICT,          //a0: bytes the connection held; text: nick
+    LOG_NUM_EVENTS
+} log_event_id;
+
+//starts the writer thread. call once the configuration is loaded
+void log_start(void);
+
+//records an event. fd is -1 if it isn't about a connection, text may be NULL
+void log_event(log_event_id event, int fd, int64_t a0, int64_t a1, const char *text);
+
+//writes out everything recorded so far, for when the process is about to exit
+void log_flush(void);
+
+#endif /* LOG_H_ */
@@ -7,6 +7,7 @@
  *  sachs_sandler
  *
  */
+#define _GNU_SOURCE     //accept4
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -16,6 +17,8 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <pthread.h>
 #include <signal.h>
 #include <errno.h>
@@ -23,47 +26,67 @@
 #include "reply.h"
 #include "simclist.h"
 #include "ircstructs.h"
-
-#define HOSTNAMELEN 30
+#include "prof.h"
+#include "trace.h"
+#include "capture.h"
+#include "chanmap.h"
+#include "config.h"
+#include "rcu.h"
+#include "upgrade.h"
+#include "admit.h"
+#include "log.h"
+#include "mem.h"
+#include "actor.h"
+#include "affinity.h"
 
 //lock for server struct
 pthread_mutex_t lock;
-//lock for log
-pthread_mutex_t loglock;
 
 
 void *accept_clients(void *args);
 void *service_single_client(void *args);
+void *handle_signals(void *args);
+static int open_listener(const char *address, const char *port, int backlog);
+static void reload_listener(void);
 int fun_seek(const void *el, const void *indicator);
+list_hash_t hash_nick(const void *el);
+int hash_nick_seek(const void *indicator, list_hash_t *hash);
+list_hash_t hash_fd(const void *el);
+int hash_fd_seek(const void *indicator, list_hash_t *hash);
 
-list_t userlist, chanlist;
+list_t userlist;
 chirc_server *ourserver;
 
+static char *confpath = NULL;   //configuration file given with -f, reread on SIGHUP
+
+//the socket accept_clients takes connections on. a reload that moves it opens the
+//new one, swaps it in here and shuts the old one down, which wakes poll()
+static int listen_fd = -1;
+static char listen_address[CONFLINE], listen_port[CONFLINE];   //what listen_fd is bound to
+
 int main(int argc, char *argv[])
 {
     /* list structs used for storing users and channels in the server struct */
     //list_init(& userlist);
-	//list_init(& chanlist);
 	
 	int opt;
-	char *port = "6667", *passwd = NULL;
+	char *port = NULL, *passwd = NULL, *capture = NULL;
+	int havepasswd, fd, err;
+	char servname[MAXMSG];
     serverArgs *sa;
     time_t birthday = time(NULL);
     
     
     //initialize lists
     list_init(& userlist);
-	list_init(& chanlist);
-	if(list_attributes_seeker(&userlist, fun_seek) == -1){
-		perror("list fail");
-		exit(-1);
-	}
-	if(list_attributes_seeker(&chanlist, fun_seek) == -1){
+	if(list_attributes_seeker(&userlist, fun_seek) == -1
+	   || list_attributes_index(&userlist, hash_nick, hash_nick_seek) == -1
+	   || list_attributes_index(&userlist, hash_fd, hash_fd_seek) == -1){
 		perror("list fail");
 		exit(-1);
 	}
     
-	while ((opt = getopt(argc, argv, "p:o:h")) != -1)
+	while ((opt = getopt(argc, argv, "p:o:c:f:h")) != -1)
 		switch (opt)
 		{
 			case 'p':
@@ -72,50 +95,109 @@ int main(int argc, char *argv[])
 			case 'o':
 				passwd = strdup(optarg);
 				break;
+			case 'c':
+				capture = strdup(optarg);
+				break;
+			case 'f':
+				confpath = strdup(optarg);
+				break;
 			default:
 				printf("ERROR: Unknown option -%c\n", opt);
 				exit(-1);
 		}
 
     
-	if (!passwd)
+	//the command line wins over the configuration file
+	if ((port && config_override("port", port) == -1) || (passwd && config_override("oper_password", passwd) == -1))
+	{
+		fprintf(stderr, "ERROR: Bad -p or -o argument\n");
+		exit(-1);
+	}
+	if (config_load(confpath) == -1)
+		exit(-1);
+	rcu_read_lock();
+	havepasswd = config_get()->oper_password[0] != '\0';
+	rcu_read_unlock();
+	if (!havepasswd)
 	{
 		fprintf(stderr, "ERROR: You must specify an operator password\n");
 		exit(-1);
 	}
     
+    //record client input for chirc-replay
+    if (capture && capture_start(capture) == -1)
+        exit(-1);
+    
     /*initialize chirc_server struct*/
     ourserver = malloc(sizeof(chirc_server));
     ourserver->userlist = &userlist;
-    ourserver->chanlist = &chanlist;
+    ourserver->chans = chanmap_create();
     ourserver->numregistered = 0;
-    ourserver->port = port;
-    ourserver->pw = passwd;
-    ourserver->version = "chirc-0.1";
+    ourserver->chanversion = 0;
     ourserver->birthday = ctime(&birthday);
     ourserver->birthday[strlen(ourserver->birthday) - 1] = '\0';
 
     /* stores several parameters within the server struct */
     
 	pthread_t server_thread; // the main and only server thread
+	pthread_attr_t attr;
+    
+	pthread_t signal_thread; // waits for SIGUSR1 and the like
     
 	sigset_t new;
 	sigemptyset (&new);
 	sigaddset(&new, SIGPIPE);
+	sigaddset(&new, SIGUSR1);
+	sigaddset(&new, SIGHUP);
+	sigaddset(&new, SIGUSR2);
+	//terminating goes through handle_signals too, so the log and any capture get written out
+	sigaddset(&new, SIGTERM);
+	sigaddset(&new, SIGINT);
 	if (pthread_sigmask(SIG_BLOCK, &new, NULL) != 0) 
 	{
 		perror("Unable to mask SIGPIPE");
 		exit(-1);
 	}
+	
+	//the writer thread needs the mask above, like every other thread
+	log_start();
+	mem_start();
+	affinity_start();
+	actor_start(ourserver);
     
 	pthread_mutex_init(&lock, NULL);
-    pthread_mutex_init(&loglock, NULL);
+    
+    //get server name
+    gethostname(servname, MAXMSG);
+    ourserver->servername = malloc(strlen(servname) + 1);
+    strcpy(ourserver->servername, servname);
+    
+    //take over from the process that started us, if it was upgrading
+    upgrade_init(argv);
+    if ((fd = upgrade_receive(ourserver)) != -1)
+    {
+        //accept_clients drains it until EAGAIN
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        __atomic_store_n(&listen_fd, fd, __ATOMIC_RELEASE);
+    }
     
     sa = malloc(sizeof(serverArgs));
     sa->server = ourserver;
     
+    //every thread inherits the mask above, so only this one ever sees SIGUSR1 or SIGHUP
+	if (pthread_create(&signal_thread, NULL, handle_signals, NULL) != 0)
+	{
+		perror("Could not create signal thread");
+		exit(-1);
+	}
+	pthread_detach(signal_thread);
+    
     //create server thread
-	if (pthread_create(&server_thread, NULL, accept_clients, sa) < 0)
+	pthread_attr_init(&attr);
+	affinity_accept(&attr);
+	err = pthread_create(&server_thread, &attr, accept_clients, sa);
+	pthread_attr_destroy(&attr);
+	if (err != 0)
 	{
 		perror("Could not create server thread");
 		exit(-1);
@@ -124,33 +206,15 @@ int main(int argc, char *argv[])
     //cleanup
 	pthread_join(server_thread, NULL);
 	pthread_mutex_destroy(&lock);
-    pthread_mutex_destroy(&loglock);
 	pthread_exit(NULL);
 }
 
-//listens on port, gets some server and client info
-void *accept_clients(void *args)
-{	
-    //unpack argument
-    serverArgs *sa;
-    chirc_server *ourserver;
-     
-    sa = (serverArgs*) args;
-    ourserver = sa->server;
-    free(sa);
-
-
-    char servname[MAXMSG];
-    char *port = ourserver->port;
-	int serverSocket;
-	int clientSocket;
-	pthread_t worker_thread;
+//opens a socket listening on address (every address if it is empty) and port. returns -1 on failure
+static int open_listener(const char *address, const char *port, int backlog)
+{
+	int serverSocket = -1;
 	struct addrinfo hints, *res, *p;
-	struct sockaddr_in clientAddr;
-	socklen_t sinSize = sizeof(struct sockaddr_storage);
-	workerArgs *wa;
 	int yes = 1;
-	char hostname[HOSTNAMELEN];
     
     //set hints
 	memset(&hints, 0, sizeof hints);
@@ -158,26 +222,16 @@ void *accept_clients(void *args)
 	hints.ai_socktype = SOCK_STREAM;
 	hints.ai_flags = AI_PASSIVE;
     
-    
-	if (getaddrinfo(NULL, port, &hints, &res) != 0)
+	if (getaddrinfo(address[0] ? address : NULL, port, &hints, &res) != 0)
 	{
 		perror("getaddrinfo() failed");
-		pthread_exit(NULL);
+		return -1;
 	}
     
-    //get server name
-    //don't really need mutex since there aren't other threads going, but it is accessing a shared data structure
-    pthread_mutex_lock(&lock);
-    gethostname(servname, MAXMSG);
-    ourserver->servername = malloc(strlen(servname));
-    strcpy(ourserver->servername, servname);
-    pthread_mutex_unlock(&lock);
-    
-    
     //find a working socket
 	for(p = res;p != NULL; p = p->ai_next) 
 	{
-		if ((serverSocket = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) == -1) 
+		if ((serverSocket = socket(p->ai_family, p->ai_socktype | SOCK_NONBLOCK, p->ai_protocol)) == -1) 
 		{
 			perror("Could not open socket");
 			continue;
@@ -197,7 +251,7 @@ void *accept_clients(void *args)
 			continue;
 		}
         
-		if (listen(serverSocket, 5) == -1)
+		if (listen(serverSocket, backlog) == -1)
 		{
 			perror("Socket listen() failed");
 			close(serverSocket);
@@ -207,52 +261,229 @@ void *accept_clients(void *args)
 		break;
 	}
     
-    
 	freeaddrinfo(res);
     
 	if (p == NULL)
 	{
     	fprintf(stderr, "Could not find a socket to bind to.\n");
-		pthread_exit(NULL);
+		return -1;
 	}
+	return serverSocket;
+}
+
+//brings the listening socket in line with the configuration after a reload
+static void reload_listener(void)
+{
+    char address[CONFLINE], port[CONFLINE];
+    int backlog, fd, old;
+    
+    //not listening yet, and accept_clients will read the new configuration when it starts
+    if (__atomic_load_n(&listen_fd, __ATOMIC_ACQUIRE) == -1)
+        return;
+    rcu_read_lock();
+    strcpy(address, config_get()->listen_address);
+    strcpy(port, config_get()->port);
+    backlog = config_get()->backlog;
+    rcu_read_unlock();
     
-    //loop to accept clients and dispatch them to worker thread
+    //listen() on a listening socket just changes the backlog
+    if (strcmp(address, listen_address) == 0 && strcmp(port, listen_port) == 0)
+    {
+        if (listen(listen_fd, backlog) == -1)
+            perror("Socket listen() failed");
+        return;
+    }
+    if ((fd = open_listener(address, port, backlog)) == -1)
+    {
+        log_event(LOG_LISTEN, -1, 0, 0, port);
+        return;
+    }
+    log_event(LOG_LISTEN, fd, 1, 0, port);
+    strcpy(listen_address, address);
+    strcpy(listen_port, port);
+    old = listen_fd;
+    __atomic_store_n(&listen_fd, fd, __ATOMIC_RELEASE);
+    shutdown(old, SHUT_RDWR);
+    close(old);
+}
+
+//hands a connection the admission control let through to a thread of its own
+static void start_client(chirc_server *ourserver, int clientSocket, struct sockaddr_storage *clientAddr, socklen_t addrLen)
+{
+	pthread_t worker_thread;
+	pthread_attr_t attr;
+	workerArgs *wa;
+	int err;
+	
+	capture_connect(clientSocket);
+	
+	//pack arguments to worker thread. it looks up the client's name itself, so a slow
+	//DNS server holds up that client and not everyone connecting after it
+	wa = malloc(sizeof(workerArgs));
+	wa->server = ourserver;
+	wa->clientname = NULL;
+	wa->socket = clientSocket;
+	memcpy(&(wa->addr), clientAddr, addrLen);
+	wa->addrlen = addrLen;
+	wa->restore = NULL;
+	pthread_attr_init(&attr);
+	wa->node = affinity_client(&attr);
+	
+	/* this passes control to a thread that handles a single client */
+	upgrade_client_starting();
+	err = pthread_create(&worker_thread, &attr, service_single_client, wa);
+	pthread_attr_destroy(&attr);
+	if (err != 0) 
+	{
+		log_event(LOG_THREAD_ERROR, clientSocket, err, 0, NULL);
+		affinity_forget(wa->node);
+		upgrade_client_started();
+		admit_release((struct sockaddr *) clientAddr);
+		capture_close(clientSocket);
+		close(clientSocket);
+		free(wa);
+	}
+}
+
+//listens on port, gets some server and client info
+void *accept_clients(void *args)
+{	
+    //unpack argument
+    serverArgs *sa;
+    chirc_server *ourserver;
+     
+    sa = (serverArgs*) args;
+    ourserver = sa->server;
+    free(sa);
+
+
+	int serverSocket;
+	int clientSocket;
+	struct sockaddr_storage clientAddr;
+	socklen_t addrLen;
+	struct pollfd pfd;
+	int backlog, fd, wait, err;
+    
+    rcu_read_lock();
+    strcpy(listen_address, config_get()->listen_address);
+    strcpy(listen_port, config_get()->port);
+    backlog = config_get()->backlog;
+    rcu_read_unlock();
+    //an upgrade hands us the socket already listening
+    if (__atomic_load_n(&listen_fd, __ATOMIC_ACQUIRE) == -1)
+    {
+        if ((fd = open_listener(listen_address, listen_port, backlog)) == -1)
+            pthread_exit(NULL);
+        __atomic_store_n(&listen_fd, fd, __ATOMIC_RELEASE);
+    }
+    upgrade_acceptor();
+    
+    //loop to accept clients and dispatch them to worker threads
 	while (1)
 	{
-		if ((clientSocket = accept(serverSocket, (struct sockaddr *) &clientAddr, &sinSize)) == -1) 
+		if (upgrade_pending())
+		{
+			//connections still queued would be lost with this process, so they start now
+			while ((clientSocket = admit_next(&clientAddr, &addrLen, &wait, 1)) != -1)
+				start_client(ourserver, clientSocket, &clientAddr, addrLen);
+			upgrade_park();
+		}
+		serverSocket = __atomic_load_n(&listen_fd, __ATOMIC_ACQUIRE);
+		
+		//start whatever the rate limiter lets through, then wait for new connections
+		//or until it lets the next one through
+		while ((clientSocket = admit_next(&clientAddr, &addrLen, &wait, 0)) != -1)
+			start_client(ourserver, clientSocket, &clientAddr, addrLen);
+		pfd.fd = serverSocket;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, wait) == -1)
 		{
-			perror("Could not accept() connection");
+			//EINTR is an upgrade waking us to park
+			if (errno != EINTR)
+				log_event(LOG_ACCEPT_ERROR, serverSocket, errno, 0, NULL);
 			continue;
 		}
+		if (pfd.revents == 0)
+			continue;
 		
-		// determine name of client
-    	if (getnameinfo((struct sockaddr *) &clientAddr, sizeof(struct sockaddr), hostname, HOSTNAMELEN, NULL, 0, 0) != 0)
-    	{
-        	perror("getnameinfo failed");
-        	close(clientSocket);
-        	close(serverSocket);
-        	pthread_exit(NULL);
-    	}
-				
-        //pack arguments to worker thread
-		wa = malloc(sizeof(workerArgs));
-		wa->server = ourserver;
-        wa->clientname = malloc(strlen(hostname) + 1);;
-        strcpy(wa->clientname, hostname); 
-		wa->socket = clientSocket;
-        
-        /* this passes control to a thread that handles a single client */
-		if (pthread_create(&worker_thread, NULL, service_single_client, wa) != 0) 
+		//take every connection that is waiting before starting any of them
+		while (1)
 		{
-			perror("Could not create a worker thread");
-			free(wa);
-			close(clientSocket);
-			close(serverSocket);
-			pthread_exit(NULL);
+			addrLen = sizeof(clientAddr);
+			if ((clientSocket = accept4(serverSocket, (struct sockaddr *) &clientAddr, &addrLen, SOCK_CLOEXEC)) == -1)
+			{
+				if (errno == ECONNABORTED)
+					continue;
+				//a reload moved the listening socket out from under us
+				if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR
+				    || serverSocket != __atomic_load_n(&listen_fd, __ATOMIC_ACQUIRE))
+					break;
+				err = errno;
+				log_event(LOG_ACCEPT_ERROR, serverSocket, err, 0, NULL);
+				//out of descriptors: give connections a chance to close rather than spin
+				if (err == EMFILE || err == ENFILE || err == ENOBUFS || err == ENOMEM)
+					usleep(100000);
+				break;
+			}
+			CHIRC_TRACE1(accept, clientSocket);
+			admit_connection(clientSocket, (struct sockaddr *) &clientAddr, addrLen);
 		}
 	}
     
 	pthread_exit(NULL);
 }
 
+static void dump_line(const char *line, void *arg)
+{
+    fprintf((FILE *)arg, "%s\n", line);
+}
 
+//waits for signals blocked in main() and acts on them outside of signal context
+void *handle_signals(void *args)
+{
+    sigset_t waitset;
+    int sig;
+    
+    sigemptyset(&waitset);
+    sigaddset(&waitset, SIGUSR1);
+    sigaddset(&waitset, SIGHUP);
+    sigaddset(&waitset, SIGUSR2);
+    sigaddset(&waitset, SIGTERM);
+    sigaddset(&waitset, SIGINT);
+    
+    while (1)
+    {
+        if (sigwait(&waitset, &sig) != 0)
+            continue;
+        if (sig == SIGUSR1)
+        {
+            prof_report(dump_line, stderr);
+            fflush(stderr);
+        }
+        else if (sig == SIGHUP)
+        {
+            //clients stay connected; only what they see from now on changes
+            if (config_load(confpath) == 0)
+            {
+                reload_listener();
+                log_event(LOG_RELOAD, -1, 1, 0, NULL);
+            }
+            else
+                log_event(LOG_RELOAD, -1, 0, 0, NULL);
+        }
+        else if (sig == SIGUSR2)
+        {
+            //only returns if the new process didn't take over
+            upgrade_start(ourserver, __atomic_load_n(&listen_fd, __ATOMIC_ACQUIRE));
+        }
+        else if (sig == SIGTERM || sig == SIGINT)
+        {
+            //make sure the log and a capture in progress end up complete on disk
+            log_flush();
+            capture_stop();
+            exit(0);
+        }
+    }
+    
+    pthread_exit(NULL);
+}
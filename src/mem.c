@@ -0,0 +1,257 @@
+/*
+ *
+ *  CMSC 23300 / 33300 - Networks and Distributed Systems
+ *
+ *  per-connection memory accounting for chirc project
+ *
+ *  sachs_sandler
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+#include <pthread.h>
+#include <time.h>
+#include "simclist.h"
+#include "ircstructs.h"
+#include "config.h"
+#include "rcu.h"
+#include "history.h"
+#include "log.h"
+#include "mem.h"
+
+#define MEM_INTERVAL 100    //ms between checks
+#define MEM_GRACE 1000      //ms of back-pressure before anyone is evicted
+#define MEM_BACKOFF 10      //ms each read waits while memory is short
+#define MEM_REPORT_TOP 10   //connections listed by STATS z
+
+typedef struct mem_conn {
+    person *client;
+    int fd;
+    size_t bytes[MEM_NUM_KINDS];    //updated atomically, except sendq which is only set under mem_lock
+    int evicted;                    //shut down, and no longer counted
+    struct mem_conn *prev, *next;
+} mem_conn;
+
+//a copy of a connection's numbers, made under mem_lock for reporting after it
+typedef struct {
+    char nick[MAXMSG];
+    int fd;
+    size_t bytes[MEM_NUM_KINDS];
+} mem_line;
+
+static const char *kind_names[MEM_NUM_KINDS] = { "sendq", "channels", "outbuf" };
+
+static pthread_mutex_t mem_lock = PTHREAD_MUTEX_INITIALIZER;
+static mem_conn *conns = NULL;
+static int numconns = 0;
+static size_t share = 0;            //what each connection may hold while memory is short, 0 while it isn't.
+                                    //set by the monitor, read by mem_backoff
+
+void mem_open(person *client){
+    mem_conn *c = calloc(1, sizeof(mem_conn));
+
+    c->client = client;
+    c->fd = client->clientSocket;
+    pthread_mutex_lock(&mem_lock);
+    c->next = conns;
+    if (conns != NULL)
+        conns->prev = c;
+    conns = c;
+    numconns++;
+    client->mem = c;
+    pthread_mutex_unlock(&mem_lock);
+}
+
+void mem_close(person *client){
+    mem_conn *c;
+
+    pthread_mutex_lock(&mem_lock);
+    if ((c = client->mem) != NULL) {
+        if (c->prev != NULL)
+            c->prev->next = c->next;
+        else
+            conns = c->next;
+        if (c->next != NULL)
+            c->next->prev = c->prev;
+        numconns--;
+        client->mem = NULL;
+    }
+    pthread_mutex_unlock(&mem_lock);
+    free(c);
+}
+
+void mem_charge(person *client, mem_kind kind, long bytes){
+    mem_conn *c = client->mem;
+
+    if (c != NULL)
+        __atomic_add_fetch(&(c->bytes[kind]), (size_t) bytes, __ATOMIC_RELAXED);
+}
+
+static size_t conn_total(mem_conn *c){
+    size_t total = 0;
+    int kind;
+
+    for (kind = 0; kind < MEM_NUM_KINDS; kind++)
+        total += __atomic_load_n(&(c->bytes[kind]), __ATOMIC_RELAXED);
+    return total;
+}
+
+void mem_backoff(person *client){
+    struct timespec wait = { 0, MEM_BACKOFF * 1000000L };
+    size_t limit = __atomic_load_n(&share, __ATOMIC_RELAXED);
+
+    //client->mem only goes away in mem_close, on client's own thread
+    if (limit != 0 && client->mem != NULL && conn_total(client->mem) > limit)
+        nanosleep(&wait, NULL);
+}
+
+//refreshes every sendq and adds up what connections not already evicted hold.
+//call with mem_lock held
+static size_t sample(void){
+    size_t total = 0;
+    mem_conn *c;
+    int queued;
+
+    for (c = conns; c != NULL; c = c->next) {
+        if (c->evicted)
+            continue;
+        if (ioctl(c->fd, SIOCOUTQ, &queued) == 0)
+            __atomic_store_n(&(c->bytes[MEM_SENDQ]), (size_t) queued, __ATOMIC_RELAXED);
+        total += conn_total(c);
+    }
+    return total;
+}
+
+static int bigger_first(const void *a, const void *b){
+    size_t ta = conn_total(*(mem_conn **)a), tb = conn_total(*(mem_conn **)b);
+
+    return ta < tb ? 1 : ta > tb ? -1 : 0;
+}
+
+//returns the connections not yet evicted, biggest first, and how many in *n.
+//call with mem_lock held
+static mem_conn **biggest(int *n){
+    mem_conn **sorted = malloc((numconns + 1) * sizeof(mem_conn *));
+    mem_conn *c;
+
+    *n = 0;
+    for (c = conns; c != NULL; c = c->next)
+        if (!c->evicted)
+            sorted[(*n)++] = c;
+    qsort(sorted, *n, sizeof(mem_conn *), bigger_first);
+    return sorted;
+}
+
+//shuts down the biggest connections until total is at most target. their
+//threads see the shutdown and tear them down. call with mem_lock held, which
+//keeps their sockets open until we're done
+static void evict(size_t total, size_t target){
+    struct linger drop = { 1, 0 };
+    mem_conn **sorted;
+    size_t held;
+    int i, n;
+
+    sorted = biggest(&n);
+    for (i = 0; i < n && total > target; i++) {
+        held = conn_total(sorted[i]);
+        //closing the socket then resets the connection instead of trying to
+        //deliver its sendq
+        setsockopt(sorted[i]->fd, SOL_SOCKET, SO_LINGER, &drop, sizeof(drop));
+        shutdown(sorted[i]->fd, SHUT_RDWR);
+        sorted[i]->evicted = 1;
+        log_event(LOG_EVICT, sorted[i]->fd, held, 0, sorted[i]->client->nick);
+        total -= held;
+    }
+    free(sorted);
+}
+
+static void *monitor(void *args){
+    struct timespec interval = { 0, MEM_INTERVAL * 1000000L };
+    size_t budget, total;
+    int since = -1;         //ms spent over the soft limit, -1 while under it
+
+    while (1) {
+        nanosleep(&interval, NULL);
+        rcu_read_lock();
+        budget = config_get()->mem_budget;
+        rcu_read_unlock();
+
+        pthread_mutex_lock(&mem_lock);
+        total = sample() + history_total();
+        if (budget == 0 || total <= budget / 4 * 3) {
+            __atomic_store_n(&share, 0, __ATOMIC_RELAXED);
+            since = -1;
+        }
+        else {
+            if (since == -1) {
+                log_event(LOG_MEM_PRESSURE, -1, total, budget, NULL);
+                since = 0;
+            }
+            else
+                since += MEM_INTERVAL;
+            //an even split of the soft limit, and never 0 so pressure stays on
+            __atomic_store_n(&share, budget / 4 * 3 / (numconns + 1) + 1, __ATOMIC_RELAXED);
+            if (total > budget || since >= MEM_GRACE) {
+                evict(total, budget / 4 * 3);
+                since = 0;
+            }
+        }
+        pthread_mutex_unlock(&mem_lock);
+    }
+    return NULL;
+}
+
+void mem_start(void){
+    pthread_t tid;
+
+    if (pthread_create(&tid, NULL, monitor, NULL) != 0) {
+        perror("Could not create memory monitor thread");
+        exit(-1);
+    }
+    pthread_detach(tid);
+}
+
+void mem_report(prof_emitter emit, void *arg){
+    mem_line top[MEM_REPORT_TOP];
+    char line[256];
+    size_t total, budget;
+    size_t limit = __atomic_load_n(&share, __ATOMIC_RELAXED);
+    mem_conn **sorted;
+    int i, n, len, kind, connections;
+
+    rcu_read_lock();
+    budget = config_get()->mem_budget;
+    rcu_read_unlock();
+
+    //copy out what's needed, so nothing is sent with mem_lock held
+    pthread_mutex_lock(&mem_lock);
+    total = sample();
+    connections = numconns;
+    sorted = biggest(&n);
+    if (n > MEM_REPORT_TOP)
+        n = MEM_REPORT_TOP;
+    for (i = 0; i < n; i++) {
+        snprintf(top[i].nick, MAXMSG, "%s", sorted[i]->client->nick[0] ? sorted[i]->client->nick : "*");
+        top[i].fd = sorted[i]->fd;
+        for (kind = 0; kind < MEM_NUM_KINDS; kind++)
+            top[i].bytes[kind] = __atomic_load_n(&(sorted[i]->bytes[kind]), __ATOMIC_RELAXED);
+    }
+    free(sorted);
+    pthread_mutex_unlock(&mem_lock);
+
+    snprintf(line, sizeof(line), "mem total=%zu budget=%zu connections=%d history=%zu pressure=%d share=%zu",
+             total + history_total(), budget, connections, history_total(),
+             limit != 0, limit);
+    emit(line, arg);
+    for (i = 0; i < n; i++) {
+        len = snprintf(line, sizeof(line), "mem %.32s fd=%d", top[i].nick, top[i].fd);
+        for (kind = 0; kind < MEM_NUM_KINDS; kind++)
+            len += snprintf(line + len, sizeof(line) - len, " %s=%zu", kind_names[kind], top[i].bytes[kind]);
+        emit(line, arg);
+    }
+}
@@ -0,0 +1,64 @@
+/*
+ *
+ *  CMSC 23300 / 33300 - Networks and Distributed Systems
+ *
+ *  per-connection memory accounting for chirc project
+ *
+ *  sachs_sandler
+ *
+ */
+
+/*
+ * Every connection is charged for the memory it holds, in three categories:
+ *
+ *   sendq     bytes the kernel has yet to send it (sampled, not counted)
+ *   channels  its channel memberships
+ *   outbuf    replies queued up for it while they are being sent
+ *
+ * Channel history belongs to channels rather than connections, and is counted
+ * for the server as a whole (see history.h).
+ *
+ * A monitor thread adds everything up ten times a second. Once the total
+ * passes three quarters of mem_budget, clients holding more than an even
+ * share of that are read from a little more slowly, so they stop adding to
+ * what they hold while they catch up; everyone else is left alone. If that
+ * hasn't brought the total down within a second, or it passes mem_budget
+ * itself, the connections holding the most are shut down, biggest first,
+ * until it is back under three quarters. A connection
+ * that never reads ends up holding the most, since everything sent to it
+ * stays in its sendq.
+ *
+ * STATS z reports the totals and the biggest connections.
+ */
+
+#ifndef MEM_H_
+#define MEM_H_
+
+#include "prof.h"
+
+typedef enum {
+    MEM_SENDQ,
+    MEM_CHANNELS,
+    MEM_OUTBUF,
+    MEM_NUM_KINDS
+} mem_kind;
+
+//starts the monitor thread. call once the configuration is loaded
+void mem_start(void);
+
+//starts charging client, which must have its socket, and stops. mem_close
+//has to come before the socket is closed
+void mem_open(person *client);
+void mem_close(person *client);
+
+//adds bytes (which may be negative) to what client is charged for kind
+void mem_charge(person *client, mem_kind kind, long bytes);
+
+//waits a little before client's next read while memory is short and client
+//holds more than its share. call on client's own thread
+void mem_backoff(person *client);
+
+//totals, then one line for each of the biggest connections
+void mem_report(prof_emitter emit, void *arg);
+
+#endif /* MEM_H_ */
@@ -21,6 +21,12 @@
 #include "reply.h"
 #include "simclist.h"
 #include "ircstructs.h"
+#include "prof.h"
+#include "trace.h"
+#include "capture.h"
+#include "upgrade.h"
+#include "log.h"
+#include "mem.h"
 
 #define MAXMSG 512
 
@@ -45,36 +51,68 @@ void parse_message(int clientSocket, chirc_server *server)
     int truncated = 0;        // used to track occurence of the end of a truncated message
     int CRLFsplit = 0;        // tracks the \r\n in difference message receptions
     
+    client_input saved;       // partial line kept while parked for an upgrade
+    person *clientpt;
+    
     memset(msg, '\0', MAXMSG - 1);
-    el_indicator *seek_arg = malloc(sizeof(el_indicator));
+    el_indicator seek_arg;
+    seek_arg.field = FD;
+    seek_arg.fd = clientSocket;
+    
+    //pick up where the process we were upgraded from left off
+    chirc_lock(&lock);
+    clientpt = (person *)list_seek(server->userlist, &seek_arg);
+    chirc_unlock(&lock);
+    if (clientpt->input != NULL) {
+        memcpy(msg, clientpt->input->msg, MAXMSG - 1);
+        msglength = clientpt->input->msglength;
+        truncated = clientpt->input->truncated;
+        CRLFsplit = clientpt->input->CRLFsplit;
+        clientpt->input = NULL;
+    }
     
 	while (1) {
         msgstart = buf;
         
         
-        seek_arg->field = FD;
-        seek_arg->fd = clientSocket;
+        seek_arg.field = FD;
+        seek_arg.fd = clientSocket;
         
-        pthread_mutex_lock(&lock);
-        person *clientpt = (person *)list_seek(server->userlist, seek_arg);
-        pthread_mutex_unlock(&lock);
+        chirc_lock(&lock);
+        clientpt = (person *)list_seek(server->userlist, &seek_arg);
+        chirc_unlock(&lock);
         
+        if (upgrade_pending()) {
+            memcpy(saved.msg, msg, MAXMSG - 1);
+            saved.msglength = msglength;
+            saved.truncated = truncated;
+            saved.CRLFsplit = CRLFsplit;
+            clientpt->input = &saved;
+            upgrade_park();
+            clientpt->input = NULL;
+            continue;
+        }
+        
+        mem_backoff(clientpt);
         if ((nbytes = recv(clientSocket, buf, MAXMSG, 0)) == -1) {
-            perror("Socket recv() failed");
+            if (errno == EINTR)     //woken to park for an upgrade
+                continue;
+            log_event(LOG_RECV_ERROR, clientSocket, errno, 0, NULL);
             user_exit(server, clientpt);
         }
         
         if(nbytes == 0){
-            printf("Connection closed by client\n");
+            log_event(LOG_EOF, clientSocket, 0, 0, NULL);
             user_exit(server, clientpt);
         }
+        capture_data(clientSocket, buf, nbytes);
         buf[nbytes] = '\0';
         if(CRLFsplit){      // procedure to deal with \r\n split across messages
             CRLFsplit = 0;
             if (buf[0] == '\n') {
                 msgstart = buf + 1;
                 if (msglength > 0) {
-                    msg[msglength - 2] = '\0';
+                    msg[msglength - 1] = '\0';     //drop the \r that ended the last read
                     parse(msg, clientSocket, server);
                     memset(msg, '\0', MAXMSG - 1);
                     msglength = 0;
@@ -133,14 +171,16 @@ void parse(char *msg, int clientSocket, chirc_server *server) {
     int paramcounter = 0;
     int paramnum = 0;
     int i;
-    el_indicator *seek_arg = malloc(sizeof(el_indicator));
+    el_indicator seek_arg;
+    
+    seek_arg.field = FD;
+    seek_arg.fd = clientSocket;
     
-    seek_arg->field = FD;
-    seek_arg->fd = clientSocket;
+    chirc_lock(&lock);
+    person *clientpt = (person *)list_seek(server->userlist, &seek_arg);
+    chirc_unlock(&lock);
     
-    pthread_mutex_lock(&lock);
-    person *clientpt = (person *)list_seek(server->userlist, seek_arg);
-    pthread_mutex_unlock(&lock);
+    CHIRC_TRACE2(message, clientSocket, strlen(msg));
     
     //start by setting every param to NULL
     for(i = 0; i < MAXPARAMS; i++)
@@ -167,7 +207,6 @@ void parse(char *msg, int clientSocket, chirc_server *server) {
     }
 
     handle_chirc_message(server, clientpt, params);
-    free(seek_arg);
     
 }
 
@@ -0,0 +1,182 @@
+/*
+ *
+ *  CMSC 23300 / 33300 - Networks and Distributed Systems
+ *
+ *  per-thread object pools for chirc project
+ *
+ *  sachs_sandler
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include "simclist.h"
+#include "ircstructs.h"
+#include "pool.h"
+#include "actor.h"
+#include "affinity.h"
+
+#define POOL_SLAB (64 * 1024)
+
+//sits in front of every object
+typedef struct pool_obj {
+    struct pool_cache *owner;   //the cache whose slab it came from, for good
+    struct pool_obj *next;      //while it's free
+} pool_obj;
+
+//one per thread, handed on to a new thread when its thread exits
+typedef struct pool_cache {
+    pool_obj *free[POOL_NUM_KINDS];
+    pool_obj *remote[POOL_NUM_KINDS];       //freed by other threads, pushed with CAS
+    unsigned long allocs[POOL_NUM_KINDS];   //only changed by the thread using the cache,
+    unsigned long frees[POOL_NUM_KINDS];    //but read by pool_report
+    size_t slab_bytes[POOL_NUM_KINDS];
+    int in_use;
+    int node;               //of the thread that made it, -1 if that wasn't pinned
+    struct pool_cache *next;
+} pool_cache;
+
+static const char *kind_names[POOL_NUM_KINDS] = { "mychan", "outbuf", "actor_job" };
+static const size_t kind_sizes[POOL_NUM_KINDS] = { sizeof(mychan), OUTBUF_CHUNK, sizeof(actor_job) };
+
+static pool_cache *caches = NULL;
+static pthread_key_t cache_key;
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static __thread pool_cache *self = NULL;
+
+//runs when a thread exits
+static void thread_done(void *arg){
+    __atomic_store_n(&(((pool_cache *)arg)->in_use), 0, __ATOMIC_RELEASE);
+}
+
+static void make_key(void){
+    if (pthread_key_create(&cache_key, thread_done) != 0) {
+        perror("Could not create pool thread key");
+        exit(-1);
+    }
+}
+
+//a pinned thread only takes over a cache from its own node, whose slabs are
+//on that node's memory (see affinity.h)
+static pool_cache *register_thread(void){
+    pool_cache *c;
+    int node = affinity_node();
+
+    pthread_once(&key_once, make_key);
+    for (c = __atomic_load_n(&caches, __ATOMIC_ACQUIRE); c != NULL; c = c->next)
+        if ((node == -1 || c->node == node) && !__atomic_load_n(&(c->in_use), __ATOMIC_RELAXED)
+            && __sync_bool_compare_and_swap(&(c->in_use), 0, 1))
+            break;
+    if (c == NULL) {
+        c = calloc(1, sizeof(pool_cache));
+        c->in_use = 1;
+        c->node = node;
+        do {
+            c->next = caches;
+        } while (!__sync_bool_compare_and_swap(&caches, c->next, c));
+    }
+    pthread_setspecific(cache_key, c);
+    return c;
+}
+
+static size_t stride(pool_kind kind){
+    return (sizeof(pool_obj) + kind_sizes[kind] + 15) & ~(size_t) 15;
+}
+
+//carves a new slab into free objects
+static void refill(pool_cache *c, pool_kind kind){
+    size_t n = POOL_SLAB / stride(kind), i;
+    char *slab;
+    pool_obj *obj;
+
+    if (n == 0)
+        n = 1;
+    slab = malloc(n * stride(kind));
+    for (i = 0; i < n; i++) {
+        obj = (pool_obj *)(slab + i * stride(kind));
+        obj->owner = c;
+        obj->next = c->free[kind];
+        c->free[kind] = obj;
+    }
+    __atomic_store_n(&(c->slab_bytes[kind]), c->slab_bytes[kind] + n * stride(kind), __ATOMIC_RELAXED);
+}
+
+void *pool_alloc(pool_kind kind){
+    pool_obj *obj;
+
+    if (self == NULL)
+        self = register_thread();
+    if (self->free[kind] == NULL)
+        self->free[kind] = __atomic_exchange_n(&(self->remote[kind]), NULL, __ATOMIC_ACQUIRE);
+    if (self->free[kind] == NULL)
+        refill(self, kind);
+    obj = self->free[kind];
+    self->free[kind] = obj->next;
+    __atomic_store_n(&(self->allocs[kind]), self->allocs[kind] + 1, __ATOMIC_RELAXED);
+    return obj + 1;
+}
+
+void pool_free(pool_kind kind, void *p){
+    pool_obj *obj = (pool_obj *)p - 1;
+    pool_cache *owner;
+
+    if (p == NULL)
+        return;
+    if (self == NULL)
+        self = register_thread();
+    owner = obj->owner;
+    if (owner == self) {
+        obj->next = self->free[kind];
+        self->free[kind] = obj;
+    }
+    else {
+        do {
+            obj->next = __atomic_load_n(&(owner->remote[kind]), __ATOMIC_RELAXED);
+        } while (!__sync_bool_compare_and_swap(&(owner->remote[kind]), obj->next, obj));
+    }
+    __atomic_store_n(&(self->frees[kind]), self->frees[kind] + 1, __ATOMIC_RELAXED);
+}
+
+//an object can be counted as freed before the cache it came from counts it as
+//handed out, so the sum is only exact when nothing is happening
+static void totals(pool_kind kind, unsigned long *allocs, unsigned long *frees, size_t *bytes){
+    pool_cache *c;
+
+    *allocs = *frees = *bytes = 0;
+    for (c = __atomic_load_n(&caches, __ATOMIC_ACQUIRE); c != NULL; c = c->next) {
+        *allocs += __atomic_load_n(&(c->allocs[kind]), __ATOMIC_RELAXED);
+        *frees += __atomic_load_n(&(c->frees[kind]), __ATOMIC_RELAXED);
+        *bytes += __atomic_load_n(&(c->slab_bytes[kind]), __ATOMIC_RELAXED);
+    }
+}
+
+long pool_live(pool_kind kind){
+    unsigned long allocs, frees;
+    size_t bytes;
+
+    totals(kind, &allocs, &frees, &bytes);
+    return (long) (allocs - frees);
+}
+
+void pool_report(prof_emitter emit, void *arg){
+    char line[128];
+    unsigned long allocs, frees;
+    size_t bytes;
+    pool_cache *c;
+    int kind, threads = 0, idle = 0;
+
+    for (kind = 0; kind < POOL_NUM_KINDS; kind++) {
+        totals(kind, &allocs, &frees, &bytes);
+        snprintf(line, sizeof(line), "pool %s live=%ld allocs=%lu slabs=%zukB",
+                 kind_names[kind], (long) (allocs - frees), allocs, bytes / 1024);
+        emit(line, arg);
+    }
+    for (c = __atomic_load_n(&caches, __ATOMIC_ACQUIRE); c != NULL; c = c->next) {
+        threads++;
+        if (!__atomic_load_n(&(c->in_use), __ATOMIC_RELAXED))
+            idle++;
+    }
+    snprintf(line, sizeof(line), "pool caches=%d idle=%d", threads, idle);
+    emit(line, arg);
+}
@@ -0,0 +1,51 @@
+/*
+ *
+ *  CMSC 23300 / 33300 - Networks and Distributed Systems
+ *
+ *  per-thread object pools for chirc project
+ *
+ *  sachs_sandler
+ *
+ */
+
+/*
+ * Objects that are made and thrown away all the time (channel memberships, the
+ * first chunk of every outbuf and the jobs posted to channel actors) come from pools instead of malloc. Every
+ * thread has its own cache of free objects of each kind, so pool_alloc and
+ * pool_free by the thread that owns an object take no lock. Freeing an object
+ * owned by another thread (a KILL freeing its victim's memberships) pushes it
+ * onto the owner's remote list, which the owner takes back the next time its
+ * own list runs dry. An empty cache is refilled with a whole slab at once.
+ *
+ * Slabs are never given back. When a thread exits its cache, and everything in
+ * it, goes to the next thread that starts (on the same NUMA node, if threads
+ * are pinned to one: see affinity.h).
+ *
+ * Every cache counts what it handed out and took back, so the number of
+ * objects of each kind still in use (pool_report, STATS m) shows leaks.
+ */
+
+#ifndef POOL_H_
+#define POOL_H_
+
+#include "prof.h"
+
+#define OUTBUF_CHUNK 4096
+
+typedef enum {
+    POOL_MYCHAN,    //mychan
+    POOL_OUTBUF,    //OUTBUF_CHUNK bytes
+    POOL_ACTOR_JOB, //actor_job (see actor.h)
+    POOL_NUM_KINDS
+} pool_kind;
+
+void *pool_alloc(pool_kind kind);
+void pool_free(pool_kind kind, void *obj);
+
+//objects of kind in use right now
+long pool_live(pool_kind kind);
+
+//one line per kind: in use, handed out, slab bytes
+void pool_report(prof_emitter emit, void *arg);
+
+#endif /* POOL_H_ */
@@ -0,0 +1,175 @@
+/*
+ *
+ *  CMSC 23300 / 33300 - Networks and Distributed Systems
+ *
+ *  lock and handler profiling for chirc project
+ *
+ *  sachs_sandler
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include "prof.h"
+
+#define PROFLINE 200
+
+uint64_t prof_now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#ifdef CHIRC_PROFILE
+
+#define MAXHELD     16  //how many locks one thread can hold at once and still be tracked
+#define NUMBUCKETS  21  //bucket i counts calls taking less than 2^i microseconds, last one is everything else
+#define MAXCMDS     64
+
+//a lock this thread currently holds
+typedef struct {
+    pthread_mutex_t *m;
+    prof_site *site;
+    uint64_t acquired;
+} held_lock;
+
+typedef struct {
+    const char *name;
+    unsigned long long calls;
+    unsigned long long total_ns;
+    unsigned long long max_ns;
+    unsigned long long buckets[NUMBUCKETS];
+} prof_hist;
+
+static prof_site *sites = NULL;
+static prof_hist handlers[MAXCMDS];
+static prof_hist sends;
+static unsigned long long send_bytes;
+
+static __thread held_lock held[MAXHELD];
+static __thread int numheld = 0;
+
+static void update_max(unsigned long long *max, unsigned long long val){
+    unsigned long long old = *max;
+    while (val > old && !__sync_bool_compare_and_swap(max, old, val))
+        old = *max;
+}
+
+static void register_site(prof_site *site){
+    prof_site *head;
+    if (!__sync_bool_compare_and_swap(&(site->registered), 0, 1))
+        return;
+    do {
+        head = sites;
+        site->next = head;
+    } while (!__sync_bool_compare_and_swap(&sites, head, site));
+}
+
+static void hist_add(prof_hist *h, uint64_t ns){
+    int b = 0;
+    uint64_t us = ns / 1000;
+    while (b < NUMBUCKETS - 1 && us >= (1ULL << b))
+        b++;
+    __sync_fetch_and_add(&(h->calls), 1);
+    __sync_fetch_and_add(&(h->total_ns), ns);
+    __sync_fetch_and_add(&(h->buckets[b]), 1);
+    update_max(&(h->max_ns), ns);
+}
+
+void prof_lock(prof_site *site, pthread_mutex_t *m){
+    uint64_t start, acquired;
+
+    register_site(site);
+    start = prof_now();
+    if (pthread_mutex_trylock(m) != 0) {
+        __sync_fetch_and_add(&(site->contended), 1);
+        pthread_mutex_lock(m);
+    }
+    acquired = prof_now();
+
+    __sync_fetch_and_add(&(site->acquires), 1);
+    __sync_fetch_and_add(&(site->wait_ns), acquired - start);
+    update_max(&(site->wait_max_ns), acquired - start);
+
+    if (numheld < MAXHELD) {
+        held[numheld].m = m;
+        held[numheld].site = site;
+        held[numheld].acquired = acquired;
+        numheld++;
+    }
+}
+
+void prof_unlock(pthread_mutex_t *m){
+    int i;
+    uint64_t hold;
+
+    //locks are not always released in the order they were taken, so search from the top
+    for (i = numheld - 1; i >= 0; i--) {
+        if (held[i].m == m) {
+            hold = prof_now() - held[i].acquired;
+            __sync_fetch_and_add(&(held[i].site->hold_ns), hold);
+            update_max(&(held[i].site->hold_max_ns), hold);
+            memmove(&held[i], &held[i + 1], (numheld - i - 1) * sizeof(held_lock));
+            numheld--;
+            break;
+        }
+    }
+    pthread_mutex_unlock(m);
+}
+
+void prof_handler(int cmd, const char *name, uint64_t ns){
+    if (cmd < 0 || cmd >= MAXCMDS)
+        return;
+    handlers[cmd].name = name;
+    hist_add(&handlers[cmd], ns);
+}
+
+void prof_send(size_t len, uint64_t ns){
+    __sync_fetch_and_add(&send_bytes, len);
+    hist_add(&sends, ns);
+}
+
+static void report_hist(prof_emitter emit, void *arg, const char *what, prof_hist *h){
+    char line[PROFLINE];
+    int i, n;
+    unsigned long long calls = h->calls;
+
+    n = snprintf(line, PROFLINE, "%s n=%llu avg=%lluus max=%lluus hist=", what, calls,
+                 calls ? h->total_ns / calls / 1000 : 0, h->max_ns / 1000);
+    for (i = 0; i < NUMBUCKETS && n < PROFLINE; i++)
+        n += snprintf(line + n, PROFLINE - n, i ? "/%llu" : "%llu", h->buckets[i]);
+    emit(line, arg);
+}
+
+void prof_report(prof_emitter emit, void *arg){
+    char line[PROFLINE];
+    char what[PROFLINE];
+    prof_site *site;
+    int i;
+
+    for (site = sites; site != NULL; site = site->next) {
+        snprintf(line, PROFLINE, "lock %s %s:%d acq=%llu cont=%llu wait=%lluus wmax=%lluus hold=%lluus hmax=%lluus",
+                 site->what, site->file, site->line, site->acquires, site->contended,
+                 site->wait_ns / 1000, site->wait_max_ns / 1000,
+                 site->hold_ns / 1000, site->hold_max_ns / 1000);
+        emit(line, arg);
+    }
+    for (i = 0; i < MAXCMDS; i++) {
+        if (handlers[i].calls == 0)
+            continue;
+        snprintf(what, PROFLINE, "cmd %s", handlers[i].name);
+        report_hist(emit, arg, what, &handlers[i]);
+    }
+    snprintf(what, PROFLINE, "send bytes=%llu", send_bytes);
+    report_hist(emit, arg, what, &sends);
+}
+
+#else
+
+void prof_report(prof_emitter emit, void *arg){
+    emit("profiling not compiled in (build with PROFILE=1)", arg);
+}
+
+#endif /* CHIRC_PROFILE */
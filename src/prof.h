@@ -0,0 +1,70 @@
+/*
+ *
+ *  CMSC 23300 / 33300 - Networks and Distributed Systems
+ *
+ *  lock and handler profiling for chirc project
+ *
+ *  sachs_sandler
+ *
+ */
+
+#ifndef PROF_H_
+#define PROF_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stddef.h>
+
+//callback used to print a single line of the profiling report
+typedef void (*prof_emitter)(const char *line, void *arg);
+
+//monotonic clock in nanoseconds
+uint64_t prof_now(void);
+
+//prints every line of the report through emit (works even when profiling is compiled out)
+void prof_report(prof_emitter emit, void *arg);
+
+#ifdef CHIRC_PROFILE
+
+//one per call site of chirc_lock, registered the first time the site is hit
+typedef struct prof_site {
+    const char *file;
+    int line;
+    const char *what;                   //text of the mutex expression
+    unsigned long long acquires;
+    unsigned long long contended;       //acquisitions that had to block
+    unsigned long long wait_ns;
+    unsigned long long wait_max_ns;
+    unsigned long long hold_ns;
+    unsigned long long hold_max_ns;
+    int registered;
+    struct prof_site *next;
+} prof_site;
+
+void prof_lock(prof_site *site, pthread_mutex_t *m);
+void prof_unlock(pthread_mutex_t *m);
+void prof_handler(int cmd, const char *name, uint64_t ns);
+void prof_send(size_t len, uint64_t ns);
+
+#define chirc_lock(m) do {                                              \
+        static prof_site prof_site_ = { __FILE__, __LINE__, #m };       \
+        prof_lock(&prof_site_, (m));                                    \
+    } while (0)
+#define chirc_unlock(m)                 prof_unlock(m)
+
+#define PROF_START(t)                   uint64_t t = prof_now()
+#define PROF_HANDLER(cmd, name, t)      prof_handler((cmd), (name), prof_now() - (t))
+#define PROF_SEND(len, t)               prof_send((len), prof_now() - (t))
+
+#else
+
+#define chirc_lock(m)                   pthread_mutex_lock(m)
+#define chirc_unlock(m)                 pthread_mutex_unlock(m)
+
+#define PROF_START(t)                   do { } while (0)
+#define PROF_HANDLER(cmd, name, t)      do { } while (0)
+#define PROF_SEND(len, t)               do { } while (0)
+
+#endif /* CHIRC_PROFILE */
+
+#endif /* PROF_H_ */
@@ -0,0 +1,133 @@
+/*
+ *
+ *  CMSC 23300 / 33300 - Networks and Distributed Systems
+ *
+ *  epoch-based read-copy-update for chirc project
+ *
+ *  sachs_sandler
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "rcu.h"
+#include "prof.h"
+
+//one per thread that has ever read under RCU; records are reused, never freed
+typedef struct rcu_thread {
+    unsigned long epoch;        //global epoch seen when the read section began, 0 outside one
+    int nesting;
+    int in_use;
+    struct rcu_thread *next;
+} rcu_thread;
+
+typedef struct retired {
+    void *p;
+    void (*free_fn)(void *);
+    unsigned long epoch;        //global epoch when it was retired
+    struct retired *next;
+} retired;
+
+static unsigned long global_epoch = 1;
+static rcu_thread *threads = NULL;
+static retired *retired_list = NULL;    //protected by retire_lock
+static pthread_mutex_t retire_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t thread_key;
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static __thread rcu_thread *self = NULL;
+
+//runs when a thread exits, so its record can't hold back the epoch
+static void thread_done(void *arg){
+    rcu_thread *t = (rcu_thread *)arg;
+    
+    __atomic_store_n(&(t->epoch), 0, __ATOMIC_RELEASE);
+    t->nesting = 0;
+    __atomic_store_n(&(t->in_use), 0, __ATOMIC_RELEASE);
+}
+
+static void make_key(void){
+    if (pthread_key_create(&thread_key, thread_done) != 0) {
+        perror("Could not create RCU thread key");
+        exit(-1);
+    }
+}
+
+static rcu_thread *register_thread(void){
+    rcu_thread *t;
+    
+    pthread_once(&key_once, make_key);
+    for (t = __atomic_load_n(&threads, __ATOMIC_ACQUIRE); t != NULL; t = t->next)
+        if (!__atomic_load_n(&(t->in_use), __ATOMIC_RELAXED) && __sync_bool_compare_and_swap(&(t->in_use), 0, 1))
+            break;
+    if (t == NULL) {
+        t = calloc(1, sizeof(rcu_thread));
+        t->in_use = 1;
+        do {
+            t->next = threads;
+        } while (!__sync_bool_compare_and_swap(&threads, t->next, t));
+    }
+    pthread_setspecific(thread_key, t);
+    return t;
+}
+
+void rcu_read_lock(void){
+    if (self == NULL)
+        self = register_thread();
+    if (self->nesting++ == 0) {
+        __atomic_store_n(&(self->epoch), __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE), __ATOMIC_SEQ_CST);
+        __sync_synchronize();
+    }
+}
+
+void rcu_read_unlock(void){
+    if (--(self->nesting) == 0)
+        __atomic_store_n(&(self->epoch), 0, __ATOMIC_RELEASE);
+}
+
+//moves the epoch forward if every reader has caught up with it. call with retire_lock held
+static void try_advance(void){
+    unsigned long e = global_epoch, seen;
+    rcu_thread *t;
+    
+    __sync_synchronize();
+    for (t = __atomic_load_n(&threads, __ATOMIC_ACQUIRE); t != NULL; t = t->next) {
+        seen = __atomic_load_n(&(t->epoch), __ATOMIC_ACQUIRE);
+        if (seen != 0 && seen != e)
+            return;
+    }
+    __atomic_store_n(&global_epoch, e + 1, __ATOMIC_RELEASE);
+}
+
+void rcu_retire(void *p, void (*free_fn)(void *)){
+    retired *r = malloc(sizeof(retired));
+    retired **link, *dead = NULL;
+    
+    r->p = p;
+    r->free_fn = free_fn;
+    
+    chirc_lock(&retire_lock);
+    r->epoch = global_epoch;
+    r->next = retired_list;
+    retired_list = r;
+    try_advance();
+    //a reader that could see r started no later than r->epoch, so two advances later it is gone
+    link = &retired_list;
+    while (*link != NULL) {
+        r = *link;
+        if (r->epoch + 2 <= global_epoch) {
+            *link = r->next;
+            r->next = dead;
+            dead = r;
+        }
+        else
+            link = &(r->next);
+    }
+    chirc_unlock(&retire_lock);
+    
+    while (dead != NULL) {
+        r = dead->next;
+        dead->free_fn(dead->p);
+        free(dead);
+        dead = r;
+    }
+}
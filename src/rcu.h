@@ -0,0 +1,35 @@
+/*
+ *
+ *  CMSC 23300 / 33300 - Networks and Distributed Systems
+ *
+ *  epoch-based read-copy-update for chirc project
+ *
+ *  sachs_sandler
+ *
+ */
+
+/*
+ * Data published through an RCU pointer is never changed in place. Readers
+ * bracket their use of it with rcu_read_lock/rcu_read_unlock, which take no
+ * locks and never block. A writer (serialized by whatever lock protects the
+ * pointer) copies the current version, changes the copy, publishes it with
+ * rcu_assign and hands the old version to rcu_retire. Retired versions are
+ * freed two epochs later, once no reader can still be looking at them.
+ *
+ * Read sections must be short and must not block, since every retired version
+ * waits for them.
+ */
+
+#ifndef RCU_H_
+#define RCU_H_
+
+#define rcu_dereference(p)      __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#define rcu_assign(p, v)        __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+
+void rcu_read_lock(void);
+void rcu_read_unlock(void);
+
+//frees p with free_fn once every reader that might have seen it is done
+void rcu_retire(void *p, void (*free_fn)(void *));
+
+#endif /* RCU_H_ */
@@ -0,0 +1,345 @@
+/*
+ *
+ *  CMSC 23300 / 33300 - Networks and Distributed Systems
+ *
+ *  chirc-replay: drives a chirc server with traffic recorded by chirc -c
+ *
+ *  sachs_sandler
+ *
+ */
+
+/*
+ * usage: chirc-replay -f capture [-s host] [-p port] [-t scale | -m]
+ *                     [-x chirc] [-o outdir] [-e expectdir] [-g grace_ms]
+ *
+ *   -t scale   play back scale times faster than recorded (default 1)
+ *   -m         play back as fast as possible
+ *   -x chirc   start a fresh server from this binary instead of using a running one
+ *   -o outdir  write what the server sent on each connection to outdir/conn-N.log
+ *   -e expect  compare outdir against the logs of an earlier run; exit 1 on a mismatch
+ *
+ * Prints one summary line of key=value pairs when done.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include "capture.h"
+
+#define MAXLINE 1024
+
+typedef struct {
+    capture_record rec;
+    char *data;
+} event;
+
+typedef struct {
+    int fd;                 //-1 when not connected
+    FILE *out;              //transcript of what the server sent
+    unsigned long long sent;
+    unsigned long long rcvd;
+} replay_conn;
+
+static event *events;
+static int numevents;
+static replay_conn *conns;
+static uint32_t numconns;
+static double lastrcvd;             //when the server last sent anything
+
+static double now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage(void){
+    fprintf(stderr, "usage: chirc-replay -f capture [-s host] [-p port] [-t scale | -m] "
+                    "[-x chirc] [-o outdir] [-e expectdir] [-g grace_ms]\n");
+    exit(-1);
+}
+
+//read the whole capture into memory
+static int load_capture(const char *path){
+    FILE *fp;
+    char magic[sizeof(CAPTURE_MAGIC)];
+    capture_header hdr;
+    int size = 1024;
+
+    if ((fp = fopen(path, "rb")) == NULL) {
+        perror("Could not open capture file");
+        return -1;
+    }
+    if (fread(magic, strlen(CAPTURE_MAGIC), 1, fp) != 1 || memcmp(magic, CAPTURE_MAGIC, strlen(CAPTURE_MAGIC)) != 0
+        || fread(&hdr, sizeof(hdr), 1, fp) != 1 || hdr.version != CAPTURE_VERSION) {
+        fprintf(stderr, "%s is not a chirc capture file\n", path);
+        fclose(fp);
+        return -1;
+    }
+
+    events = malloc(size * sizeof(event));
+    numevents = 0;
+    while (fread(&(events[numevents].rec), sizeof(capture_record), 1, fp) == 1) {
+        event *ev = &events[numevents];
+        ev->data = NULL;
+        if (ev->rec.len) {
+            ev->data = malloc(ev->rec.len);
+            if (fread(ev->data, ev->rec.len, 1, fp) != 1) {
+                fprintf(stderr, "capture truncated after %d records\n", numevents);
+                free(ev->data);
+                break;
+            }
+        }
+        if (ev->rec.conn >= numconns)
+            numconns = ev->rec.conn + 1;
+        if (++numevents == size) {
+            size *= 2;
+            events = realloc(events, size * sizeof(event));
+        }
+    }
+    fclose(fp);
+    return 0;
+}
+
+static int connect_server(const char *host, const char *port){
+    struct addrinfo hints, *res, *p;
+    int fd = -1;
+
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &res) != 0)
+        return -1;
+    for (p = res; p != NULL; p = p->ai_next) {
+        if ((fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) == -1)
+            continue;
+        if (connect(fd, p->ai_addr, p->ai_addrlen) == 0)
+            break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+//start a fresh server and wait until it accepts connections
+static pid_t spawn_server(const char *chirc, const char *port){
+    pid_t pid;
+    int tries, fd;
+
+    if ((pid = fork()) == 0) {
+        execl(chirc, chirc, "-p", port, "-o", "replay", (char *)NULL);
+        perror("Could not exec chirc");
+        _exit(127);
+    }
+    for (tries = 0; tries < 50; tries++) {
+        usleep(100000);
+        if ((fd = connect_server("localhost", port)) != -1) {
+            close(fd);
+            return pid;
+        }
+    }
+    fprintf(stderr, "chirc did not start listening on port %s\n", port);
+    kill(pid, SIGTERM);
+    return -1;
+}
+
+//read whatever the server has sent, waiting at most timeout_ms. returns bytes read
+static int drain(int timeout_ms){
+    struct pollfd *pfds = malloc(numconns * sizeof(struct pollfd));
+    char buf[4096];
+    uint32_t i;
+    int n, total = 0;
+
+    for (i = 0; i < numconns; i++) {
+        pfds[i].fd = conns[i].fd;
+        pfds[i].events = POLLIN;
+    }
+    if (poll(pfds, numconns, timeout_ms) > 0) {
+        for (i = 0; i < numconns; i++) {
+            if (conns[i].fd == -1 || !(pfds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+            n = recv(conns[i].fd, buf, sizeof(buf), 0);
+            if (n <= 0) {
+                close(conns[i].fd);
+                conns[i].fd = -1;
+                continue;
+            }
+            conns[i].rcvd += n;
+            total += n;
+            lastrcvd = now();
+            if (conns[i].out)
+                fwrite(buf, n, 1, conns[i].out);
+        }
+    }
+    free(pfds);
+    return total;
+}
+
+static void play(event *ev, const char *host, const char *port, const char *outdir){
+    replay_conn *c = &conns[ev->rec.conn];
+    char path[MAXLINE];
+
+    switch (ev->rec.type) {
+        case CAP_CONNECT:
+            if ((c->fd = connect_server(host, port)) == -1)
+                fprintf(stderr, "conn %u: could not connect\n", ev->rec.conn);
+            if (outdir) {
+                snprintf(path, MAXLINE, "%s/conn-%u.log", outdir, ev->rec.conn);
+                c->out = fopen(path, "w");
+            }
+            break;
+        case CAP_DATA:
+            if (c->fd == -1)
+                break;
+            if (send(c->fd, ev->data, ev->rec.len, 0) == -1) {
+                perror("Socket send() failed");
+                close(c->fd);
+                c->fd = -1;
+                break;
+            }
+            c->sent += ev->rec.len;
+            break;
+        case CAP_CLOSE:
+            if (c->fd != -1) {
+                close(c->fd);
+                c->fd = -1;
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+//lines that legitimately differ between runs
+static int volatile_line(const char *line){
+    return strstr(line, " 003 ") != NULL;   //RPL_CREATED
+}
+
+//compare outdir with expectdir. returns the number of connections that differ
+static int compare(const char *outdir, const char *expectdir){
+    char path[MAXLINE], line1[MAXLINE], line2[MAXLINE];
+    FILE *a, *b;
+    uint32_t i;
+    int lineno, diffs = 0;
+    char *r1, *r2;
+
+    for (i = 1; i < numconns; i++) {
+        snprintf(path, MAXLINE, "%s/conn-%u.log", outdir, i);
+        a = fopen(path, "r");
+        snprintf(path, MAXLINE, "%s/conn-%u.log", expectdir, i);
+        b = fopen(path, "r");
+        if (a == NULL || b == NULL) {
+            if (a != b) {
+                printf("conn %u: transcript missing\n", i);
+                diffs++;
+            }
+            if (a) fclose(a);
+            if (b) fclose(b);
+            continue;
+        }
+        lineno = 0;
+        do {
+            do { r1 = fgets(line1, MAXLINE, a); } while (r1 && volatile_line(line1));
+            do { r2 = fgets(line2, MAXLINE, b); } while (r2 && volatile_line(line2));
+            lineno++;
+            if ((r1 == NULL) != (r2 == NULL) || (r1 && strcmp(line1, line2) != 0)) {
+                printf("conn %u: differs at line %d\n", i, lineno);
+                diffs++;
+                break;
+            }
+        } while (r1 != NULL);
+        fclose(a);
+        fclose(b);
+    }
+    return diffs;
+}
+
+int main(int argc, char *argv[])
+{
+    int opt, i, maxspeed = 0, grace = 1000, diffs = 0;
+    double scale = 1.0, start, due, left, elapsed;
+    char *capture = NULL, *host = "localhost", *port = "6667";
+    char *chirc = NULL, *outdir = NULL, *expectdir = NULL;
+    unsigned long long sent = 0, rcvd = 0;
+    pid_t server = -1;
+    uint32_t c;
+
+    while ((opt = getopt(argc, argv, "f:s:p:t:mx:o:e:g:")) != -1)
+        switch (opt)
+        {
+            case 'f': capture = optarg; break;
+            case 's': host = optarg; break;
+            case 'p': port = optarg; break;
+            case 't': scale = atof(optarg); break;
+            case 'm': maxspeed = 1; break;
+            case 'x': chirc = optarg; break;
+            case 'o': outdir = optarg; break;
+            case 'e': expectdir = optarg; break;
+            case 'g': grace = atoi(optarg); break;
+            default: usage();
+        }
+    if (capture == NULL || scale <= 0 || (expectdir && !outdir))
+        usage();
+
+    signal(SIGPIPE, SIG_IGN);
+    if (load_capture(capture) == -1)
+        exit(-1);
+    if (outdir)
+        mkdir(outdir, 0755);
+
+    conns = calloc(numconns, sizeof(replay_conn));
+    for (c = 0; c < numconns; c++)
+        conns[c].fd = -1;
+
+    if (chirc && (server = spawn_server(chirc, port)) == -1)
+        exit(-1);
+
+    start = now();
+    for (i = 0; i < numevents; i++) {
+        if (maxspeed)
+            drain(0);
+        else {
+            due = start + events[i].rec.usec / 1e6 / scale;
+            while ((left = due - now()) > 0)
+                drain((int)(left * 1000) + 1);
+        }
+        play(&events[i], host, port, outdir);
+    }
+    elapsed = now();
+    //let the server finish answering
+    while (drain(grace) > 0)
+        ;
+    if (lastrcvd > elapsed)
+        elapsed = lastrcvd;
+    elapsed -= start;
+
+    for (c = 0; c < numconns; c++) {
+        if (conns[c].fd != -1)
+            close(conns[c].fd);
+        if (conns[c].out)
+            fclose(conns[c].out);
+        sent += conns[c].sent;
+        rcvd += conns[c].rcvd;
+    }
+    if (server != -1) {
+        kill(server, SIGTERM);
+        waitpid(server, NULL, 0);
+    }
+
+    if (expectdir)
+        diffs = compare(outdir, expectdir);
+
+    printf("events=%d conns=%u bytes_sent=%llu bytes_rcvd=%llu elapsed=%.3f diffs=%d\n",
+           numevents, numconns ? numconns - 1 : 0, sent, rcvd, elapsed, diffs);
+    return diffs ? 1 : 0;
+}
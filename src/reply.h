@@ -20,6 +20,9 @@
 #define RPL_LUSERCHANNELS	"254"
 #define RPL_LUSERME			"255"
 
+#define RPL_ENDOFSTATS		"219"
+#define RPL_STATSDEBUG		"249"
+
 #define RPL_AWAY			"301"
 #define RPL_UNAWAY          "305"
 #define RPL_NOWAWAY         "306"
@@ -53,6 +56,8 @@
 #define ERR_NOSUCHNICK			"401"
 #define ERR_NOSUCHCHANNEL		"403"
 #define ERR_CANNOTSENDTOCHAN	"404"
+#define ERR_TOOMANYTARGETS		"407"
+#define ERR_NORECIPIENT			"411"
 #define ERR_UNKNOWNCOMMAND		"421"
 #define ERR_NOMOTD              "422"
 #define ERR_NICKNAMEINUSE		"433"
@@ -61,6 +66,7 @@
 #define ERR_NOTREGISTERED		"451"
 #define ERR_ALREADYREGISTRED	"462"
 #define ERR_PASSWDMISMATCH      "464"
+#define ERR_NOPRIVILEGES        "481"
 #define ERR_UNKNOWNMODE         "472"
 #define ERR_CHANOPRIVISNEEDED	"482"
 #define ERR_UMODEUNKNOWNFLAG    "501"
@@ -23,6 +23,12 @@
 #include "reply.h"
 #include "simclist.h"
 #include "ircstructs.h"
+#include "prof.h"
+#include "upgrade.h"
+#include "admit.h"
+#include "log.h"
+#include "mem.h"
+#include "affinity.h"
 
 
 #define MAXMSG 512
@@ -32,6 +38,14 @@ extern pthread_mutex_t lock;
 void parse_message(int clientSocket, chirc_server *server);
 int fun_seek(const void *el, const void *indicator);
 int fun_compare(const void *a, const void *b);
+list_hash_t hash_userchan(const void *el);
+int hash_userchan_seek(const void *indicator, list_hash_t *hash);
+
+//gives back the connection's place in admission control, however the thread ends
+static void release_client(void *addr)
+{
+    admit_release((struct sockaddr *) addr);
+}
 
 void *service_single_client(void *args) {
 	
@@ -39,18 +53,29 @@ void *service_single_client(void *args) {
 	int socket;
 	chirc_server *ourserver;
     char *clientname;
+    char hostname[NI_MAXHOST];
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
     list_t userchans;
+    client_input input;
     person client;
     client.nick[0] = '\0';
     client.user[0] = '\0';
     client.fullname[0] = '\0';
-    client.mode[0] = '\0';
+    client.mode = 0;
+    client.mark = 0;
+    client.input = NULL;
+    client.mem = NULL;
+    client.actor_pending = 0;
+    client.closing = 0;
+    client.refs = 0;
     pthread_mutex_init(&(client.c_lock), NULL);
     
     //unpack arguments
 	wa = (workerArgs*) args;
 	socket = wa->socket;
 	ourserver = wa->server;
+	affinity_enter(wa->node);
     
     //set up client struct
     list_init(&userchans);
@@ -62,23 +87,50 @@ void *service_single_client(void *args) {
         perror("list fail");
         exit(-1);
     }
+    if(list_attributes_index(&userchans, hash_userchan, hash_userchan_seek) == -1){
+        perror("list fail");
+        exit(-1);
+    }
+    //connections handed over by an upgrade still count against the limits
+    if (wa->restore != NULL)
+        admit_existing(socket, &addr, &addrlen);
+    else {
+        memcpy(&addr, &(wa->addr), wa->addrlen);
+        addrlen = wa->addrlen;
+    }
     clientname = wa->clientname;
+    if (clientname == NULL) {
+        if (getnameinfo((struct sockaddr *) &addr, addrlen, hostname, sizeof(hostname), NULL, 0, 0) != 0
+            && getnameinfo((struct sockaddr *) &addr, addrlen, hostname, sizeof(hostname), NULL, 0, NI_NUMERICHOST) != 0)
+            strcpy(hostname, "unknown");
+        clientname = strdup(hostname);
+        log_event(LOG_CONNECT, socket, 0, 0, clientname);
+    }
     client.clientSocket = socket;
     client.address = clientname;
     client.my_chans = &userchans;
     client.tid = pthread_self();
+    mem_open(&client);
     
-    free(wa);
-
     //add client to list
-    pthread_mutex_lock(&lock);
-    list_append(ourserver->userlist, &client);
-    pthread_mutex_unlock(&lock);
+    if (wa->restore != NULL) {
+        client.input = &input;
+        upgrade_restore(ourserver, &client, wa->restore);
+    }
+    else {
+        chirc_lock(&lock);
+        list_append(ourserver->userlist, &client);
+        chirc_unlock(&lock);
+        upgrade_client_started();
+    }
+    free(wa);
 
 	pthread_detach(pthread_self());
 
     //actually get messages
+    pthread_cleanup_push(release_client, &addr);
 	parse_message(socket, ourserver);
+    pthread_cleanup_pop(1);
 	
 	pthread_mutex_destroy(&(client.c_lock));
 
@@ -0,0 +1,441 @@
+/*
+ *
+ *  CMSC 23300 / 33300 - Networks and Distributed Systems
+ *
+ *  deterministic in-memory client simulator for chirc project (make sim)
+ *
+ *  sachs_sandler
+ *
+ */
+
+/*
+ * usage: chirc-sim [-u clients] [-c channels] [-j joins] [-n actions] [-s seed]
+ *
+ * Runs the handlers against clients that have no socket. This file provides
+ * transport_send and transport_close (see transport.h) in place of
+ * transport.c, so whatever the handlers send to a client lands here, and
+ * everything runs on one thread: each command goes straight to parse(), and
+ * every reply and fan-out it causes has been delivered by the time parse()
+ * returns. With the same arguments, two runs do exactly the same thing, and
+ * print the same digest of every byte delivered.
+ *
+ * Every client registers, then joins joins channels. Channel popularity is
+ * skewed, so a few channels get a large share of the clients. Then actions
+ * actions follow, each one by a randomly chosen client:
+ *
+ *   chanmsg  PRIVMSG to one of its channels
+ *   usermsg  PRIVMSG to another client
+ *   nick     NICK, which reaches everyone sharing a channel with it once
+ *   topic    TOPIC on one of its channels
+ *   join     JOIN a channel it isn't on
+ *   part     PART one of its channels
+ *
+ * The simulator keeps its own record of who is on which channel. After each
+ * command it checks that the relayed line reached exactly the clients that
+ * record says it should, each of them exactly once. A mismatch is reported
+ * on stderr and makes the exit status 1.
+ *
+ * stdout gets one JSON object per kind of command, with how often it was run,
+ * its average and worst cost, and how many deliveries it caused, then a
+ * summary line.
+ *
+ * The defaults (10000 clients, 1000 channels, 3 joins, 50000 actions) run in
+ * well under a minute. Finding a client by socket or nick goes through the
+ * userlist's hash indexes, so it costs the same however many clients there
+ * are. -u 100000 still takes minutes: each registration's LUSERS walks the
+ * userlist, and unless -c grows with -u the channels fill up, so every JOIN
+ * and message reaches more clients.
+ */
+#define _GNU_SOURCE //memmem
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <pthread.h>
+#include <stdint.h>
+#include "reply.h"
+#include "simclist.h"
+#include "ircstructs.h"
+#include "prof.h"
+#include "chanmap.h"
+#include "transport.h"
+
+#define SIM_FD 1000000      //first client's fd, well clear of real ones
+#define SIM_MAXFAILS 10     //mismatches described on stderr
+
+//normally defined in main.c
+pthread_mutex_t lock;
+
+void parse(char *msg, int clientSocket, chirc_server *server);
+int fun_seek(const void *el, const void *indicator);
+int fun_compare(const void *a, const void *b);
+list_hash_t hash_nick(const void *el);
+int hash_nick_seek(const void *indicator, list_hash_t *hash);
+list_hash_t hash_fd(const void *el);
+int hash_fd_seek(const void *indicator, list_hash_t *hash);
+list_hash_t hash_userchan(const void *el);
+int hash_userchan_seek(const void *indicator, list_hash_t *hash);
+
+typedef enum {
+    ACT_REGISTER,
+    ACT_CHANMSG,
+    ACT_USERMSG,
+    ACT_NICK,
+    ACT_TOPIC,
+    ACT_JOIN,
+    ACT_PART,
+    NUM_ACTS
+} sim_act;
+
+static const char *act_names[NUM_ACTS] = { "register", "chanmsg", "usermsg", "nick", "topic", "join", "part" };
+
+typedef struct {
+    unsigned long ops;
+    uint64_t ns;
+    uint64_t max_ns;
+    unsigned long deliveries;
+} act_stats;
+
+//the simulator's own record of who is on what
+typedef struct {
+    int *ids;
+    int n, size;
+} id_set;
+
+typedef struct {
+    char nick[32];
+    id_set chans;
+} sim_client;
+
+static chirc_server server;
+static list_t userlist;
+static sim_client *clients;
+static id_set *chans;
+static int numclients = 10000, numchans = 1000, joins = 3, numactions = 50000;
+static uint64_t rng;
+static FILE *results;       //the original stdout; chirc's own printf logging goes to stderr
+
+//what the command being run should cause, checked by transport_send
+static char match[MAXMSG];
+static size_t matchlen;
+static unsigned long seq = 0;
+static unsigned long *got_seq;  //per client, the last command it got the line for
+static int *got_count;          //and how many times
+static unsigned long delivered;
+
+static act_stats stats[NUM_ACTS];
+static unsigned long failures = 0;
+static uint64_t digest = 14695981039346656037ULL;
+
+static uint64_t next_random(void)
+{
+    //xorshift64*
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+    return rng * 2685821657736338717ULL;
+}
+
+static int random_below(int n)
+{
+    return (int) (next_random() % n);
+}
+
+//low channel numbers are much more popular than high ones
+static int random_chan(void)
+{
+    double u = (next_random() >> 11) * (1.0 / 9007199254740992.0);
+    return (int) (u * u * u * numchans);
+}
+
+static void set_add(id_set *s, int id)
+{
+    if (s->n == s->size) {
+        s->size = s->size ? s->size * 2 : 4;
+        s->ids = realloc(s->ids, s->size * sizeof(int));
+    }
+    s->ids[s->n++] = id;
+}
+
+static int set_find(id_set *s, int id)
+{
+    int i;
+    for (i = 0; i < s->n; i++)
+        if (s->ids[i] == id)
+            return i;
+    return -1;
+}
+
+static void set_remove(id_set *s, int id)
+{
+    int i = set_find(s, id);
+    s->ids[i] = s->ids[--(s->n)];
+}
+
+ssize_t transport_send(int fd, const void *buf, size_t len)
+{
+    const unsigned char *p = buf;
+    const char *at = buf, *end = at + len;
+    int id = fd - SIM_FD;
+    size_t i;
+
+    for (i = 0; i < sizeof(int); i++)
+        digest = (digest ^ ((id >> (8 * i)) & 0xff)) * 1099511628211ULL;
+    for (i = 0; i < len; i++)
+        digest = (digest ^ p[i]) * 1099511628211ULL;
+
+    while (matchlen && (at = memmem(at, end - at, match, matchlen)) != NULL) {
+        if (got_seq[id] != seq) {
+            got_seq[id] = seq;
+            got_count[id] = 0;
+        }
+        got_count[id]++;
+        delivered++;
+        at += matchlen;
+    }
+    return len;
+}
+
+int transport_close(int fd)
+{
+    return 0;
+}
+
+static void fail(sim_act act, int id, const char *what, int count)
+{
+    if (failures++ < SIM_MAXFAILS)
+        fprintf(stderr, "%s #%lu by %s: %s %s (%d times)\n",
+                act_names[act], seq, clients[id].nick, what, match, count);
+}
+
+//runs cmd for client id. the line matching fmt has to reach exactly the
+//clients in expect, once each
+static void run(sim_act act, int id, id_set *expect, const char *cmd, const char *fmt, ...)
+{
+    char msg[MAXMSG];
+    va_list ap;
+    uint64_t start, ns;
+    int i, r;
+
+    seq++;
+    va_start(ap, fmt);
+    vsnprintf(match, MAXMSG, fmt, ap);
+    va_end(ap);
+    matchlen = strlen(match);
+    delivered = 0;
+
+    snprintf(msg, MAXMSG, "%s", cmd);
+    start = prof_now();
+    parse(msg, SIM_FD + id, &server);
+    ns = prof_now() - start;
+
+    stats[act].ops++;
+    stats[act].ns += ns;
+    if (ns > stats[act].max_ns)
+        stats[act].max_ns = ns;
+    stats[act].deliveries += delivered;
+
+    for (i = 0; i < expect->n; i++) {
+        r = expect->ids[i];
+        if (got_seq[r] != seq)
+            fail(act, r, "missed", 0);
+        else if (got_count[r] != 1)
+            fail(act, r, "got duplicates of", got_count[r]);
+    }
+    if (delivered > expect->n)
+        fail(act, id, "sent to someone who shouldn't get", delivered - expect->n);
+}
+
+static void connect_client(int id)
+{
+    person *p = calloc(1, sizeof(person));
+    char cmd[MAXMSG];
+    id_set self = { &id, 1, 1 };
+
+    p->address = "sim.example.org";
+    p->clientSocket = SIM_FD + id;
+    p->tid = pthread_self();
+    pthread_mutex_init(&(p->c_lock), NULL);
+    p->my_chans = malloc(sizeof(list_t));
+    list_init(p->my_chans);
+    list_attributes_seeker(p->my_chans, fun_seek);
+    list_attributes_comparator(p->my_chans, fun_compare);
+    list_attributes_index(p->my_chans, hash_userchan, hash_userchan_seek);
+    list_append(&userlist, p);
+
+    snprintf(clients[id].nick, sizeof(clients[id].nick), "c%d", id);
+    snprintf(cmd, MAXMSG, "NICK %s", clients[id].nick);
+    parse(cmd, SIM_FD + id, &server);
+    snprintf(cmd, MAXMSG, "USER c%d * * :Simulated Client %d", id, id);
+    run(ACT_REGISTER, id, &self, cmd, " 001 %s :Welcome", clients[id].nick);
+}
+
+static void join(int id, int c)
+{
+    char cmd[MAXMSG];
+
+    set_add(&chans[c], id);
+    set_add(&clients[id].chans, c);
+    snprintf(cmd, MAXMSG, "JOIN #c%d", c);
+    run(ACT_JOIN, id, &chans[c], cmd, " JOIN #c%d\r\n", c);
+}
+
+static void part(int id, int c)
+{
+    char cmd[MAXMSG];
+
+    snprintf(cmd, MAXMSG, "PART #c%d", c);
+    run(ACT_PART, id, &chans[c], cmd, " PART #c%d\r\n", c);
+    set_remove(&chans[c], id);
+    set_remove(&clients[id].chans, c);
+}
+
+//a channel id isn't on, or -1 after a few tries
+static int unjoined_chan(int id)
+{
+    int tries, c;
+
+    for (tries = 0; tries < 8; tries++)
+        if (set_find(&clients[id].chans, c = random_chan()) == -1)
+            return c;
+    return -1;
+}
+
+static void act(int id, unsigned long *stamp)
+{
+    sim_client *cl = &clients[id];
+    char cmd[MAXMSG];
+    id_set others, one;
+    int roll = random_below(100), c, to, i, k;
+
+    if (cl->chans.n == 0 && roll < 80)
+        roll = 95;  //nothing to talk on, so join something
+    c = cl->chans.n ? cl->chans.ids[random_below(cl->chans.n)] : -1;
+
+    if (roll < 60) {
+        //everyone on the channel but the sender
+        others = chans[c];
+        others.ids = malloc(chans[c].n * sizeof(int));
+        others.n = 0;
+        for (i = 0; i < chans[c].n; i++)
+            if (chans[c].ids[i] != id)
+                others.ids[others.n++] = chans[c].ids[i];
+        snprintf(cmd, MAXMSG, "PRIVMSG #c%d :m%lu", c, seq + 1);
+        run(ACT_CHANMSG, id, &others, cmd, " PRIVMSG #c%d :m%lu\r\n", c, seq + 1);
+        free(others.ids);
+    }
+    else if (roll < 70) {
+        if ((to = random_below(numclients)) == id)
+            return;
+        one.ids = &to;
+        one.n = one.size = 1;
+        snprintf(cmd, MAXMSG, "PRIVMSG %s :m%lu", clients[to].nick, seq + 1);
+        run(ACT_USERMSG, id, &one, cmd, " PRIVMSG %s :m%lu\r\n", clients[to].nick, seq + 1);
+    }
+    else if (roll < 75) {
+        //the client itself and everyone it shares a channel with, each once
+        memset(&others, 0, sizeof(others));
+        stamp[id] = seq + 1;
+        set_add(&others, id);
+        for (k = 0; k < cl->chans.n; k++)
+            for (i = 0; i < chans[cl->chans.ids[k]].n; i++)
+                if (stamp[to = chans[cl->chans.ids[k]].ids[i]] != seq + 1) {
+                    stamp[to] = seq + 1;
+                    set_add(&others, to);
+                }
+        snprintf(cl->nick, sizeof(cl->nick), "n%lu", seq + 1);
+        snprintf(cmd, MAXMSG, "NICK %s", cl->nick);
+        run(ACT_NICK, id, &others, cmd, " NICK :%s\r\n", cl->nick);
+        free(others.ids);
+    }
+    else if (roll < 80) {
+        snprintf(cmd, MAXMSG, "TOPIC #c%d :t%lu", c, seq + 1);
+        run(ACT_TOPIC, id, &chans[c], cmd, " TOPIC #c%d :t%lu\r\n", c, seq + 1);
+    }
+    else if (roll < 90 && c != -1)
+        part(id, c);
+    else if ((c = unjoined_chan(id)) != -1)
+        join(id, c);
+}
+
+static void report(sim_act act)
+{
+    act_stats *s = &stats[act];
+
+    if (s->ops == 0)
+        return;
+    fprintf(results, "{\"sim\":\"%s\",\"ops\":%lu,\"ns_per_op\":%.1f,\"max_us\":%.1f,"
+            "\"deliveries\":%lu,\"ns_per_delivery\":%.1f}\n",
+            act_names[act], s->ops, (double) s->ns / s->ops, s->max_ns / 1000.0,
+            s->deliveries, s->deliveries ? (double) s->ns / s->deliveries : 0.0);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt, id, c, k;
+    unsigned long seed = 1, total = 0;
+    unsigned long *stamp;
+    uint64_t start, elapsed;
+
+    while ((opt = getopt(argc, argv, "u:c:j:n:s:")) != -1)
+        switch (opt)
+        {
+            case 'u': numclients = atoi(optarg); break;
+            case 'c': numchans = atoi(optarg); break;
+            case 'j': joins = atoi(optarg); break;
+            case 'n': numactions = atoi(optarg); break;
+            case 's': seed = strtoul(optarg, NULL, 10); break;
+            default:
+                fprintf(stderr, "usage: chirc-sim [-u clients] [-c channels] [-j joins] [-n actions] [-s seed]\n");
+                exit(-1);
+        }
+    if (numclients < 2 || numchans < 1 || joins < 0 || numactions < 0) {
+        fprintf(stderr, "need at least two clients and one channel\n");
+        exit(-1);
+    }
+    rng = seed * 0x9e3779b97f4a7c15ULL + 1;
+
+    results = fdopen(dup(STDOUT_FILENO), "w");
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+
+    pthread_mutex_init(&lock, NULL);
+    list_init(&userlist);
+    list_attributes_seeker(&userlist, fun_seek);
+    list_attributes_index(&userlist, hash_nick, hash_nick_seek);
+    list_attributes_index(&userlist, hash_fd, hash_fd_seek);
+    server.userlist = &userlist;
+    server.chans = chanmap_create();
+    server.servername = "sim.example.org";
+    server.birthday = "at the start of the simulation";
+
+    clients = calloc(numclients, sizeof(sim_client));
+    chans = calloc(numchans, sizeof(id_set));
+    got_seq = calloc(numclients, sizeof(unsigned long));
+    got_count = calloc(numclients, sizeof(int));
+    stamp = calloc(numclients, sizeof(unsigned long));
+
+    start = prof_now();
+    for (id = 0; id < numclients; id++)
+        connect_client(id);
+    for (id = 0; id < numclients; id++)
+        for (k = 0; k < joins; k++)
+            if ((c = unjoined_chan(id)) != -1)
+                join(id, c);
+    for (k = 0; k < numactions; k++)
+        act(random_below(numclients), stamp);
+    elapsed = prof_now() - start;
+
+    for (k = 0; k < NUM_ACTS; k++) {
+        report(k);
+        total += stats[k].deliveries;
+    }
+    fprintf(results, "{\"sim\":\"total\",\"clients\":%d,\"channels\":%d,\"joins\":%d,\"actions\":%d,"
+            "\"seed\":%lu,\"deliveries\":%lu,\"failures\":%lu,\"seconds\":%.2f,\"digest\":\"%016llx\"}\n",
+            numclients, numchans, joins, numactions, seed, total, failures, elapsed / 1e9,
+            (unsigned long long) digest);
+    fflush(results);
+    return failures ? 1 : 0;
+}
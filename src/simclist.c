@@ -217,6 +217,11 @@ static void *list_get_minmax(const list_t *restrict l, int versus);
 
 static inline struct list_entry_s *list_findpos(const list_t *restrict l, int posstart);
 
+/* keep the hash indexes up to date */
+static void list_index_insert(list_t *restrict l, void *data);
+static void list_index_remove(list_t *restrict l, const void *data);
+static void list_index_clear(list_t *restrict l);
+
 /*
  * Random Number Generator
  *
@@ -280,6 +285,9 @@ int list_init(list_t *restrict l) {
     l->iter_active = 0;
     l->iter_pos = 0;
     l->iter_curentry = NULL;
+    l->version = 0;
+    l->indexes = NULL;
+    l->numindexes = 0;
 
     /* free-list attributes */
     l->spareels = (struct list_entry_s **)malloc(SIMCLIST_MAX_SPARE_ELEMS * sizeof(struct list_entry_s *));
@@ -301,6 +309,10 @@ void list_destroy(list_t *restrict l) {
     unsigned int i;
 
     list_clear(l);
+    for (i = 0; i < l->numindexes; i++) {
+        free(l->indexes[i].buckets);
+    }
+    free(l->indexes);
     for (i = 0; i < l->spareelsnum; i++) {
         free(l->spareels[i]);
     }
@@ -383,6 +395,134 @@ int list_attributes_unserializer(list_t *restrict l, element_unserializer unseri
     return 0;
 }
 
+/* hash indexes */
+#define SIMCLIST_INDEX_MINBITS  4
+
+/* bucket for hash: the top bits of a multiplicative hash, so every bit of hash counts */
+static inline unsigned int list_index_bucket(const struct list_index_s *ix, list_hash_t hash) {
+    return (unsigned int)(((uint32_t)hash * 2654435761U) >> (32 - ix->bits));
+}
+
+static void list_index_add(struct list_index_s *ix, void *data, list_hash_t hash) {
+    struct list_index_node_s *n, *next, **old;
+    unsigned int i, b, oldbits;
+
+    if (ix->count >= (2U << ix->bits)) {
+        /* more than two per bucket on average: double the buckets */
+        old = ix->buckets;
+        oldbits = ix->bits;
+        ix->buckets = (struct list_index_node_s **)calloc(1U << (oldbits + 1), sizeof(struct list_index_node_s *));
+        if (ix->buckets == NULL) {
+            ix->buckets = old;
+        } else {
+            ix->bits = oldbits + 1;
+            for (i = 0; i < (1U << oldbits); i++) {
+                for (n = old[i]; n != NULL; n = next) {
+                    next = n->next;
+                    b = list_index_bucket(ix, n->hash);
+                    n->next = ix->buckets[b];
+                    ix->buckets[b] = n;
+                }
+            }
+            free(old);
+        }
+    }
+
+    n = (struct list_index_node_s *)malloc(sizeof(struct list_index_node_s));
+    if (n == NULL) return;
+    n->data = data;
+    n->hash = hash;
+    b = list_index_bucket(ix, hash);
+    n->next = ix->buckets[b];
+    ix->buckets[b] = n;
+    ix->count++;
+}
+
+static int list_index_del(struct list_index_s *ix, const void *data) {
+    struct list_index_node_s *n, **p;
+
+    for (p = &ix->buckets[list_index_bucket(ix, ix->elhash(data))]; (n = *p) != NULL; p = &n->next) {
+        if (n->data == data) {
+            *p = n->next;
+            free(n);
+            ix->count--;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static void list_index_insert(list_t *restrict l, void *data) {
+    unsigned int i;
+
+    for (i = 0; i < l->numindexes; i++)
+        list_index_add(&l->indexes[i], data, l->indexes[i].elhash(data));
+}
+
+static void list_index_remove(list_t *restrict l, const void *data) {
+    unsigned int i;
+
+    for (i = 0; i < l->numindexes; i++)
+        list_index_del(&l->indexes[i], data);
+}
+
+static void list_index_clear(list_t *restrict l) {
+    struct list_index_node_s *n, *next;
+    struct list_index_s *ix;
+    unsigned int i, b;
+
+    for (i = 0; i < l->numindexes; i++) {
+        ix = &l->indexes[i];
+        for (b = 0; b < (1U << ix->bits); b++) {
+            for (n = ix->buckets[b]; n != NULL; n = next) {
+                next = n->next;
+                free(n);
+            }
+            ix->buckets[b] = NULL;
+        }
+        ix->count = 0;
+    }
+}
+
+int list_attributes_index(list_t *restrict l, element_hash_computer elhash, indicator_hash_computer indhash) {
+    struct list_index_s *indexes, *ix;
+    struct list_entry_s *s;
+
+    if (l == NULL || elhash == NULL) return -1;
+
+    indexes = (struct list_index_s *)realloc(l->indexes, (l->numindexes + 1) * sizeof(struct list_index_s));
+    if (indexes == NULL) return -1;
+    l->indexes = indexes;
+    ix = &indexes[l->numindexes];
+    ix->elhash = elhash;
+    ix->indhash = indhash;
+    ix->bits = SIMCLIST_INDEX_MINBITS;
+    ix->count = 0;
+    ix->buckets = (struct list_index_node_s **)calloc(1U << ix->bits, sizeof(struct list_index_node_s *));
+    if (ix->buckets == NULL) return -1;
+    l->numindexes++;
+
+    /* index what is already there */
+    for (s = l->head_sentinel->next; s != l->tail_sentinel; s = s->next)
+        list_index_add(ix, s->data, elhash(s->data));
+
+    return 0;
+}
+
+int list_unindex(list_t *restrict l, const void *data) {
+    unsigned int i;
+    int r = 0;
+
+    for (i = 0; i < l->numindexes; i++)
+        if (list_index_del(&l->indexes[i], data) != 0) r = -1;
+    return r;
+}
+
+int list_reindex(list_t *restrict l, const void *data) {
+    list_index_insert(l, (void *)data);
+    return 0;
+}
+
 int list_append(list_t *restrict l, const void *data) {
     return list_insert_at(l, data, l->numels);
 }
@@ -465,9 +605,11 @@ void *list_extract_at(list_t *restrict l, unsigned int pos) {
     tmp = list_findpos(l, pos);
     data = tmp->data;
 
+    list_index_remove(l, data);
     tmp->data = NULL;   /* save data from list_drop_elem() free() */
     list_drop_elem(l, tmp, pos);
     l->numels--;
+    l->version++;
 
     assert(list_repOk(l));
 
@@ -508,6 +650,8 @@ int list_insert_at(list_t *restrict l, const void *data, unsigned int pos) {
     succ->prev = lent;
 
     l->numels++;
+    l->version++;
+    list_index_insert(l, lent->data);
 
     /* fix mid pointer */
     if (l->numels == 1) { /* first element, set pointer */
@@ -547,9 +691,11 @@ int list_delete_at(list_t *restrict l, unsigned int pos) {
 
     delendo = list_findpos(l, pos);
 
+    list_index_remove(l, delendo->data);
     list_drop_elem(l, delendo, pos);
 
     l->numels--;
+    l->version++;
 
 
     assert(list_repOk(l));
@@ -583,6 +729,8 @@ int list_delete_range(list_t *restrict l, unsigned int posstart, unsigned int po
     }
 
     assert(posstart == 0 || lastvalid != l->head_sentinel);
+    for (tmp2 = tmp, i = posstart; i <= posend; tmp2 = tmp2->next, i++)
+        list_index_remove(l, tmp2->data);
     i = posstart;
     if (l->attrs.copy_data) {
         /* also free element data */
@@ -614,6 +762,7 @@ int list_delete_range(list_t *restrict l, unsigned int posstart, unsigned int po
     tmp->prev = lastvalid;
 
     l->numels -= posend - posstart + 1;
+    l->version++;
 
     assert(list_repOk(l));
 
@@ -629,6 +778,8 @@ int list_clear(list_t *restrict l) {
 
     if (l->iter_active) return -1;
 
+    list_index_clear(l);
+
     if (l->attrs.copy_data) {        /* also free user data */
         /* spare a loop conditional with two loops: spareing elems and freeing elems */
         for (s = l->head_sentinel->next; l->spareelsnum < SIMCLIST_MAX_SPARE_ELEMS && s != l->tail_sentinel; s = s->next) {
@@ -660,6 +811,7 @@ int list_clear(list_t *restrict l) {
     }
     l->numels = 0;
     l->mid = NULL;
+    l->version++;
 
     assert(list_repOk(l));
 
@@ -696,9 +848,22 @@ int list_locate(const list_t *restrict l, const void *data) {
 
 void *list_seek(list_t *restrict l, const void *indicator) {
     const struct list_entry_s *iter;
+    const struct list_index_node_s *n;
+    const struct list_index_s *ix;
+    list_hash_t hash;
+    unsigned int i;
 
     if (l->attrs.seeker == NULL) return NULL;
 
+    for (i = 0; i < l->numindexes; i++) {
+        ix = &l->indexes[i];
+        if (ix->indhash == NULL || ix->indhash(indicator, &hash) != 0) continue;
+        for (n = ix->buckets[list_index_bucket(ix, hash)]; n != NULL; n = n->next) {
+            if (n->hash == hash && l->attrs.seeker(n->data, indicator) != 0) return n->data;
+        }
+        return NULL;
+    }
+
     for (iter = l->head_sentinel->next; iter != l->tail_sentinel; iter = iter->next) {
         if (l->attrs.seeker(iter->data, indicator) != 0) return iter->data;
     }
@@ -707,6 +872,20 @@ void *list_seek(list_t *restrict l, const void *indicator) {
 }
 
 int list_contains(const list_t *restrict l, const void *data) {
+    const struct list_index_node_s *n;
+    const struct list_index_s *ix;
+    list_hash_t hash;
+
+    if (l->numindexes > 0) {
+        ix = &l->indexes[0];
+        hash = ix->elhash(data);
+        for (n = ix->buckets[list_index_bucket(ix, hash)]; n != NULL; n = n->next) {
+            if (n->hash != hash) continue;
+            if (l->attrs.comparator != NULL ? l->attrs.comparator(data, n->data) == 0 : n->data == data)
+                return 1;
+        }
+        return 0;
+    }
     return (list_locate(l, data) >= 0);
 }
 
@@ -770,6 +949,7 @@ int list_sort(list_t *restrict l, int versus) {
     if (l->numels <= 1)
         return 0;
     list_sort_quicksort(l, versus, 0, l->head_sentinel->next, l->numels-1, l->tail_sentinel->prev);
+    l->version++;
     assert(list_repOk(l));
     return 0;
 }
@@ -967,6 +1147,33 @@ int list_iterator_stop(list_t *restrict l) {
     return 1;
 }
 
+void list_iter_start(list_iter_t *restrict it, const list_t *restrict l) {
+    it->list = l;
+    it->next = l->head_sentinel->next;
+    it->version = l->version;
+}
+
+void *list_iter_next(list_iter_t *restrict it) {
+    void *toret;
+
+    if (! list_iter_hasnext(it)) return NULL;
+
+    toret = it->next->data;
+    it->next = it->next->next;
+
+    return toret;
+}
+
+int list_iter_hasnext(const list_iter_t *restrict it) {
+    /* the walk must hold whatever lock keeps the list from changing under it */
+    assert(it->version == it->list->version);
+    return (it->next != it->list->tail_sentinel);
+}
+
+int list_iter_changed(const list_iter_t *restrict it) {
+    return (it->version != it->list->version);
+}
+
 int list_hash(const list_t *restrict l, list_hash_t *restrict hash) {
     struct list_entry_s *x;
     list_hash_t tmphash;
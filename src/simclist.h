@@ -114,6 +114,20 @@ typedef size_t (*element_meter)(const void *el);
  */
 typedef list_hash_t (*element_hash_computer)(const void *el);
 
+/**
+ * a function computing the hash of the key an indicator looks for.
+ *
+ * An indicator hash computing function is a function that:
+ *      -# receives the reference to an indicator, as passed to list_seek()
+ *      -# if the indicator looks for the key an index is built on, stores the
+ *         hash the index's element_hash_computer gives elements with that key
+ *         in hash and returns 0
+ *      -# returns non-0 otherwise
+ *
+ * @see list_attributes_index()
+ */
+typedef int (*indicator_hash_computer)(const void *indicator, list_hash_t *hash);
+
 /**
  * a function for serializing an element.
  *
@@ -177,6 +191,22 @@ struct list_attributes_s {
     element_unserializer unserializer;
 };
 
+/* [private-use] entry of a hash index */
+struct list_index_node_s {
+    void *data;
+    list_hash_t hash;
+    struct list_index_node_s *next;
+};
+
+/* [private-use] hash index on one key of the elements */
+struct list_index_s {
+    element_hash_computer elhash;
+    indicator_hash_computer indhash;
+    struct list_index_node_s **buckets;
+    unsigned int bits;          /* 1 << bits buckets */
+    unsigned int count;
+};
+
 /** list object */
 typedef struct {
     struct list_entry_s *head_sentinel;
@@ -199,10 +229,24 @@ typedef struct {
     unsigned int iter_pos;
     struct list_entry_s *iter_curentry;
 
+    /* bumped on every change to the list's elements or their order */
+    unsigned int version;
+
+    /* hash indexes, see list_attributes_index() */
+    struct list_index_s *indexes;
+    unsigned int numindexes;
+
     /* list attributes */
     struct list_attributes_s attrs;
 } list_t;
 
+/** external iterator, see list_iter_start() */
+typedef struct {
+    const list_t *list;
+    struct list_entry_s *next;      /* entry list_iter_next() returns */
+    unsigned int version;           /* list version when the iteration started */
+} list_iter_t;
+
 /**
  * initialize a list object for use.
  *
@@ -345,6 +389,54 @@ int list_attributes_serializer(list_t *restrict l, element_serializer serializer
  */
 int list_attributes_unserializer(list_t *restrict l, element_unserializer unserializer_fun);
 
+/**
+ * add a hash index on one key of the list elements.
+ *
+ * [ advanced preference ]
+ *
+ * The index is kept up to date as elements are added and removed. list_seek()
+ * uses the first index whose indhash accepts the indicator, and only calls the
+ * seeker on elements with the same hash, so finding an element by an indexed
+ * key costs the same however long the list is. If several elements match, it
+ * returns one of them, not necessarily the first in the list.
+ *
+ * list_contains() uses the first index added. With a comparator set, elements
+ * it finds equal must get the same hash from that index's elhash.
+ *
+ * The key of an element must not change while it is in the list, other than
+ * between list_unindex() and list_reindex().
+ *
+ * @param   l       list to operate
+ * @param   elhash  computes the hash of an element's key
+ * @param   indhash computes the hash of the key an indicator looks for, or
+ *                  NULL if list_seek() is not to use the index
+ * @return      0 if the index was added; -1 otherwise
+ *
+ * @see     indicator_hash_computer()
+ * @see     list_unindex()
+ */
+int list_attributes_index(list_t *restrict l, element_hash_computer elhash, indicator_hash_computer indhash);
+
+/**
+ * take an element out of the list's indexes before one of its keys changes.
+ *
+ * @param   l       list to operate
+ * @param   data    element whose key is about to change
+ * @return      0 for success; -1 if data is not indexed
+ *
+ * @see     list_reindex()
+ */
+int list_unindex(list_t *restrict l, const void *data);
+
+/**
+ * put an element taken out with list_unindex() back in the list's indexes.
+ *
+ * @param   l       list to operate
+ * @param   data    element whose key has changed
+ * @return      0 for success; -1 otherwise
+ */
+int list_reindex(list_t *restrict l, const void *data);
+
 /**
  * append data at the end of the list.
  *
@@ -548,6 +640,7 @@ void *list_seek(list_t *restrict l, const void *indicator);
  * function has been set previously, with list_attributes_comparator();
  * in which case, the given data reference is believed to be in list iff
  * comparator_fun(elementdata, userdata) == 0 for any element in the list.
+ * If the list has an index, only elements with the same hash are compared.
  * 
  * @param l     list to operate
  * @param data  reference to the data to search
@@ -629,6 +722,49 @@ int list_iterator_hasnext(const list_t *restrict l);
  */
 int list_iterator_stop(list_t *restrict l);
 
+/**
+ * start an iteration session kept in an external iterator.
+ *
+ * Unlike list_iterator_start(), the iteration state lives in the iterator,
+ * which the caller provides (usually on the stack). Any number of them can
+ * walk a list at once. Nothing needs to be released when the iteration is over.
+ *
+ * The list must not change while it is walked, or the walk would skip or
+ * revisit elements; doing so fails an assertion. Iterators do no locking:
+ * walking a list that another thread may change needs whatever lock guards
+ * the changes, but readers can share it.
+ *
+ * @param it    iterator to set up
+ * @param l     list to iterate
+ *
+ * @see list_iter_next()
+ */
+void list_iter_start(list_iter_t *restrict it, const list_t *restrict l);
+
+/**
+ * return the next element of an external iteration.
+ *
+ * @param it    iterator to advance
+ * @return      element datum, or NULL if there are no more
+ */
+void *list_iter_next(list_iter_t *restrict it);
+
+/**
+ * inspect whether an external iteration has more elements.
+ *
+ * @param it    iterator to operate
+ * @return      0 iff no more elements are available
+ */
+int list_iter_hasnext(const list_iter_t *restrict it);
+
+/**
+ * inspect whether a list changed since an external iteration started.
+ *
+ * @param it    iterator to operate
+ * @return      0 iff the list is as it was when the iteration started
+ */
+int list_iter_changed(const list_iter_t *restrict it);
+
 /**
  * return the hash of the current status of the list.
  *
@@ -0,0 +1,52 @@
+/*
+ *
+ *  CMSC 23300 / 33300 - Networks and Distributed Systems
+ *
+ *  static tracepoints for chirc project
+ *
+ *  sachs_sandler
+ *
+ */
+
+/*
+ * When <sys/sdt.h> is available the Makefile defines CHIRC_USDT and every
+ * probe below becomes a USDT probe in provider "chirc". An unattached probe
+ * is a single nop; attach with e.g.
+ *
+ *   bpftrace -e 'usdt:./chirc:chirc:handler__entry { @[str(arg2)] = count(); }'
+ *
+ * Probes and their arguments:
+ *
+ *   accept          (fd)
+ *   register        (fd)
+ *   message         (fd, length)                  complete line framed off the socket
+ *   handler__entry  (fd, command id, command name)
+ *   handler__return (fd, command id)
+ *   fanout__start   (target, length)              target is a channel, a PRIVMSG target list,
+ *   fanout__done    (target, recipients)          or the nick whose NICK/QUIT goes to all its channels
+ *   sendq__enqueue  (fd, length)                  message handed to user_send
+ *   sendq__flush    (fd, bytes written or -1)
+ *   disconnect      (fd)
+ */
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#ifdef CHIRC_USDT
+
+#include <sys/sdt.h>
+
+#define CHIRC_TRACE1(probe, a)          DTRACE_PROBE1(chirc, probe, a)
+#define CHIRC_TRACE2(probe, a, b)       DTRACE_PROBE2(chirc, probe, a, b)
+#define CHIRC_TRACE3(probe, a, b, c)    DTRACE_PROBE3(chirc, probe, a, b, c)
+
+#else
+
+//arguments are only mentioned in sizeof so nothing is evaluated
+#define CHIRC_TRACE1(probe, a)          do { (void) sizeof(a); } while (0)
+#define CHIRC_TRACE2(probe, a, b)       do { (void) sizeof(a); (void) sizeof(b); } while (0)
+#define CHIRC_TRACE3(probe, a, b, c)    do { (void) sizeof(a); (void) sizeof(b); (void) sizeof(c); } while (0)
+
+#endif /* CHIRC_USDT */
+
+#endif /* TRACE_H_ */
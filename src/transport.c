@@ -0,0 +1,21 @@
+/*
+ *
+ *  CMSC 23300 / 33300 - Networks and Distributed Systems
+ *
+ *  client socket transport for chirc project
+ *
+ *  sachs_sandler
+ *
+ */
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include "transport.h"
+
+ssize_t transport_send(int fd, const void *buf, size_t len){
+    return send(fd, buf, len, 0);
+}
+
+int transport_close(int fd){
+    return close(fd);
+}
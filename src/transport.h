@@ -0,0 +1,29 @@
+/*
+ *
+ *  CMSC 23300 / 33300 - Networks and Distributed Systems
+ *
+ *  client socket transport for chirc project
+ *
+ *  sachs_sandler
+ *
+ */
+
+/*
+ * Everything the handlers write to a client, and the close when it goes,
+ * goes through these two calls. transport.c passes them straight to the
+ * socket. The simulator (sim.c) links its own in-memory versions instead,
+ * so the handlers can be driven with clients that have no socket at all.
+ */
+
+#ifndef TRANSPORT_H_
+#define TRANSPORT_H_
+
+#include <sys/types.h>
+
+//like send(2) with no flags
+ssize_t transport_send(int fd, const void *buf, size_t len);
+
+//like close(2)
+int transport_close(int fd);
+
+#endif /* TRANSPORT_H_ */
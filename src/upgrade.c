@@ -0,0 +1,489 @@
+/*
+ *
+ *  CMSC 23300 / 33300 - Networks and Distributed Systems
+ *
+ *  binary upgrade without dropping connections for chirc project
+ *
+ *  sachs_sandler
+ *
+ */
+#define _GNU_SOURCE     //execvpe, close_range
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include "simclist.h"
+#include "ircstructs.h"
+#include "prof.h"
+#include "rcu.h"
+#include "chanmap.h"
+#include "capture.h"
+#include "upgrade.h"
+#include "log.h"
+#include "actor.h"
+#include "affinity.h"
+
+#define PARK_TIMEOUT    5       //seconds to wait for every thread to park
+#define ACK_TIMEOUT     10000   //milliseconds to wait for the new process to take over
+
+extern pthread_mutex_t lock;
+extern char **environ;
+
+void *service_single_client(void *args);
+void channel_restore(chirc_server *server, person *client, char *cname, unsigned int mode);
+
+static char **saved_argv;
+static pthread_t acceptor;
+static int have_acceptor = 0;
+
+//old process side, protected by park_lock
+static int upgrading = 0;
+static int parked = 0;
+static int starting = 0;        //client threads started but not yet on the userlist
+static pthread_mutex_t park_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t park_cond = PTHREAD_COND_INITIALIZER;
+
+//new process side, protected by restore_lock
+static int restored = 0;
+static int go = 0;
+static pthread_mutex_t restore_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t restore_cond = PTHREAD_COND_INITIALIZER;
+
+//only there to interrupt blocking calls
+static void wake(int sig){
+}
+
+void upgrade_init(char *argv[]){
+    struct sigaction sa;
+
+    saved_argv = argv;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = wake;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;    //no SA_RESTART, so recv and accept return EINTR
+    if (sigaction(UPGRADE_WAKE, &sa, NULL) == -1)
+        perror("Could not install upgrade handler");
+}
+
+int upgrade_pending(void){
+    return __atomic_load_n(&upgrading, __ATOMIC_ACQUIRE);
+}
+
+void upgrade_park(void){
+    pthread_mutex_lock(&park_lock);
+    parked++;
+    pthread_cond_broadcast(&park_cond);
+    while (upgrading)
+        pthread_cond_wait(&park_cond, &park_lock);
+    parked--;
+    pthread_mutex_unlock(&park_lock);
+}
+
+void upgrade_acceptor(void){
+    acceptor = pthread_self();
+    have_acceptor = 1;
+}
+
+void upgrade_client_starting(void){
+    pthread_mutex_lock(&park_lock);
+    starting++;
+    pthread_mutex_unlock(&park_lock);
+}
+
+void upgrade_client_started(void){
+    pthread_mutex_lock(&park_lock);
+    starting--;
+    pthread_mutex_unlock(&park_lock);
+}
+
+//waits for the accept thread and every client thread to park, interrupting them
+//until they do. returns -1 if they don't within PARK_TIMEOUT
+static int quiesce(chirc_server *server){
+    time_t deadline = time(NULL) + PARK_TIMEOUT;
+    list_iter_t it;
+    person *p;
+    int done;
+
+    while (1) {
+        chirc_lock(&lock);
+        list_iter_start(&it, server->userlist);
+        while (list_iter_hasnext(&it)) {
+            p = (person *)list_iter_next(&it);
+            pthread_kill(p->tid, UPGRADE_WAKE);
+        }
+        pthread_kill(acceptor, UPGRADE_WAKE);
+        pthread_mutex_lock(&park_lock);
+        done = starting == 0 && parked == list_size(server->userlist) + 1;
+        pthread_mutex_unlock(&park_lock);
+        chirc_unlock(&lock);
+        if (done)
+            return 0;
+        if (time(NULL) > deadline)
+            return -1;
+        usleep(10000);
+    }
+}
+
+//starts our binary with fd as descriptor 3 and nothing else open but stdio
+static pid_t spawn(int fd){
+    char envvar[64];
+    char **envp;
+    int n, i, j;
+    pid_t pid;
+
+    //built before forking, since only async-signal-safe calls are allowed after
+    for (n = 0; environ[n] != NULL; n++)
+        ;
+    envp = malloc((n + 2) * sizeof(char *));
+    for (i = j = 0; i < n; i++)
+        if (strncmp(environ[i], UPGRADE_ENV "=", strlen(UPGRADE_ENV) + 1) != 0)
+            envp[j++] = environ[i];
+    snprintf(envvar, sizeof(envvar), "%s=3", UPGRADE_ENV);
+    envp[j++] = envvar;
+    envp[j] = NULL;
+
+    if ((pid = fork()) == 0) {
+        if (fd != 3 && dup2(fd, 3) == -1)
+            _exit(127);
+        close_range(4, ~0U, 0);
+        execvpe(saved_argv[0], saved_argv, envp);
+        _exit(127);
+    }
+    if (pid == -1)
+        log_event(LOG_UPGRADE_FAILED, -1, 0, 0, "fork failed");
+    free(envp);
+    return pid;
+}
+
+//one record, with fd (if not -1) attached as SCM_RIGHTS
+static int send_record(int sock, void *rec, size_t len, int fd){
+    struct msghdr msg;
+    struct iovec iov;
+    char control[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr *cmsg;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = rec;
+    iov.iov_len = len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (fd != -1) {
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+    while (sendmsg(sock, &msg, 0) == -1) {
+        if (errno != EINTR) {
+            log_event(LOG_UPGRADE_FAILED, -1, 0, 0, "send failed");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+//receives one record of exactly len bytes and type. *fd gets any descriptor that came with it
+static int recv_record(int sock, void *rec, size_t len, uint32_t type, int *fd){
+    struct msghdr msg;
+    struct iovec iov;
+    char control[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr *cmsg;
+    ssize_t n;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = rec;
+    iov.iov_len = len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    while ((n = recvmsg(sock, &msg, 0)) == -1 && errno == EINTR)
+        ;
+    if (n != len || *(uint32_t *)rec != type) {
+        fprintf(stderr, "Upgrade: expected record type %u\n", type);
+        return -1;
+    }
+    if (fd != NULL) {
+        *fd = -1;
+        cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+            memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+        if (*fd == -1) {
+            fprintf(stderr, "Upgrade: record type %u came without a socket\n", type);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+typedef struct {
+    int sock;
+    int failed;
+} send_state;
+
+//chanmap_foreach callback sending one channel
+static void send_chan(channel *chan, void *arg){
+    send_state *st = arg;
+    upgrade_chan rec;
+    chan_meta *meta;
+
+    if (st->failed)
+        return;
+    memset(&rec, 0, sizeof(rec));
+    rec.type = UPG_CHAN;
+    strcpy(rec.name, chan->name);
+    rcu_read_lock();
+    meta = rcu_dereference(chan->meta);
+    strcpy(rec.topic, meta->topic);
+    rec.topic_time = meta->topic_time;
+    rec.mode = meta->mode;
+    rcu_read_unlock();
+    if (send_record(st->sock, &rec, sizeof(rec), -1) == -1)
+        st->failed = 1;
+}
+
+//sends everything, with every thread parked. returns how many clients went, or -1
+static int send_all(chirc_server *server, int sock, int listen_fd){
+    upgrade_hello hello;
+    upgrade_client *rec = malloc(sizeof(upgrade_client));
+    upgrade_member member;
+    send_state st = { sock, 0 };
+    mychan *userchan;
+    list_iter_t it, chanit;
+    person *p;
+
+    chirc_lock(&lock);
+    memset(&hello, 0, sizeof(hello));
+    hello.type = UPG_HELLO;
+    memcpy(hello.magic, UPGRADE_MAGIC, sizeof(hello.magic));
+    hello.version = UPGRADE_VERSION;
+    hello.numchans = chanmap_size(server->chans);
+    hello.numclients = list_size(server->userlist);
+    if (send_record(sock, &hello, sizeof(hello), listen_fd) == -1)
+        st.failed = 1;
+    chanmap_foreach(server->chans, send_chan, &st);
+
+    list_iter_start(&it, server->userlist);
+    while (!st.failed && list_iter_hasnext(&it)) {
+        p = (person *)list_iter_next(&it);
+        memset(rec, 0, sizeof(upgrade_client));
+        rec->type = UPG_CLIENT;
+        strcpy(rec->nick, p->nick);
+        strcpy(rec->user, p->user);
+        strcpy(rec->fullname, p->fullname);
+        snprintf(rec->address, MAXMSG, "%s", p->address);
+        rec->mode = p->mode;
+        strcpy(rec->away, p->away);
+        if (p->input != NULL)
+            rec->input = *(p->input);
+        rec->nummembers = list_size(p->my_chans);
+        if (send_record(sock, rec, sizeof(upgrade_client), p->clientSocket) == -1) {
+            st.failed = 1;
+            break;
+        }
+        list_iter_start(&chanit, p->my_chans);
+        while (list_iter_hasnext(&chanit)) {
+            userchan = (mychan *)list_iter_next(&chanit);
+            memset(&member, 0, sizeof(member));
+            member.type = UPG_MEMBER;
+            strcpy(member.name, userchan->name);
+            member.mode = userchan->mode;
+            if (send_record(sock, &member, sizeof(member), -1) == -1) {
+                st.failed = 1;
+                break;
+            }
+        }
+    }
+    chirc_unlock(&lock);
+    free(rec);
+
+    hello.type = UPG_DONE;
+    if (st.failed || send_record(sock, &hello, sizeof(hello), -1) == -1)
+        return -1;
+    return hello.numclients;
+}
+
+static int wait_ack(int sock){
+    struct pollfd pfd;
+    char ack;
+
+    pfd.fd = sock;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, ACK_TIMEOUT) != 1 || recv(sock, &ack, 1, 0) != 1 || ack != 'K') {
+        log_event(LOG_UPGRADE_FAILED, -1, 0, 0, "no acknowledgement");
+        return -1;
+    }
+    return 0;
+}
+
+void upgrade_start(chirc_server *server, int listen_fd){
+    int sv[2] = { -1, -1 };
+    pid_t pid = -1;
+    int numclients;
+
+    if (listen_fd == -1 || !have_acceptor) {
+        log_event(LOG_UPGRADE_FAILED, -1, 0, 0, "not listening yet");
+        return;
+    }
+    pthread_mutex_lock(&park_lock);
+    __atomic_store_n(&upgrading, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&park_lock);
+
+    if (quiesce(server) == -1) {
+        log_event(LOG_UPGRADE_FAILED, -1, 0, 0, "clients did not stop");
+        goto resume;
+    }
+    //memberships are handed over as the clients see them, so the actors have to catch up
+    if (actor_quiesce(PARK_TIMEOUT) == -1) {
+        log_event(LOG_UPGRADE_FAILED, -1, 0, 0, "channel actors did not stop");
+        goto resume;
+    }
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) == -1) {
+        log_event(LOG_UPGRADE_FAILED, -1, 0, 0, "socketpair failed");
+        goto resume;
+    }
+    pid = spawn(sv[1]);
+    close(sv[1]);
+    if (pid == -1)
+        goto resume;
+    if ((numclients = send_all(server, sv[0], listen_fd)) == -1 || wait_ack(sv[0]) == -1) {
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        goto resume;
+    }
+    //the new process has every socket now; exiting closes only our copies
+    log_event(LOG_UPGRADE, -1, pid, numclients, NULL);
+    log_flush();
+    capture_stop();
+    exit(0);
+
+resume:
+    if (sv[0] != -1)
+        close(sv[0]);
+    pthread_mutex_lock(&park_lock);
+    __atomic_store_n(&upgrading, 0, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&park_cond);
+    pthread_mutex_unlock(&park_lock);
+}
+
+int upgrade_receive(chirc_server *server){
+    char *env = getenv(UPGRADE_ENV);
+    upgrade_hello hello;
+    upgrade_chan chanrec;
+    upgrade_client *rec;
+    channel **chans;
+    workerArgs *wa;
+    pthread_t tid;
+    pthread_attr_t attr;
+    int sock, listen_fd, fd, i, j, err;
+    char ack = 'K';
+
+    if (env == NULL)
+        return -1;
+    sock = atoi(env);
+    unsetenv(UPGRADE_ENV);
+
+    //anything going wrong before the acknowledgement leaves the old server in charge
+    if (recv_record(sock, &hello, sizeof(hello), UPG_HELLO, &listen_fd) == -1
+        || memcmp(hello.magic, UPGRADE_MAGIC, sizeof(hello.magic)) != 0 || hello.version != UPGRADE_VERSION) {
+        fprintf(stderr, "Upgrade: bad handover\n");
+        exit(-1);
+    }
+
+    //each channel is held until its members are back
+    chans = malloc((hello.numchans + 1) * sizeof(channel *));
+    for (i = 0; i < hello.numchans; i++) {
+        if (recv_record(sock, &chanrec, sizeof(chanrec), UPG_CHAN, NULL) == -1)
+            exit(-1);
+        chans[i] = chanmap_get_or_create(server->chans, chanrec.name);
+        strcpy(chans[i]->meta->topic, chanrec.topic);
+        chans[i]->meta->topic_time = chanrec.topic_time;
+        chans[i]->meta->mode = chanrec.mode;
+    }
+
+    for (i = 0; i < hello.numclients; i++) {
+        rec = malloc(sizeof(upgrade_client));
+        if (recv_record(sock, rec, sizeof(upgrade_client), UPG_CLIENT, &fd) == -1)
+            exit(-1);
+        rec->members = malloc((rec->nummembers + 1) * sizeof(upgrade_member));
+        for (j = 0; j < rec->nummembers; j++)
+            if (recv_record(sock, &(rec->members[j]), sizeof(upgrade_member), UPG_MEMBER, NULL) == -1)
+                exit(-1);
+        wa = malloc(sizeof(workerArgs));
+        wa->server = server;
+        wa->clientname = strdup(rec->address);
+        wa->socket = fd;
+        wa->restore = rec;
+        pthread_attr_init(&attr);
+        wa->node = affinity_client(&attr);
+        err = pthread_create(&tid, &attr, service_single_client, wa);
+        pthread_attr_destroy(&attr);
+        if (err != 0) {
+            perror("Could not create a worker thread");
+            exit(-1);
+        }
+    }
+    if (recv_record(sock, &hello, sizeof(hello), UPG_DONE, NULL) == -1)
+        exit(-1);
+
+    pthread_mutex_lock(&restore_lock);
+    while (restored < hello.numclients)
+        pthread_cond_wait(&restore_cond, &restore_lock);
+    pthread_mutex_unlock(&restore_lock);
+    for (i = 0; i < hello.numchans; i++)
+        chanmap_put(server->chans, chans[i]);
+    free(chans);
+
+    if (send(sock, &ack, 1, 0) != 1) {
+        perror("Upgrade: could not acknowledge");
+        exit(-1);
+    }
+    close(sock);
+    log_event(LOG_UPGRADED, -1, hello.numclients, hello.numchans, NULL);
+
+    //the old server is gone, so clients can be read from
+    pthread_mutex_lock(&restore_lock);
+    go = 1;
+    pthread_cond_broadcast(&restore_cond);
+    pthread_mutex_unlock(&restore_lock);
+    return listen_fd;
+}
+
+void upgrade_restore(chirc_server *server, person *client, upgrade_client *rec){
+    int i;
+
+    strcpy(client->nick, rec->nick);
+    strcpy(client->user, rec->user);
+    strcpy(client->fullname, rec->fullname);
+    strcpy(client->away, rec->away);
+    client->mode = rec->mode;
+    *(client->input) = rec->input;
+
+    chirc_lock(&lock);
+    list_append(server->userlist, client);
+    if (client->nick[0] != '\0' && client->user[0] != '\0')
+        server->numregistered++;
+    chirc_unlock(&lock);
+    for (i = 0; i < rec->nummembers; i++)
+        channel_restore(server, client, rec->members[i].name, rec->members[i].mode);
+    free(rec->members);
+    free(rec);
+
+    pthread_mutex_lock(&restore_lock);
+    restored++;
+    pthread_cond_broadcast(&restore_cond);
+    while (!go)
+        pthread_cond_wait(&restore_cond, &restore_lock);
+    pthread_mutex_unlock(&restore_lock);
+}
@@ -0,0 +1,108 @@
+/*
+ *
+ *  CMSC 23300 / 33300 - Networks and Distributed Systems
+ *
+ *  binary upgrade without dropping connections for chirc project
+ *
+ *  sachs_sandler
+ *
+ */
+
+/*
+ * SIGUSR2 makes a running chirc hand itself over to a new copy of its binary
+ * (the one it was started as, with the same arguments), so the binary can be
+ * replaced on disk and picked up without clients noticing:
+ *
+ *   1. every client thread and the accept thread park at their next recv or
+ *      accept (UPGRADE_WAKE interrupts the ones blocked in one), saving any
+ *      partial input line first
+ *   2. the new binary is started with one end of a SOCK_SEQPACKET socketpair,
+ *      named by CHIRC_UPGRADE_FD in its environment
+ *   3. the listening socket, then every channel, then every client with its
+ *      socket and memberships are sent over it, sockets as SCM_RIGHTS
+ *   4. the new process rebuilds its state, starts a thread per client and
+ *      acknowledges, and the old one exits
+ *
+ * If the threads don't park in time or the new process fails or doesn't
+ * acknowledge, it is killed and the old one carries on as before.
+ */
+
+#ifndef UPGRADE_H_
+#define UPGRADE_H_
+
+#include <stdint.h>
+#include <pthread.h>
+#include <signal.h>
+
+#define UPGRADE_ENV     "CHIRC_UPGRADE_FD"
+#define UPGRADE_WAKE    (SIGRTMIN + 1)  //interrupts blocking calls so threads notice an upgrade
+#define UPGRADE_MAGIC   "CHIRCUPG"
+#define UPGRADE_VERSION 1
+
+#define UPG_HELLO   1   //carries the listening socket
+#define UPG_CHAN    2
+#define UPG_CLIENT  3   //carries the client's socket, followed by nummembers UPG_MEMBERs
+#define UPG_MEMBER  4
+#define UPG_DONE    5
+
+typedef struct {
+    uint32_t type;
+    char magic[8];
+    uint32_t version;
+    uint32_t numchans;
+    uint32_t numclients;
+} upgrade_hello;
+
+typedef struct {
+    uint32_t type;
+    char name[MAXMSG];
+    char topic[MAXMSG];
+    int64_t topic_time;
+    uint32_t mode;
+} upgrade_chan;
+
+typedef struct {
+    uint32_t type;
+    char name[MAXMSG];
+    uint32_t mode;
+} upgrade_member;
+
+typedef struct upgrade_client {
+    uint32_t type;
+    char nick[MAXMSG];
+    char user[MAXMSG];
+    char fullname[MAXMSG];
+    char address[MAXMSG];
+    uint32_t mode;
+    char away[MAXMSG];
+    client_input input;
+    uint32_t nummembers;
+    upgrade_member *members;    //filled in on the receiving side
+} upgrade_client;
+
+//remembers how chirc was started and installs the UPGRADE_WAKE handler
+void upgrade_init(char *argv[]);
+
+//hands over to a new process, exiting if it succeeds. listen_fd is the listening socket
+void upgrade_start(chirc_server *server, int listen_fd);
+
+//receives state from the process that started us (if it did). returns the listening
+//socket it sent, or -1 if this is not an upgrade
+int upgrade_receive(chirc_server *server);
+
+//true while an upgrade is waiting for threads to park
+int upgrade_pending(void);
+
+//blocks until the upgrade fails (and returns) or succeeds (and the process exits)
+void upgrade_park(void);
+
+//the accept thread announces itself and every client thread it is about to start,
+//and each client thread says when it is on the userlist
+void upgrade_acceptor(void);
+void upgrade_client_starting(void);
+void upgrade_client_started(void);
+
+//sets up a person from what the old process sent. called by its service thread
+void upgrade_restore(chirc_server *server, person *client, upgrade_client *rec);
+
+#endif /* UPGRADE_H_ */
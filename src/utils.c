@@ -23,18 +23,40 @@
 #include "reply.h"
 #include "simclist.h"
 #include "ircstructs.h"
+#include "prof.h"
+#include "trace.h"
+#include "capture.h"
+#include "chanmap.h"
+#include "config.h"
+#include "rcu.h"
+#include "log.h"
+#include "pool.h"
+#include "mem.h"
+#include "transport.h"
+#include "actor.h"
 
 extern pthread_mutex_t lock;
 
 int chirc_handle_MOTD(chirc_server *server, person *user, chirc_message params);
 int chirc_handle_LUSERS(chirc_server *server, person *user, chirc_message params);
 void user_exit(chirc_server *server, person *user);
+void user_close(person *user);
+void user_ref(person *user);
+void user_put(person *user);
+int user_send(chirc_server *server, person *user, char *msg);
+void names_patch(channel *chan, char *oldnick, char *newnick, unsigned int mode);
+void directory_changed(chirc_server *server);
+void outbuf_init(outbuf *out);
+void outbuf_add(outbuf *out, char *msg);
+void outbuf_addn(outbuf *out, const char *msg, size_t len);
+int outbuf_send(chirc_server *server, person *user, outbuf *out);
+
+static unsigned long fanout_epoch = 0;  //protected by lock. a user whose mark equals it is in the current recipient set
 
 void constr_reply(char code[4], person *client, char *reply, chirc_server *server, char *extra) {
     int replcode = strtol(code, NULL, 10);
     char replmsg[MAXMSG];
     char *servname = server->servername;
-    char *version = server->version;
     char prefix[MAXMSG] = ":";
     strcat(prefix, servname);
     char *nick = client->nick;
@@ -48,13 +70,17 @@ void constr_reply(char code[4], person *client, char *reply, chirc_server *serve
             sprintf(replmsg, ":Welcome to the Internet Relay Network %s!%s@%s", nick, user, msg_clnt);
             break;
         case 2:   // RPL_YOURHOST
-            sprintf(replmsg, ":Your host is %s running version %s", servname, version);
+            rcu_read_lock();
+            snprintf(replmsg, MAXMSG, ":Your host is %s running version %s", servname, config_get()->version);
+            rcu_read_unlock();
             break;
         case 3:   // RPL_CREATED
             sprintf(replmsg, ":This server was created %s", server->birthday);
             break;
         case 4:   // RPL_MYINFO
-            sprintf(replmsg, "%s %s ao mtov", servname, version); 
+            rcu_read_lock();
+            snprintf(replmsg, MAXMSG, "%s %s ao mtov", servname, config_get()->version);
+            rcu_read_unlock(); 
             break;
         case 251: // RPL_LUSERCLIENT
             sprintf(replmsg, ":There are %s users and 0 services on 1 servers", extra);
@@ -71,6 +97,12 @@ void constr_reply(char code[4], person *client, char *reply, chirc_server *serve
         case 255: // RPL_LUSERNAME
             sprintf(replmsg, ":I have %s clients and 1 servers", extra);
             break;
+        case 219: // RPL_ENDOFSTATS
+            sprintf(replmsg, "%s :End of STATS report", extra);
+            break;
+        case 249: // RPL_STATSDEBUG
+            strcpy(replmsg, extra);
+            break;
         case 301: // RPL_AWAY
             strcpy(replmsg, extra);
             break;
@@ -143,6 +175,12 @@ void constr_reply(char code[4], person *client, char *reply, chirc_server *serve
         case 404: // ERR_CANNOTSENDTOCHAN
             sprintf(replmsg, "%s :Cannot send to channel", extra);
             break;
+        case 407: // ERR_TOOMANYTARGETS
+            sprintf(replmsg, "%s :Too many recipients", extra);
+            break;
+        case 411: // ERR_NORECIPIENT
+            sprintf(replmsg, ":No recipient given (%s)", extra);
+            break;
         case 421: // ERR_UNKNOWNCOMMAND
             sprintf(replmsg, "%s :Unknown command", extra);
             break;
@@ -170,6 +208,9 @@ void constr_reply(char code[4], person *client, char *reply, chirc_server *serve
         case 472: // ERR_UNKNOWNMODE
         	sprintf(replmsg, "%s :is unknown mode char to me for %s", reply, extra);
         	break;
+        case 481: // ERR_NOPRIVILEGES
+            strcpy(replmsg, ":Permission Denied- You're not an IRC operator");
+            break;
         case 482: // ERR_CHANOPRIVISNEEDED
             sprintf(replmsg, "%s :You're not channel operator", extra);
             break;
@@ -187,86 +228,122 @@ void constr_reply(char code[4], person *client, char *reply, chirc_server *serve
     return;
 }
 
+//sends msg to user; if the socket is dead, the connection is closed (see user_close)
+int user_send(chirc_server *server, person *user, char *msg){
+    int rc, err;
+    size_t len = strlen(msg);
+    PROF_START(start);
+    
+    if (__atomic_load_n(&(user->closing), __ATOMIC_ACQUIRE))
+        return -1;      //already going, so not worth waiting on
+    CHIRC_TRACE2(sendq__enqueue, user->clientSocket, len);
+    chirc_lock(&(user->c_lock));
+    if (user->closing) {
+        //user_exit got in first and may have closed the fd already
+        chirc_unlock(&(user->c_lock));
+        return -1;
+    }
+    while ((rc = transport_send(user->clientSocket, msg, len)) == -1 && errno == EINTR)
+        ;   //interrupted by an upgrade waking this thread
+    err = errno;
+    CHIRC_TRACE2(sendq__flush, user->clientSocket, rc);
+    chirc_unlock(&(user->c_lock));
+    PROF_SEND(len, start);
+    
+    if(rc == -1){
+        log_event(LOG_SEND_ERROR, user->clientSocket, err, 0, NULL);
+        user_close(user);
+    }
+    return rc;
+}
+
+//splits a comma-separated list in place, dropping repeats. empty items are kept so
+//they can be answered. returns the number of items, at most max; if there are more,
+//*rest is left pointing at what's left of the list (still comma-separated), and
+//otherwise set to NULL
+int split_list(char *list, char **items, int max, char **rest){
+    char *item;
+    int i, n = 0;
+    
+    *rest = NULL;
+    while (list != NULL) {
+        item = strsep(&list, ",");
+        for (i = 0; i < n; i++)
+            if (strcmp(items[i], item) == 0)
+                break;
+        if (i < n)
+            continue;
+        if (n == max) {
+            if (list != NULL)
+                list[-1] = ',';     //put back what strsep cut
+            *rest = item;
+            break;
+        }
+        items[n++] = item;
+    }
+    return n;
+}
+
 //send all registration replies
 void do_registration(person *client, chirc_server *server){
     int i;
-    int clientSocket = client->clientSocket;
     char reply[MAXMSG];
     char *replies[4] = {RPL_WELCOME,
                         RPL_YOURHOST,
                         RPL_CREATED,
                         RPL_MYINFO,
     };
-    pthread_mutex_lock(&lock);
+    CHIRC_TRACE1(register, client->clientSocket);
+    log_event(LOG_REGISTER, client->clientSocket, 0, 0, client->nick);
+    chirc_lock(&lock);
     (server->numregistered)++;
-    pthread_mutex_unlock(&lock);
+    chirc_unlock(&lock);
     
     for (i = 0; i < 4; i++){
         constr_reply(replies[i], client, reply , server, NULL);
         
-        pthread_mutex_lock(&(client->c_lock));
-        if(send(clientSocket, reply, strlen(reply), 0) == -1)
-        {
-            perror("Socket send() failed");
-            user_exit(server, client);
-        }
-        pthread_mutex_unlock(&(client->c_lock));
+        user_send(server, client, reply);
     }
     
     chirc_handle_LUSERS(server, client, NULL);
     chirc_handle_MOTD(server, client, NULL);
 }
 
-//send RPL_NAMREPLY for given channel to given user
-void send_names(chirc_server *server, channel *chan, person *user){
-    int clientSocket = user->clientSocket;
+//appends RPL_NAMREPLY for chan to out, split over as many replies as its names need.
+//call with lock held
+void names_reply(chirc_server *server, channel *chan, person *user, outbuf *out){
     char chanusers[MAXMSG];
     char reply[MAXMSG];
-    person *someuser;
-    int buff;
-    mychan *userchan;
-    el_indicator *seek_arg = malloc(sizeof(el_indicator));
-    int first = 1;
-    
-    seek_arg->field = CHAN;
-    
-    pthread_mutex_lock(&(chan->chan_lock));
-    sprintf(chanusers, "= %s :", chan->name);
-    seek_arg->value = chan->name;           //may be safer to use strcpy here, but need to allocate space for seek_arg->value
-    pthread_mutex_unlock(&(chan->chan_lock));
+    char *p = chan->names, *end = chan->names + chan->nameslen;
+    char *cut;
+    int start, len;
     
-    pthread_mutex_lock(&lock);
-    list_iterator_start(server->userlist);
-    while(list_iterator_hasnext(server->userlist) && strlen(chanusers) < MAXMSG - 3){   //must be 3 less than MAXMSG so adding space and two mode chars won't cause overflow
-        someuser = list_iterator_next(server->userlist);
-        pthread_mutex_lock(&(someuser->c_lock));
-        userchan = (mychan *)list_seek(someuser->my_chans, seek_arg);
-        if (userchan != NULL) { //user is a member of chan
-            if(!first)
-                strcat(chanusers, " ");
-            if(strchr(userchan->mode, (int) 'o') != NULL)
-                strcat(chanusers, "@");
-            if(strchr(userchan->mode, (int) 'v') != NULL)
-                strcat(chanusers, "+");
-            buff = MAXMSG - strlen(reply);
-            strncat(chanusers, someuser->nick, buff);
-            first = 0;
+    start = snprintf(chanusers, MAXMSG, "= %s :", chan->name);
+    while (p < end) {
+        //take as many whole entries as fit, always at least one
+        len = end - p;
+        if (start + len > MAXCHANLINE) {
+            for (cut = p + MAXCHANLINE - start; cut > p && *cut != ' '; cut--)
+                ;
+            if (cut <= p)
+                cut = strchr(p, ' ');
+            len = cut - p + 1;
         }
-        pthread_mutex_unlock(&(someuser->c_lock));
+        snprintf(chanusers + start, MAXMSG - start, "%.*s", len - 1, p);   //without the trailing space
+        constr_reply(RPL_NAMREPLY, user, reply, server, chanusers);
+        outbuf_add(out, reply);
+        p += len;
     }
-    list_iterator_stop(server->userlist);
-    pthread_mutex_unlock(&lock);
+}
+
+void send_names(chirc_server *server, channel *chan, person *user){
+    outbuf out;
     
-    constr_reply(RPL_NAMREPLY, user, reply, server, chanusers);
-    pthread_mutex_lock(&(user->c_lock));
-    if(send(clientSocket, reply, strlen(reply), 0) == -1){
-        perror("Socket send() failed");
-        user_exit(server, user);
-    }
-    pthread_mutex_unlock(&(user->c_lock));
-                             
-    free(seek_arg);
-    return;
+    outbuf_init(&out);
+    chirc_lock(&lock);
+    names_reply(server, chan, user, &out);
+    chirc_unlock(&lock);
+    outbuf_send(server, user, &out);
 }
 
 int fun_seek(const void *el, const void *indicator){
@@ -357,53 +434,196 @@ int fun_seek(const void *el, const void *indicator){
     }
 }
 
+//hashes for the list indexes that speed up fun_seek: userlist by NICK and FD, and a
+//user's channels by USERCHAN (which fun_compare agrees with, so list_contains uses it
+//too). each *_seek hashes what an indicator for that field looks for
+list_hash_t hash_nick(const void *el){
+    return list_hashcomputer_string(((person *)el)->nick);
+}
+
+int hash_nick_seek(const void *indicator, list_hash_t *hash){
+    const el_indicator *el_info = (const el_indicator *)indicator;
+    
+    if (el_info->field != NICK)
+        return -1;
+    *hash = list_hashcomputer_string(el_info->value);
+    return 0;
+}
+
+list_hash_t hash_fd(const void *el){
+    return ((person *)el)->clientSocket;
+}
+
+int hash_fd_seek(const void *indicator, list_hash_t *hash){
+    const el_indicator *el_info = (const el_indicator *)indicator;
+    
+    if (el_info->field != FD)
+        return -1;
+    *hash = el_info->fd;
+    return 0;
+}
+
+list_hash_t hash_userchan(const void *el){
+    return list_hashcomputer_string(((mychan *)el)->name);
+}
+
+int hash_userchan_seek(const void *indicator, list_hash_t *hash){
+    const el_indicator *el_info = (const el_indicator *)indicator;
+    
+    if (el_info->field != USERCHAN)
+        return -1;
+    *hash = list_hashcomputer_string(el_info->value);
+    return 0;
+}
+
+//writes the letters of the modes set in mode to buf, which needs room for 27 chars
+char *mode_string(unsigned int mode, char *buf){
+    char *p = buf;
+    char c;
+    
+    for (c = 'a'; c <= 'z'; c++)
+        if (mode & MODE_BIT(c))
+            *p++ = c;
+    *p = '\0';
+    return buf;
+}
+
+void outbuf_init(outbuf *out){
+    out->data = NULL;
+    out->len = 0;
+    out->size = 0;
+}
+
+//queues msg at the end of out
+void outbuf_add(outbuf *out, char *msg){
+    outbuf_addn(out, msg, strlen(msg));
+}
+
+//queues the len bytes at msg, which need not be terminated. the first
+//OUTBUF_CHUNK bytes come from the thread's pool; only long replies use malloc
+void outbuf_addn(outbuf *out, const char *msg, size_t len){
+    size_t size = out->size ? out->size : OUTBUF_CHUNK;
+    char *data;
+    
+    if (out->len + len + 1 > out->size) {
+        while (out->len + len + 1 > size)
+            size *= 2;
+        if (size == OUTBUF_CHUNK)
+            data = pool_alloc(POOL_OUTBUF);
+        else if (out->size == OUTBUF_CHUNK) {
+            data = malloc(size);
+            memcpy(data, out->data, out->len);
+            pool_free(POOL_OUTBUF, out->data);
+        }
+        else
+            data = realloc(out->data, size);
+        out->data = data;
+        out->size = size;
+    }
+    memcpy(out->data + out->len, msg, len);
+    out->len += len;
+    out->data[out->len] = '\0';
+}
+
+//sends everything queued in out to user and frees it
+int outbuf_send(chirc_server *server, person *user, outbuf *out){
+    int rc = 0;
+    
+    mem_charge(user, MEM_OUTBUF, out->size);
+    if (out->len)
+        rc = user_send(server, user, out->data);
+    mem_charge(user, MEM_OUTBUF, -(long) out->size);
+    if (out->size == OUTBUF_CHUNK)
+        pool_free(POOL_OUTBUF, out->data);
+    else
+        free(out->data);
+    outbuf_init(out);
+    return rc;
+}
+
+//starts a new recipient set. call with lock held; the set is only valid until lock is released
+void fanout_begin(void){
+    fanout_epoch++;
+}
+
+//adds someone to the current recipient set. returns 1 if they were not already in it
+int fanout_mark(person *someone){
+    if (someone->mark == fanout_epoch)
+        return 0;
+    someone->mark = fanout_epoch;
+    return 1;
+}
+
 void sendtochannel(chirc_server *server, channel *chan, char *msg, char *sender){
-    int chanSocket;
+    list_iter_t it;
     person *user;
     char *cname = chan->name;
-    mychan *dummy = malloc(sizeof(mychan));
-    strcpy(dummy->name, cname);
+    int recipients = 0;
     
-    pthread_mutex_lock(&(lock));
-    list_iterator_start(server->userlist);
-    while(list_iterator_hasnext(server->userlist)){
-        user = (person *)list_iterator_next(server->userlist);
-        if ((sender == NULL || strcmp(user->nick, sender) != 0) && list_contains(user->my_chans, dummy)){
-            pthread_mutex_lock(&(user->c_lock));    //should actually lock before reading user_nick, but that causes deadlock--deal with this later
-            chanSocket = user->clientSocket;
-            if(send(chanSocket, msg, strlen(msg), 0) == -1)
-            {
-                perror("Socket send() failed");
-                user_exit(server, user);
-            }   
-            pthread_mutex_unlock(&(user->c_lock));
+    //nobody passes a sender with actors running
+    if (actor_enabled()) {
+        actor_relay(chan, msg);
+        return;
+    }
+    CHIRC_TRACE2(fanout__start, cname, strlen(msg));
+    chirc_lock(&(lock));
+    list_iter_start(&it, chan->members);
+    while(list_iter_hasnext(&it)){
+        user = (person *)list_iter_next(&it);
+        if (sender == NULL || strcmp(user->nick, sender) != 0){
+            user_send(server, user, msg);   //should actually lock before reading user_nick, but that causes deadlock--deal with this later
+            recipients++;
         }
     }
-    list_iterator_stop(server->userlist);
-    pthread_mutex_unlock(&lock);
-    free(dummy);
+    chirc_unlock(&lock);
+    CHIRC_TRACE2(fanout__done, cname, recipients);
 }
 
-//sends message to all channels a user is on. does not return message to sender
+//sends message once to everyone who shares a channel with user, however many channels
+//they share. does not return message to sender. call on user's own thread, the only
+//one that changes their channels, so they can be read without c_lock
 void sendtoallchans(chirc_server *server, person *user, char *msg){
-    el_indicator *seek_arg = malloc(sizeof(el_indicator));
-    seek_arg->field = CHAN;
-    mychan *dummy;
+    list_iter_t chanit, memberit;
     channel *chan;
+    person *member;
+    person *stack_recips[FANOUT_STACK];
+    person **recips = stack_recips;
+    int recipients = 0, maxrecips = 0, i;
+    
+    CHIRC_TRACE2(fanout__start, user->nick, strlen(msg));
+    if (actor_enabled())
+        actor_flush(user);
+    //recipients are collected under lock and sent to once it is released, so one
+    //that isn't reading holds up only this thread
+    chirc_lock(&lock);
+    list_iter_start(&chanit, user->my_chans);
+    while(list_iter_hasnext(&chanit))
+        maxrecips += list_size(((mychan *)list_iter_next(&chanit))->chan->members);
+    if (maxrecips > FANOUT_STACK)
+        recips = malloc(maxrecips * sizeof(person *));
+    fanout_begin();
+    fanout_mark(user);
+    list_iter_start(&chanit, user->my_chans);
+    while(list_iter_hasnext(&chanit)){
+        chan = ((mychan *)list_iter_next(&chanit))->chan;
+        list_iter_start(&memberit, chan->members);
+        while(list_iter_hasnext(&memberit)){
+            member = (person *)list_iter_next(&memberit);
+            if (fanout_mark(member)){
+                user_ref(member);
+                recips[recipients++] = member;
+            }
+        }
+    }
+    chirc_unlock(&lock);
     
-    pthread_mutex_lock(&(user->c_lock));
-    list_iterator_start(user->my_chans);
-    while(list_iterator_hasnext(user->my_chans)){
-          dummy = (mychan *)list_iterator_next(user->my_chans);
-          seek_arg->value = dummy->name;
-          pthread_mutex_lock(&lock);
-          chan = (channel *)list_seek(server->chanlist, seek_arg);
-          pthread_mutex_unlock(&lock);
-          sendtochannel(server, chan, msg, user->nick);
+    for(i = 0; i < recipients; i++){
+        user_send(server, recips[i], msg);
+        user_put(recips[i]);
     }
-    list_iterator_stop(user->my_chans);
-    pthread_mutex_unlock(&(user->c_lock));
-    free(seek_arg);
+    if (recips != stack_recips)
+        free(recips);
+    CHIRC_TRACE2(fanout__done, user->nick, recipients);
 }
 
 int fun_compare(const void *a, const void *b){
@@ -420,64 +640,86 @@ int fun_compare(const void *a, const void *b){
         return -1;
 }
 
-void channel_destroy(chirc_server *server, channel *chan){
-    pthread_mutex_lock(&(chan->chan_lock));
-    //make sure it should actually be destroyed
-    if (chan->numusers != 0) {
-        pthread_mutex_unlock(&(chan->chan_lock));
-        return;
-    }
-    pthread_mutex_lock(&lock);
-    list_delete(server->chanlist, chan);
-    pthread_mutex_unlock(&lock);
-    pthread_mutex_unlock(&(chan->chan_lock));
-    
-    pthread_mutex_destroy(&(chan->chan_lock));
-    
-    //free(chan);
-    return;
+//marks user's connection as closing and shuts its socket down. its own thread
+//sees that as end of file and calls user_exit. safe on any thread, holding any locks
+void user_close(person *user){
+    if (__sync_bool_compare_and_swap(&(user->closing), 0, 1))
+        shutdown(user->clientSocket, SHUT_RDWR);
+}
+
+//keeps user's struct, which lives on its thread's stack, from going away while it
+//is used outside lock. take it with lock held, while user is still on the userlist
+//or one of the channels it was found through, and drop it with user_put
+void user_ref(person *user){
+    __sync_fetch_and_add(&(user->refs), 1);
 }
 
-void user_exit(chirc_server *server, person *user){         //removes all information about user and frees all associated structs/memory
-    pthread_t userid = user->tid;
-    el_indicator *seek_arg = malloc(sizeof(el_indicator));
-    seek_arg->field = CHAN;
+void user_put(person *user){
+    __sync_fetch_and_sub(&(user->refs), 1);
+}
+
+//removes all information about user and frees all associated structs/memory. only
+//ever called on user's own thread, which it ends; anyone else calls user_close
+void user_exit(chirc_server *server, person *user){
+    struct timespec wait = { 0, 1000000 };
+    list_iter_t it;
     channel *chan;
-    mychan *dummy = malloc(sizeof(mychan));
-    pthread_mutex_lock(&(user->c_lock));
-    close(user->clientSocket);
-    //if user is a member of any channels, decrement those channels numuser counters
-    list_iterator_start(user->my_chans);
-    while(list_iterator_hasnext(user->my_chans)){
-        dummy = (mychan *)list_iterator_next(user->my_chans);
-        seek_arg->value = dummy->name;
-        pthread_mutex_lock(&lock);
-        chan = (channel *)list_seek(server->chanlist, seek_arg);
-        pthread_mutex_unlock(&lock);
-        pthread_mutex_lock(&(chan->chan_lock));
-        (chan->numusers)--;
-        pthread_mutex_unlock(&(chan->chan_lock));
-        if(chan->numusers == 0)
-            channel_destroy(server, chan);
-    }
-    list_iterator_stop(user->my_chans);
+    mychan *userchan;
     
-    //free memory and delete user from userlist
-    list_destroy(user->my_chans);
-    free(user->address);
+    //set under c_lock so a send already past its first check of closing is done
+    //with the fd before it is closed, and any later send sees it
+    chirc_lock(&(user->c_lock));
+    __atomic_store_n(&(user->closing), 1, __ATOMIC_RELEASE);
+    chirc_unlock(&(user->c_lock));
+    //the actors take the user off their channels, and nothing is sent to the
+    //user once they have
+    if (actor_enabled()) {
+        list_iter_start(&it, user->my_chans);
+        while(list_iter_hasnext(&it))
+            actor_leave(((mychan *)list_iter_next(&it))->chan, user);
+        actor_flush(user);
+    }
+    CHIRC_TRACE1(disconnect, user->clientSocket);
+    log_event(LOG_DISCONNECT, user->clientSocket, 0, 0, user->nick);
+    capture_close(user->clientSocket);
     
-    pthread_mutex_lock(&lock);
+    //off the userlist and every channel in one go, so nobody finds the user half gone.
+    //c_lock is not held here: everyone else takes lock before c_lock
+    chirc_lock(&lock);
     list_delete(server->userlist, user);
     server->numregistered--;
-    pthread_mutex_unlock(&lock);
+    if (!actor_enabled()) {
+        list_iter_start(&it, user->my_chans);
+        while(list_iter_hasnext(&it)){
+            chan = ((mychan *)list_iter_next(&it))->chan;
+            list_delete(chan->members, user);
+            names_patch(chan, user->nick, NULL, 0);
+        }
+    }
+    chirc_unlock(&lock);
     
-    pthread_mutex_unlock(&(user->c_lock));
-    pthread_mutex_destroy(&(user->c_lock));
+    //fan-outs that found the user before that may still be using the struct
+    while (__atomic_load_n(&(user->refs), __ATOMIC_SEQ_CST) > 0)
+        nanosleep(&wait, NULL);
     
-    free(seek_arg);
-    free(dummy);
-    if(userid == pthread_self())
-        pthread_exit(NULL);
-    else
-        pthread_cancel(userid);
+    mem_close(user);
+    transport_close(user->clientSocket);
+    //drop each membership's reference to its channel
+    list_iter_start(&it, user->my_chans);
+    while(list_iter_hasnext(&it)){
+        userchan = (mychan *)list_iter_next(&it);
+        chan = userchan->chan;
+        chirc_lock(&(chan->chan_lock));
+        (chan->numusers)--;
+        chirc_unlock(&(chan->chan_lock));
+        directory_changed(server);
+        chanmap_put(server->chans, chan);
+        pool_free(POOL_MYCHAN, userchan);
+    }
+    
+    //free memory
+    list_destroy(user->my_chans);
+    free(user->address);
+    pthread_mutex_destroy(&(user->c_lock));
+    pthread_exit(NULL);
 }
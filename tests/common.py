@@ -144,18 +144,27 @@ class ChircClient(object):
 class ChircTestCase(unittest.TestCase):
     
     CHIRC_EXE = "./chirc"
+    CHIRC_CONF = None       # contents of a configuration file to start chirc with
+    CHIRC_LOG = False       # send chirc's output to chirc.log in tmpdir
     MESSAGE_TIMEOUT = 1.0
     INTERTEST_PAUSE = 0.0
     
     def setUp(self):
         self.tmpdir = tempfile.mkdtemp()
-        
-        if tests.DEBUG:
+        args = [os.path.abspath(ChircTestCase.CHIRC_EXE), "-p", "7776", "-o", OPER_PASSWD]
+        if self.CHIRC_CONF is not None:
+            self.write_conf(self.CHIRC_CONF)
+            args += ["-f", "chirc.conf"]
+        
+        if self.CHIRC_LOG:
+            stdout = open(self.tmpdir + "/chirc.log", "w")
+            stderr = subprocess.STDOUT
+        elif tests.DEBUG:
             stdout = stderr = None
         else:
             stdout = open('/dev/null', 'w')
             stderr = subprocess.STDOUT 
-        self.chirc_proc = subprocess.Popen([os.path.abspath(ChircTestCase.CHIRC_EXE), "-p", "7776", "-o", OPER_PASSWD], stdout=stdout, stderr=stderr, cwd = self.tmpdir)
+        self.chirc_proc = subprocess.Popen(args, stdout=stdout, stderr=stderr, cwd = self.tmpdir)
         rc = self.chirc_proc.poll()        
         if rc != None:
             self.fail("chirc process failed to start. rc = %i" % rc)
@@ -170,9 +179,16 @@ class ChircTestCase(unittest.TestCase):
             self.fail("chirc process failed during test. rc = %i" % rc)
             shutil.rmtree(self.tmpdir)
         self.chirc_proc.terminate()
+        # the next test's server can't have the port until this one is gone
+        self.chirc_proc.wait()
         shutil.rmtree(self.tmpdir)
         time.sleep(self.INTERTEST_PAUSE)
     
+    def write_conf(self, conf):
+        conff = open(self.tmpdir + "/chirc.conf", "w")
+        conff.write(conf)
+        conff.close()
+    
     def get_client(self):
         c = ChircClient(msg_timeout = self.MESSAGE_TIMEOUT)
         self.clients.append(c)
@@ -7,6 +7,8 @@ RPL_LUSEROP = "252"
 RPL_LUSERUNKNOWN = "253"
 RPL_LUSERCHANNELS = "254"
 RPL_LUSERME = "255"
+RPL_ENDOFSTATS = "219"
+RPL_STATSDEBUG = "249"
 RPL_AWAY = "301"
 RPL_UNAWAY = "305"
 RPL_NOWAWAY = "306"
@@ -32,6 +34,8 @@ RPL_YOUREOPER = "381"
 ERR_NOSUCHNICK = "401"
 ERR_NOSUCHCHANNEL = "403"
 ERR_CANNOTSENDTOCHAN = "404"
+ERR_TOOMANYTARGETS = "407"
+ERR_NORECIPIENT = "411"
 ERR_UNKNOWNCOMMAND = "421"
 ERR_NOMOTD = "422"
 ERR_NICKNAMEINUSE = "433"
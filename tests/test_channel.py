@@ -1,3 +1,7 @@
+import os
+import signal
+import socket
+import shutil
 import tests.replies as replies
 import time
 import re
@@ -26,6 +30,31 @@ class JOIN(ChircTestCase):
         client1.send_cmd("JOIN #test")
         self.assertRaises(ReplyTimeoutException, self.get_reply, client1) 
     
+    @score(category="CHANNEL_JOIN")
+    def test_join_multi(self):
+        client1 = self._connect_user("user1", "User One")
+        
+        client1.send_cmd("JOIN #test1,#test2,#test1")
+        
+        self._test_join(client1, "user1", "#test1")
+        self._test_join(client1, "user1", "#test2")
+        self.assertRaises(ReplyTimeoutException, self.get_reply, client1) 
+    
+    @score(category="CHANNEL_JOIN")
+    def test_join_too_many(self):
+        client1 = self._connect_user("user1", "User One")
+        
+        channels = ["#test%i" % i for i in range(22)]
+        client1.send_cmd("JOIN %s" % ",".join(channels))
+        
+        for channel in channels[:20]:
+            self._test_join(client1, "user1", channel)
+        for channel in channels[20:]:
+            self.get_reply(client1, expect_code = replies.ERR_TOOMANYTARGETS, expect_nick = "user1",
+                           expect_nparams = 2, expect_short_params = [channel],
+                           long_param_re = "Too many recipients")
+        self.assertRaises(ReplyTimeoutException, self.get_reply, client1) 
+    
     @score(category="CHANNEL_JOIN")
     def test_join3(self):
         clients = self._clients_connect(5)
@@ -205,6 +234,47 @@ class PART(ChircTestCase):
                                expect_nparams = 2, expect_short_params = ["#test"],
                                long_param_re = "No such channel")      
     
+    @score(category="CHANNEL_PART")
+    def test_channel_part_multi(self):
+        client1 = self._connect_user("user1", "User One")
+        
+        client1.send_cmd("JOIN #test1,#test2")
+        self._test_join(client1, "user1", "#test1")
+        self._test_join(client1, "user1", "#test2")
+        
+        client1.send_cmd("PART #test1,#test3,#test2 :Bye")
+        
+        self._test_relayed_part(client1, from_nick="user1", channel="#test1", msg="Bye")
+        self.get_reply(client1, expect_code = replies.ERR_NOSUCHCHANNEL, expect_nick = "user1", 
+                       expect_nparams = 2, expect_short_params = ["#test3"],
+                       long_param_re = "No such channel")
+        self._test_relayed_part(client1, from_nick="user1", channel="#test2", msg="Bye")
+    
+    @score(category="CHANNEL_PART")
+    def test_channel_part_recreate(self):
+        client1 = self._connect_user("user1", "User One")
+        client2 = self._connect_user("user2", "User Two")
+
+        client1.send_cmd("JOIN #test")
+        self._test_join(client1, "user1", "#test", expect_names = ["@user1"])
+        client2.send_cmd("JOIN #test")
+        self._test_join(client2, "user2", "#test", expect_names = ["@user1", "user2"])
+        self._test_relayed_join(client1, "user2", "#test")
+
+        client1.send_cmd("PART #test")
+        self._test_relayed_part(client1, from_nick="user1", channel="#test", msg=None)
+        self._test_relayed_part(client2, from_nick="user1", channel="#test", msg=None)
+        client2.send_cmd("PART #test")
+        self._test_relayed_part(client2, from_nick="user2", channel="#test", msg=None)
+
+        # the last PART destroyed the channel, so this creates a fresh one
+        client1.send_cmd("PART #test")
+        self.get_reply(client1, expect_code = replies.ERR_NOSUCHCHANNEL, expect_nick = "user1",
+                       expect_nparams = 2, expect_short_params = ["#test"],
+                       long_param_re = "No such channel")
+        client2.send_cmd("JOIN #test")
+        self._test_join(client2, "user2", "#test", expect_names = ["@user2"])
+
     @score(category="CHANNEL_PART")
     def test_channel_part_nochannel2(self):
         clients = self._clients_connect(1, join_channel = "#test")
@@ -490,11 +560,44 @@ class NAMES(ChircTestCase):
         self.get_reply(users["user1"], expect_code = replies.RPL_ENDOFNAMES, expect_nick = "user1",
                        expect_nparams = 2)                
 
+    
+    def _get_names(self, client, nick):
+        # collects the names from every RPL_NAMREPLY up to RPL_ENDOFNAMES
+        names = []
+        numreplies = 0
+        while True:
+            reply = self.get_message(client)
+            if reply.cmd == replies.RPL_ENDOFNAMES:
+                return names, numreplies
+            if reply.cmd == replies.RPL_NAMREPLY:
+                self._test_names_single(reply, nick, expect_channel = "#test")
+                names += reply.params[3][1:].split(" ")
+                numreplies += 1
+    
+    @score(category="NAMES")
+    def test_names_multiline(self):
+        nicks = ["user%i_%s" % (i, "x" * 40) for i in range(12)]
+        clients = []
+        for nick in nicks:
+            client = self._connect_user(nick, "Long Nick")
+            client.send_cmd("JOIN #test")
+            self._get_names(client, nick)
+            clients.append(client)
+        
+        clients[-1].send_cmd("NICK renamed")
+        self._test_relayed_nick(clients[-1], from_nick=nicks[-1], newnick="renamed")
+        
+        clients[-1].send_cmd("NAMES #test")
+        names, numreplies = self._get_names(clients[-1], "renamed")
+        
+        expect_names = ["@" + nicks[0]] + nicks[1:-1] + ["renamed"]
+        self.assertGreater(numreplies, 1, "Expected NAMES for #test to span several replies")
+        self.assertEqual(sorted(names), sorted(expect_names))
 
 class LIST(ChircTestCase):
     
-    def _test_list(self, channels, client, nick, expect_topics = None):
-        client.send_cmd("LIST")
+    def _test_list(self, channels, client, nick, expect_topics = None, cmd = "LIST"):
+        client.send_cmd(cmd)
         
         channelsl = set([k for k in channels.keys() if k is not None])
         numchannels = len(channelsl)
@@ -565,6 +668,41 @@ class LIST(ChircTestCase):
                         expect_topics = {"#test1": "Topic One",
                         "#test2": "Topic Two",
                         "#test3": "Topic Three"})      
+    
+    @score(category="LIST")
+    def test_list_filter_users(self):
+        users = self._channels_connect(channels3)
+        
+        expect = dict([(k, v) for (k, v) in channels3.items() if k is not None and len(v) > 2])
+        self._test_list(expect, users["user1"], "user1", cmd = "LIST >2")
+    
+    @score(category="LIST")
+    def test_list_filter_mask(self):
+        users = self._channels_connect(channels3)
+        
+        expect = dict([(k, v) for (k, v) in channels3.items() if k is not None and len(v) < 3])
+        self._test_list(expect, users["user1"], "user1", cmd = "LIST #test*,<3")
+        self._test_list({}, users["user1"], "user1", cmd = "LIST #foo*")
+    
+    @score(category="LIST")
+    def test_list_filter_mask_literal(self):
+        channels = { "#a[b]": ("@user1",), "#ab": ("@user2",), None: ("user3",) }
+        users = self._channels_connect(channels)
+        
+        # [ is an ordinary character in masks; only * and ? are wildcards
+        self._test_list({"#a[b]": channels["#a[b]"]}, users["user3"], "user3", cmd = "LIST #a[b]")
+        self._test_list({"#a[b]": channels["#a[b]"]}, users["user3"], "user3", cmd = "LIST #a[*")
+        self._test_list({"#a[b]": channels["#a[b]"], "#ab": channels["#ab"]}, users["user3"], "user3", cmd = "LIST #a*b*")
+    
+    @score(category="LIST")
+    def test_list_filter_topic(self):
+        users = self._channels_connect(channels2)
+        
+        users["user1"].send_cmd("TOPIC #test1 :Topic One")
+        self._test_relayed_topic(users["user1"], from_nick="user1", channel="#test1", topic="Topic One")
+        
+        self._test_list({"#test1": channels2["#test1"]}, users["user10"], "user10",
+                        expect_topics = {"#test1": "Topic One"}, cmd = "LIST T<60")
 
 
 class WHO(ChircTestCase):
@@ -705,6 +843,12 @@ class WHO(ChircTestCase):
         self._test_who(channels3, users["user1"], "user1", channel = "#test5", aways = aways, ircops = ircops)                            
 
 
+class WHO_CHUNKED(WHO):
+    # every reply goes out on its own, so WHO is streamed a piece at a time
+    CHIRC_CONF = """list_chunk = 1
+"""
+
+
 class UPDATE1b(ChircTestCase):
     
     @score(category="UPDATE_1B")
@@ -738,4 +882,208 @@ class UPDATE1b(ChircTestCase):
         client1.send_cmd("QUIT :I'm outta here")
         
         for nick, client in clients[1:]:
-            self._test_relayed_quit(client, from_nick=nick1, msg = "I'm outta here")          
\ No newline at end of file
+            self._test_relayed_quit(client, from_nick=nick1, msg = "I'm outta here")              
+    @score(category="UPDATE_1B")
+    def test_update1b_nick_shared_channels(self):
+        clients = self._clients_connect(3, join_channel = "#test1")
+        self._clients_join(clients, "#test2")
+        
+        nick1, client1 = clients[0]
+        
+        client1.send_cmd("NICK userfoo")
+        
+        # peers share two channels with user1, but only hear about the change once
+        for nick, client in clients:
+            self._test_relayed_nick(client, from_nick=nick1, newnick="userfoo")
+        for nick, client in clients:
+            self.assertRaises(ReplyTimeoutException, self.get_reply, client)
+
+
+class UPGRADE(ChircTestCase):
+    
+    CHIRC_LOG = True
+    
+    def setUp(self):
+        ChircTestCase.setUp(self)
+        self.new_pid = None
+    
+    def tearDown(self):
+        for c in self.clients[:]:
+            self.disconnect_client(c)
+        if self.new_pid is not None:
+            os.kill(self.new_pid, signal.SIGTERM)
+            # it isn't our child, so wait for the port to be free instead
+            for i in range(50):
+                try:
+                    socket.create_connection(("localhost", 7776), 0.1).close()
+                    time.sleep(0.1)
+                except socket.error:
+                    break
+        else:
+            self.chirc_proc.terminate()
+        self.chirc_proc.wait()
+        shutil.rmtree(self.tmpdir)
+    
+    def _upgrade(self):
+        self.chirc_proc.send_signal(signal.SIGUSR2)
+        self.assertEqual(self.chirc_proc.wait(), 0, "Old server did not exit after handing over")
+        log = open(self.tmpdir + "/chirc.log").read()
+        match = re.search(r" upgrade pid=(\d+)", log)
+        self.assertIsNotNone(match, "No handover in the server log: %s" % log)
+        self.new_pid = int(match.group(1))
+    
+    def test_upgrade_keeps_clients(self):
+        clients = self._clients_connect(3, join_channel = "#test")
+        nick1, client1 = clients[0]
+        nick2, client2 = clients[1]
+        
+        client1.send_cmd("TOPIC #test :Before the upgrade")
+        for nick, client in clients:
+            self._test_relayed_topic(client, from_nick=nick1, channel="#test", topic="Before the upgrade")
+        self.get_reply(client1, expect_code = replies.RPL_TOPIC, expect_nick = nick1)
+        
+        # half a line before the upgrade, the rest after
+        client2.client.write("PRIVMSG #test :Hello ")
+        time.sleep(0.1)
+        self._upgrade()
+        client2.client.write("from the other side\r\n")
+        
+        for nick, client in [clients[0], clients[2]]:
+            self._test_relayed_privmsg(client, from_nick=nick2, recip="#test", msg="Hello from the other side")
+        
+        client1.send_cmd("TOPIC #test")
+        self.get_reply(client1, expect_code = replies.RPL_TOPIC, expect_nick = nick1,
+                       expect_nparams = 2, expect_short_params = ["#test"], long_param_re = "Before the upgrade")
+        
+        # membership modes came along, so user1 is still the operator
+        client1.send_cmd("NAMES #test")
+        self._test_names(client1, nick1, expect_channel = "#test", expect_names = ["@user1", "user2", "user3"])
+        
+        # and the listening socket did too
+        client4 = self._connect_user("user4", "User Four")
+        client4.send_cmd("JOIN #test")
+        self._test_join(client4, "user4", "#test", expect_topic = "Before the upgrade",
+                        expect_names = ["@user1", "user2", "user3", "user4"])
+
+
+class HISTORY(ChircTestCase):
+    
+    CHIRC_CONF = """history_lines = 3
+"""
+    
+    @score(category="CHANNEL_JOIN")
+    def test_history_replayed_on_join(self):
+        client1 = self._connect_user("user1", "User One")
+        client1.send_cmd("JOIN #test")
+        self._test_join(client1, "user1", "#test")
+        client1.send_cmd("JOIN #other")
+        self._test_join(client1, "user1", "#other")
+        
+        for i in range(4):
+            client1.send_cmd("PRIVMSG #test :Message %i" % i)
+        client1.send_cmd("NOTICE #test :Notice")
+        client1.send_cmd("PRIVMSG #other :Elsewhere")
+        # once this is answered everything above has been recorded
+        client1.send_cmd("PING :sync")
+        self.get_message(client1, expect_cmd = "PONG")
+        
+        # only the last three, and only from #test
+        client2 = self._connect_user("user2", "User Two")
+        client2.send_cmd("JOIN #test")
+        self._test_join(client2, "user2", "#test", expect_names = ["@user1", "user2"])
+        for i in (2, 3):
+            self._test_relayed_privmsg(client2, from_nick="user1", recip="#test", msg="Message %i" % i)
+        reply = self.get_message(client2, expect_prefix = True, expect_cmd = "NOTICE",
+                                 expect_nparams = 2, expect_short_params = ["#test"], long_param_re = "Notice")
+        self.assertRaises(ReplyTimeoutException, self.get_reply, client2)
+        
+        # the members already there don't see the replay
+        self._test_relayed_join(client1, from_nick="user2", channel="#test")
+        self.assertRaises(ReplyTimeoutException, self.get_reply, client1)
+    
+    @score(category="CHANNEL_JOIN")
+    def test_history_gone_with_channel(self):
+        client1 = self._connect_user("user1", "User One")
+        client1.send_cmd("JOIN #test")
+        self._test_join(client1, "user1", "#test")
+        client1.send_cmd("PRIVMSG #test :Hello")
+        client1.send_cmd("PART #test")
+        self._test_relayed_part(client1, from_nick="user1", channel="#test", msg=None)
+        
+        client2 = self._connect_user("user2", "User Two")
+        client2.send_cmd("JOIN #test")
+        self._test_join(client2, "user2", "#test", expect_names = ["@user2"])
+        self.assertRaises(ReplyTimeoutException, self.get_reply, client2)
+
+
+# the same tests, with every channel run by an actor
+
+class JOIN_ACTORS(JOIN):
+    CHIRC_CONF = """channel_actors = 4
+"""
+
+class PRIVMSG_ACTORS(PRIVMSG):
+    CHIRC_CONF = """channel_actors = 4
+"""
+
+class PART_ACTORS(PART):
+    CHIRC_CONF = """channel_actors = 4
+"""
+
+class TOPIC_ACTORS(TOPIC):
+    CHIRC_CONF = """channel_actors = 4
+"""
+
+class HISTORY_ACTORS(HISTORY):
+    CHIRC_CONF = """history_lines = 3
+channel_actors = 4
+"""
+
+class ACTORS(ChircTestCase):
+    
+    CHIRC_CONF = """channel_actors = 2
+"""
+    
+    @score(category="CHANNEL_PRIVMSG_NOTICE")
+    def test_actor_keeps_order(self):
+        clients = self._clients_connect(3, join_channel = "#test")
+        nick1, client1 = clients[0]
+        nick2, client2 = clients[1]
+        nick3, client3 = clients[2]
+        
+        # more than one turn's worth, from two senders at once
+        for i in range(150):
+            client1.send_cmd("PRIVMSG #test :One %i" % i)
+            client2.send_cmd("PRIVMSG #test :Two %i" % i)
+        ones = twos = 0
+        while ones < 150 or twos < 150:
+            reply = self.get_message(client3, expect_prefix = True, expect_cmd = "PRIVMSG", expect_nparams = 2)
+            if reply.prefix.nick == nick1:
+                self.assertEqual(reply.params[-1], ":One %i" % ones)
+                ones += 1
+            else:
+                self.assertEqual(reply.params[-1], ":Two %i" % twos)
+                twos += 1
+        
+        # a user's channel message can't be overtaken by their direct one
+        client1.send_cmd("PRIVMSG #test :Channel")
+        client1.send_cmd("PRIVMSG %s :Direct" % nick3)
+        self._test_relayed_privmsg(client3, from_nick=nick1, recip="#test", msg="Channel")
+        self._test_relayed_privmsg(client3, from_nick=nick1, recip=nick3, msg="Direct")
+    
+    @score(category="CHANNEL_PRIVMSG_NOTICE")
+    def test_actor_quit_while_busy(self):
+        clients = self._clients_connect(3, join_channel = "#test")
+        nick1, client1 = clients[0]
+        nick2, client2 = clients[1]
+        nick3, client3 = clients[2]
+        
+        for i in range(100):
+            client1.send_cmd("PRIVMSG #test :Message %i" % i)
+        client1.send_cmd("QUIT :Gone")
+        for i in range(100):
+            self._test_relayed_privmsg(client2, from_nick=nick1, recip="#test", msg="Message %i" % i)
+        self._test_relayed_quit(client2, from_nick=nick1, msg="Gone")
+        
+        client2.send_cmd("NAMES #test")
+        self._test_names(client2, nick2, expect_channel = "#test", expect_names = [nick2, nick3])
@@ -1,6 +1,10 @@
+import os
+import socket
+import struct
+import threading
 import tests.replies as replies
 import time
-from tests.common import ChircTestCase, ChircClient
+from tests.common import ChircTestCase, ChircClient, OPER_PASSWD
 from tests.scores import score
 
 class BasicConnection(ChircTestCase):
@@ -89,3 +93,250 @@ class MultiuserConnection(ChircTestCase):
                                expect_short_params = ["user1"],
                                long_param_re = "Nickname is already in use")
         
+
+class AdmissionControl(ChircTestCase):
+    
+    CHIRC_CONF = """max_clients_per_ip = 2
+"""
+    
+    def _test_shed(self, client, reason):
+        self.get_message(client, expect_prefix = False, expect_cmd = "ERROR", expect_nparams = 1,
+                         long_param_re = "Closing Link: \S+ \(%s\)" % reason)
+    
+    @score(category="CONNECTION_REGISTRATION")
+    def test_connect_per_ip_limit(self):
+        self._connect_user("user1", "User One")
+        self._connect_user("user2", "User Two")
+        
+        client3 = self.get_client()
+        self._test_shed(client3, "Too many connections from your host")
+    
+    @score(category="CONNECTION_REGISTRATION")
+    def test_connect_limit_released(self):
+        client1 = self._connect_user("user1", "User One")
+        self._connect_user("user2", "User Two")
+        
+        client1.send_cmd("QUIT")
+        self.disconnect_client(client1)
+        time.sleep(0.2)
+        
+        # user1's connection no longer counts
+        self._connect_user("user3", "User Three")
+
+class EventLog(ChircTestCase):
+    
+    CHIRC_CONF = """log_file = events.log
+log_max_bytes = 600
+log_keep = 1
+"""
+    
+    def _read_log(self, name = "events.log"):
+        # the writer thread empties the rings a few times a second
+        time.sleep(0.2)
+        return open(self.tmpdir + "/" + name).read()
+    
+    @score(category="CONNECTION_REGISTRATION")
+    def test_log_register_quit(self):
+        client1 = self._connect_user("user1", "User One")
+        client1.send_cmd("QUIT")
+        self.disconnect_client(client1)
+        
+        log = self._read_log()
+        self.assertRegexpMatches(log, r" info connect fd=\d+ host=\S+\n")
+        self.assertRegexpMatches(log, r" info register fd=\d+ nick=user1\n")
+        self.assertRegexpMatches(log, r" info disconnect fd=\d+ nick=user1\n")
+    
+    @score(category="CONNECTION_REGISTRATION")
+    def test_log_rotate(self):
+        for i in range(10):
+            self._connect_user("user%i" % i, "User %i" % i)
+            time.sleep(0.1)
+        
+        self.assertLessEqual(len(self._read_log()), 600)
+        self.assertIn("register", self._read_log("events.log.1"))
+        self.assertFalse(os.path.exists(self.tmpdir + "/events.log.2"))
+
+class MemoryBudget(ChircTestCase):
+    
+    CHIRC_LOG = True
+    CHIRC_CONF = """mem_budget = 200000
+"""
+    
+    def _connect_raw(self, nick):
+        # a small receive buffer, so whatever it doesn't read piles up in the server
+        s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        s.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 4096)
+        s.connect(("localhost", 7776))
+        s.sendall("NICK %s\r\nUSER %s * * :Never Reads\r\nJOIN #test\r\n" % (nick, nick))
+        return s
+    
+    def _stats_mem(self, client, nick):
+        client.send_cmd("STATS z")
+        self.get_reply(client, expect_code = replies.RPL_STATSDEBUG, expect_nick = nick, expect_nparams = 1,
+                       long_param_re = "mem total=\d+ budget=200000 connections=2 history=0 pressure=0 share=0")
+        lines = []
+        for i in range(2):
+            reply = self.get_reply(client, expect_code = replies.RPL_STATSDEBUG, expect_nick = nick, expect_nparams = 1,
+                                   long_param_re = "mem \S+ fd=\d+ sendq=\d+ channels=\d+ outbuf=\d+")
+            lines.append(reply.params[-1])
+        self.get_reply(client, expect_code = replies.RPL_ENDOFSTATS, expect_nick = nick,
+                       expect_short_params = ["z"])
+        return lines
+    
+    @score(category="CONNECTION_REGISTRATION")
+    def test_mem_stats(self):
+        oper = self._connect_user("oper", "Operator")
+        oper.send_cmd("OPER oper %s" % OPER_PASSWD)
+        self.get_reply(oper, expect_code = replies.RPL_YOUREOPER)
+        slow = self._connect_raw("slow")
+        time.sleep(0.2)
+        
+        # only slow is on a channel
+        lines = self._stats_mem(oper, "oper")
+        self.assertIn(" channels=0 ", [l for l in lines if l.startswith(":mem oper ")][0])
+        self.assertNotIn(" channels=0 ", [l for l in lines if l.startswith(":mem slow ")][0])
+        slow.close()
+    
+    @score(category="CONNECTION_REGISTRATION")
+    def test_mem_evict_non_reader(self):
+        clients = self._clients_connect(1, join_channel = "#test")
+        nick1, client1 = clients[0]
+        slow = self._connect_raw("slow")
+        self.get_message(client1, expect_cmd = "JOIN", expect_nparams = 1, expect_short_params = ["#test"])
+        
+        # everything relayed to slow stays in its sendq until it's shut down
+        closed = False
+        start = time.time()
+        while not closed and time.time() - start < 10:
+            client1.send_cmd("PRIVMSG #test :%s" % ("x" * 400))
+            try:
+                # fails once the server has reset the connection
+                slow.sendall("PONG :slow\r\n")
+            except socket.error:
+                closed = True
+        
+        # slow is gone, and the server is still answering
+        self.assertTrue(closed, "Connection that never reads was not shut down")
+        client1.send_cmd("PING :alive")
+        self.get_message(client1, expect_cmd = "PONG")
+        slow.close()
+        
+        time.sleep(0.2)
+        log = open(self.tmpdir + "/chirc.log").read()
+        self.assertRegexpMatches(log, r" warn evict fd=\d+ bytes=\d+ nick=slow\n")
+
+class Affinity(ChircTestCase):
+    
+    CHIRC_CONF = """accept_cpus = 0
+client_cpus = 0
+actor_cpus = 0
+channel_actors = 2
+"""
+    
+    def _cpus_allowed(self):
+        cpus = []
+        taskdir = "/proc/%i/task" % self.chirc_proc.pid
+        for tid in os.listdir(taskdir):
+            for line in open("%s/%s/status" % (taskdir, tid)):
+                if line.startswith("Cpus_allowed_list:"):
+                    cpus.append(line.split()[1])
+        return cpus
+    
+    @score(category="CONNECTION_REGISTRATION")
+    def test_pinned_threads(self):
+        clients = self._clients_connect(3, join_channel = "#test")
+        nick1, client1 = clients[0]
+        nick2, client2 = clients[1]
+        
+        client1.send_cmd("PRIVMSG #test :Pinned")
+        self._test_relayed_privmsg(client2, from_nick=nick1, recip="#test", msg="Pinned")
+        
+        # the accept thread, two actors and three connections at least
+        self.assertGreaterEqual(self._cpus_allowed().count("0"), 6)
+
+class Teardown(ChircTestCase):
+    
+    def _connect_raw(self, nick):
+        s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        s.connect(("localhost", 7776))
+        s.sendall("NICK %s\r\nUSER %s * * :Goes Away\r\nJOIN #test\r\n" % (nick, nick))
+        return s
+    
+    def _threads(self):
+        return len(os.listdir("/proc/%i/task" % self.chirc_proc.pid))
+    
+    @score(category="CONNECTION_REGISTRATION")
+    def test_mass_disconnect(self):
+        clients = self._clients_connect(1, join_channel = "#test")
+        nick1, client1 = clients[0]
+        baseline = self._threads()
+        
+        raws = [self._connect_raw("gone%i" % i) for i in range(40)]
+        for i in range(40):
+            self.get_message(client1, expect_cmd = "JOIN", expect_nparams = 1, expect_short_params = ["#test"])
+        
+        # reset them all at once, while the channel is kept busy
+        for s in raws:
+            s.setsockopt(socket.SOL_SOCKET, socket.SO_LINGER, struct.pack("ii", 1, 0))
+            s.close()
+        for i in range(20):
+            client1.send_cmd("PRIVMSG #test :Still here %i" % i)
+        client1.send_cmd("PING :alive")
+        self.get_message(client1, expect_cmd = "PONG")
+        
+        # every one of their threads is gone, and so are they
+        start = time.time()
+        while self._threads() > baseline and time.time() - start < 5:
+            time.sleep(0.1)
+        self.assertEqual(self._threads(), baseline)
+        client1.send_cmd("NAMES #test")
+        self._test_names(client1, nick1, expect_channel = "#test", expect_names = ["@" + nick1])
+
+    @score(category="CONNECTION_REGISTRATION")
+    def test_disconnect_during_queries(self):
+        clients = self._clients_connect(1, join_channel = "#test")
+        nick1, client1 = clients[0]
+        
+        raws = [self._connect_raw("gone%i" % i) for i in range(20)]
+        for i in range(20):
+            self.get_message(client1, expect_cmd = "JOIN", expect_nparams = 1, expect_short_params = ["#test"])
+        
+        # one client keeps asking about the others while they go away
+        asker = self._connect_raw("asker")
+        self.get_message(client1, expect_cmd = "JOIN", expect_nparams = 1, expect_short_params = ["#test"])
+        done = threading.Event()
+        def ask():
+            while not done.is_set():
+                try:
+                    for i in range(20):
+                        asker.sendall("LUSERS\r\nWHOIS gone%i\r\n" % i)
+                except socket.error:
+                    return
+        def drain():
+            try:
+                while asker.recv(65536):
+                    pass
+            except socket.error:
+                pass
+        threads = [threading.Thread(target = ask), threading.Thread(target = drain)]
+        for t in threads:
+            t.daemon = True
+            t.start()
+        
+        for s in raws:
+            s.setsockopt(socket.SOL_SOCKET, socket.SO_LINGER, struct.pack("ii", 1, 0))
+            s.close()
+        time.sleep(0.5)
+        done.set()
+        
+        # the server still answers, and the channel is down to the two of them
+        client1.send_cmd("PING :alive")
+        self.get_message(client1, expect_cmd = "PONG")
+        client1.send_cmd("NAMES #test")
+        self._test_names(client1, nick1, expect_channel = "#test", expect_names = ["@" + nick1, "asker"])
+        asker.close()
+
+class TeardownActors(Teardown):
+    
+    CHIRC_CONF = """channel_actors = 2
+"""
@@ -1,5 +1,6 @@
 import tests.replies as replies
 import time
+import signal
 from tests.common import ChircTestCase, ChircClient
 from tests.scores import score
 
@@ -181,4 +182,40 @@ DDD
 
         client1.send_cmd("MOTD")     
         self._test_motd(client1, "user1", expect_motd = motd)
+
+
+class ConfigReload(ChircTestCase):
+    
+    CHIRC_CONF = """# MOTD is read from first.txt until the reload
+motd = first.txt
+oper_password = ignored
+"""
+    
+    def _write_motd(self, name, motd):
+        motdf = open(self.tmpdir + "/" + name, "w")
+        motdf.write(motd)
+        motdf.close()
+    
+    @score(category="MOTD")
+    def test_config_reload_motd(self):
+        client1 = self._connect_user("user1", "User One")
+        self._write_motd("first.txt", "AAA\nBBB\n")
+        self._write_motd("second.txt", "CCC\n")
+        
+        client1.send_cmd("MOTD")
+        self._test_motd(client1, "user1", expect_motd = "AAA\nBBB\n")
+        
+        self.write_conf("motd = second.txt\n")
+        self.chirc_proc.send_signal(signal.SIGHUP)
+        time.sleep(0.2)
+        
+        # the same connection sees the new setting
+        client1.send_cmd("MOTD")
+        self._test_motd(client1, "user1", expect_motd = "CCC\n")
+    
+    @score(category="MOTD")
+    def test_config_command_line_wins(self):
+        client1 = self._connect_user("user1", "User One")
         
+        client1.send_cmd("OPER user1 ignored")
+        self.get_reply(client1, expect_code = replies.ERR_PASSWDMISMATCH, expect_nick = "user1")
@@ -709,3 +709,36 @@ class AWAY(ChircTestCase):
         client2.send_cmd("PRIVMSG #test :Hello")
         self._test_relayed_privmsg(client1, from_nick=nick2, recip="#test", msg="Hello")
         self.assertRaises(ReplyTimeoutException, self.get_reply, client2)                   
+
+class STATS(ChircTestCase):
+    
+    def _stats_pool(self, client, nick, mychans):
+        client.send_cmd("STATS m")
+        self.get_reply(client, expect_code = replies.RPL_STATSDEBUG, expect_nick = nick,
+                       expect_nparams = 1, long_param_re = "pool mychan live=%i allocs=\d+ slabs=\d+kB" % mychans)
+        self.get_reply(client, expect_code = replies.RPL_STATSDEBUG, expect_nick = nick,
+                       expect_nparams = 1, long_param_re = "pool outbuf live=0 allocs=\d+ slabs=\d+kB")
+        self.get_reply(client, expect_code = replies.RPL_STATSDEBUG, expect_nick = nick,
+                       expect_nparams = 1, long_param_re = "pool actor_job live=0 allocs=\d+ slabs=\d+kB")
+        self.get_reply(client, expect_code = replies.RPL_STATSDEBUG, expect_nick = nick,
+                       expect_nparams = 1, long_param_re = "pool caches=\d+ idle=\d+")
+        self.get_reply(client, expect_code = replies.RPL_ENDOFSTATS, expect_nick = nick,
+                       expect_short_params = ["m"])
+    
+    @score(category="MODES")
+    def test_stats_pool_memberships(self):
+        oper = self._connect_user("oper", "Operator")
+        oper.send_cmd("OPER oper %s" % OPER_PASSWD)
+        self.get_reply(oper, expect_code = replies.RPL_YOUREOPER)
+        
+        clients = self._clients_connect(3, join_channel = "#test")
+        self._stats_pool(oper, "oper", 3)
+        
+        # a part and a quit both give their membership back
+        nick2, client2 = clients[1]
+        nick3, client3 = clients[2]
+        client2.send_cmd("PART #test")
+        client3.send_cmd("QUIT")
+        self.disconnect_client(client3)
+        time.sleep(0.2)
+        self._stats_pool(oper, "oper", 1)
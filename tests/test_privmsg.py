@@ -99,6 +99,80 @@ class PRIVMSG(ChircTestCase):
                                expect_nparams = 2, expect_short_params = ["user2"],
                                long_param_re = "No such nick/channel")           
 
+    @score(category="PRIVMSG_NOTICE")
+    def test_privmsg_renamed(self):
+        client1 = self._connect_user("user1", "User One")
+        client2 = self._connect_user("user2", "User Two")
+        
+        client2.send_cmd("NICK user3")
+        self.get_message(client2, expect_prefix = True, expect_cmd = "NICK", expect_nparams = 1,
+                         long_param_re = "user3")
+        
+        # found by the new nick, and no longer by the old one
+        client1.send_cmd("PRIVMSG user3 :Hello")
+        self._test_relayed_privmsg(client2, from_nick="user1", recip="user3", msg="Hello")
+        client1.send_cmd("PRIVMSG user2 :Hello")
+        self.get_reply(client1, expect_code = replies.ERR_NOSUCHNICK, expect_nick = "user1",
+                       expect_nparams = 2, expect_short_params = ["user2"],
+                       long_param_re = "No such nick/channel")
+        
+        # and the old one is free again
+        self._connect_user("user2", "User Two Again")
+
+    @score(category="PRIVMSG_NOTICE")
+    def test_privmsg_multitarget(self):
+        client1 = self._connect_user("user1", "User One")
+        client2 = self._connect_user("user2", "User Two")
+        client3 = self._connect_user("user3", "User Three")
+        
+        client1.send_cmd("JOIN #test")
+        self._test_join(client1, "user1", "#test")
+        client2.send_cmd("JOIN #test")
+        self._test_join(client2, "user2", "#test")
+        self._test_relayed_join(client1, "user2", "#test")
+        
+        # user2 is reached both directly and through #test, but gets one copy
+        client1.send_cmd("PRIVMSG user2,#test,user3,user4 :Hello")
+        
+        self._test_relayed_privmsg(client2, from_nick="user1", recip="user2", msg="Hello")
+        self._test_relayed_privmsg(client3, from_nick="user1", recip="user3", msg="Hello")
+        self.get_reply(client1, expect_code = replies.ERR_NOSUCHNICK, expect_nick = "user1", 
+                       expect_nparams = 2, expect_short_params = ["user4"],
+                       long_param_re = "No such nick/channel")
+        self.assertRaises(ReplyTimeoutException, self.get_reply, client2)
+        self.assertRaises(ReplyTimeoutException, self.get_reply, client1)
+    
+    @score(category="PRIVMSG_NOTICE")
+    def test_privmsg_too_many_targets(self):
+        client1 = self._connect_user("user1", "User One")
+        client2 = self._connect_user("user2", "User Two")
+        
+        # the first 20 targets are honored and each one past them is refused
+        targets = ["user2"] + ["nobody%i" % i for i in range(24)]
+        client1.send_cmd("PRIVMSG %s :Hello" % ",".join(targets))
+        
+        self._test_relayed_privmsg(client2, from_nick="user1", recip="user2", msg="Hello")
+        for i in range(19):
+            self.get_reply(client1, expect_code = replies.ERR_NOSUCHNICK, expect_nick = "user1",
+                           expect_nparams = 2, expect_short_params = ["nobody%i" % i])
+        for i in range(19, 24):
+            self.get_reply(client1, expect_code = replies.ERR_TOOMANYTARGETS, expect_nick = "user1",
+                           expect_nparams = 2, expect_short_params = ["nobody%i" % i],
+                           long_param_re = "Too many recipients")
+    
+    @score(category="PRIVMSG_NOTICE")
+    def test_privmsg_empty_target(self):
+        client1 = self._connect_user("user1", "User One")
+        client2 = self._connect_user("user2", "User Two")
+        
+        client1.send_cmd("PRIVMSG user2,,user3 :Hello")
+        
+        self._test_relayed_privmsg(client2, from_nick="user1", recip="user2", msg="Hello")
+        self.get_reply(client1, expect_code = replies.ERR_NORECIPIENT, expect_nick = "user1",
+                       expect_nparams = 1, long_param_re = "No recipient given \\(PRIVMSG\\)")
+        self.get_reply(client1, expect_code = replies.ERR_NOSUCHNICK, expect_nick = "user1",
+                       expect_nparams = 2, expect_short_params = ["user3"])
+
 
 class NOTICE(ChircTestCase):
     
@@ -92,4 +92,25 @@ class WHOIS(ChircTestCase):
         
         reply = self.get_reply(users["user1"], expect_code = replies.RPL_ENDOFWHOIS, 
                                expect_nparams = 2, long_param_re = "End of WHOIS list")  
-        
\ No newline at end of file
+        
+
+class WHOISVersion(ChircTestCase):
+    
+    CHIRC_CONF = """version = chirc-whois-test
+"""
+    
+    @score(category="WHOIS")
+    def test_whois_version(self):
+        client1 = self._connect_user("user1", "User One")
+        client2 = self._connect_user("user2", "User Two")
+        
+        client1.send_cmd("WHOIS user2")
+        
+        reply = self.get_reply(client1, expect_code = replies.RPL_WHOISUSER, 
+                               expect_nparams = 5, long_param_re = "User Two")    
+        
+        reply = self.get_reply(client1, expect_code = replies.RPL_WHOISSERVER, 
+                               expect_nparams = 3, long_param_re = "chirc-whois-test")    
+        
+        reply = self.get_reply(client1, expect_code = replies.RPL_ENDOFWHOIS, 
+                               expect_nparams = 2, long_param_re = "End of WHOIS list")    